@@ -21,6 +21,7 @@
 #include <greentea-client/test_env.h>
 #include "update-client-paal/arm_uc_paal_update.h"
 #include "bootloader_common.h"
+#include "ucp_request.h"
 #include "active_application.h"
 #include "mbed.h"
 #include "mbedtls/sha256.h"
@@ -45,9 +46,6 @@ void copyAppToSDCard(uint32_t firmware_size)
 
     tr_info("ARM_UCP_Prepare\r\n");
 
-    /* clear most recent event */
-    event_callback = CLEAR_EVENT;
-
     arm_uc_buffer_t temp_buffer = {
         .size_max = BUFFER_SIZE,
         .size     = 0,
@@ -55,14 +53,10 @@ void copyAppToSDCard(uint32_t firmware_size)
     };
 
     /* prepare UCP to receive new image */
-    arm_uc_error_t ucp_status = ARM_UCP_Prepare(0, &details, &temp_buffer);
+    ucp_request_t request;
+    ucpRequestPrepare(&request, 0, &details, &temp_buffer);
 
-    /* wait for event if call was accepted */
-    if (ucp_status.error == ERR_NONE) {
-        while (event_callback == CLEAR_EVENT) {
-            __WFI();
-        }
-    } else {
+    if (!ucpRun(&request)) {
         tr_error("ARM_UCP_Prepare failed\r\n");
     }
 
@@ -76,18 +70,10 @@ void copyAppToSDCard(uint32_t firmware_size)
         .ptr      = (uint8_t *) appStart
     };
 
-    /* clear most recent event */
-    event_callback = CLEAR_EVENT;
-
-    /* prepare UCP to receive new image */
-    ucp_status = ARM_UCP_Write(0, 0, &write_buffer);
+    /* write the active image to the slot */
+    ucpRequestWrite(&request, 0, 0, &write_buffer);
 
-    /* wait for event if call was accepted */
-    if (ucp_status.error == ERR_NONE) {
-        while (event_callback == CLEAR_EVENT) {
-            __WFI();
-        }
-    } else {
+    if (!ucpRun(&request)) {
         tr_error("ARM_UCP_Write failed\r\n");
     }
 
@@ -95,18 +81,10 @@ void copyAppToSDCard(uint32_t firmware_size)
 
     tr_info("ARM_UCP_Finalize\r\n");
 
-    /* clear most recent event */
-    event_callback = CLEAR_EVENT;
-
-    /* prepare UCP to receive new image */
-    ucp_status = ARM_UCP_Finalize(0);
+    /* finalize the slot */
+    ucpRequestFinalize(&request, 0);
 
-    /* wait for event if call was accepted */
-    if (ucp_status.error == ERR_NONE) {
-        while (event_callback == CLEAR_EVENT) {
-            __WFI();
-        }
-    } else {
+    if (!ucpRun(&request)) {
         tr_error("ARM_UCP_Finalize failed\r\n");
     }
 }
@@ -0,0 +1,397 @@
+#!/usr/bin/env python
+# ----------------------------------------------------------------------------
+# Copyright 2018 ARM Ltd.
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ----------------------------------------------------------------------------
+
+"""Benchmark the boot time of the bootloader on the host build.
+
+Every scenario pairs an application config with a target, as in configs/,
+and is built for one or more firmware storage slot counts. Each build then
+boots three cases against the timing model of its MCU and storage:
+
+  update      the active image is older than the images in the slots
+  up_to_date  the next boot, with nothing to install
+  corrupt     a newer slot image fails its integrity check
+
+The results are written as one JSON document with the simulated boot time
+per phase, the host CPU time and the flash and storage traffic of every
+case. Given a baseline from an earlier run, cases that became slower than
+the threshold, or that changed outcome, are reported and the exit status
+is 1.
+
+Some scenarios only differ from another one in their macros or images,
+the update cases of these pairs are listed side by side at the end.
+"""
+
+import argparse
+import hashlib
+import json
+import os
+import shutil
+import subprocess
+import sys
+
+HOST_DIR = os.path.dirname(os.path.abspath(__file__))
+ROOT_DIR = os.path.dirname(HOST_DIR)
+
+# name: (config, target, image size, slot counts, extra bootloader_host
+#        options, macros, images)
+# images are "random", which does not compress, "firmware", which compresses
+# about as well as code, or "lz4", the same compressed with
+# tools/compress_image.py
+SCENARIOS = [
+    ("k64f-sd", "mbed_app.json", "K64F", 256 * 1024, [1, 2, 4], [],
+     "", "random"),
+    ("l476-sd", "mbed_app.json", "NUCLEO_L476RG", 256 * 1024, [1, 2, 4], [],
+     "", "random"),
+    ("f429-sd", "mbed_app.json", "NUCLEO_F429ZI", 256 * 1024, [1, 2, 4],
+     ["--sectors", "16Kx4,64K,128K"], "", "random"),
+    ("k64f-internal", "configs/internal_flash_fake_rot.json", "K64F",
+     192 * 1024, [1], [], "", "random"),
+    ("f429-internal", "configs/internal_flash_fake_rot.json", "NUCLEO_F429ZI",
+     256 * 1024, [1], ["--sectors", "16Kx4,64K,128K"], "", "random"),
+    ("nrf52-internal", "configs/nrf52_internal_flash_fake_rot.json", "NRF52_DK",
+     160 * 1024, [1], [], "", "random"),
+    ("nrf52-sd", "configs/nrf52_block_device_fake_rot.json", "NRF52_DK",
+     256 * 1024, [1, 2, 4], [], "", "random"),
+    ("k64f-sd-raw", "mbed_app.json", "K64F", 256 * 1024, [1], [],
+     "-DCOMPRESSED_IMAGES=1", "firmware"),
+    ("k64f-sd-lz4", "mbed_app.json", "K64F", 256 * 1024, [1], [],
+     "-DCOMPRESSED_IMAGES=1", "lz4"),
+    ("k64f-sd-page", "mbed_app.json", "K64F", 256 * 1024, [1], [],
+     "-DPROGRAM_RUN_SIZE=8", "random"),
+    ("k64f-sd-sector", "mbed_app.json", "K64F", 256 * 1024, [1], [],
+     "-DERASE_RUN_SIZE=4096", "random"),
+]
+
+# (scenario, reference scenario, what is compared)
+COMPARISONS = [
+    ("k64f-sd-lz4", "k64f-sd-raw", "decompress and program against a raw copy"),
+    ("k64f-sd-page", "k64f-sd", "program page by page against sector runs"),
+    ("k64f-sd-sector", "k64f-sd", "erase sector by sector against sector runs"),
+]
+
+CASES = ["update", "up_to_date", "corrupt"]
+
+
+def image(size, seed):
+    """Deterministic content that does not compress or repeat."""
+    blocks = []
+    for counter in range((size + 31) // 32):
+        blocks.append(hashlib.sha256(("%s:%d" % (seed, counter)).encode()).digest())
+    return b"".join(blocks)[:size]
+
+
+def firmware_image(size, seed):
+    """Deterministic content that compresses to about 60%, like code.
+
+    Half of the 16 byte blocks repeat one of the 255 blocks before them,
+    within the window of the bootloader's decompressor.
+    """
+    blocks = []
+    for counter in range((size + 15) // 16):
+        digest = hashlib.sha256(("%s:%d" % (seed, counter)).encode()).digest()
+        if counter > 0 and digest[0] < 128:
+            blocks.append(blocks[counter - 1 - digest[1] % min(counter, 255)])
+        else:
+            blocks.append(digest[:16])
+    return b"".join(blocks)[:size]
+
+
+def derived_config(config, target, slots, path):
+    """Copy of an application config with another slot count."""
+    with open(os.path.join(ROOT_DIR, config)) as config_file:
+        data = json.load(config_file)
+
+    data["target_overrides"][target]["update-client.storage-locations"] = slots
+    text = json.dumps(data, indent=4, sort_keys=True)
+
+    # left alone when unchanged, so make does not rebuild
+    if os.path.exists(path):
+        with open(path) as current:
+            if current.read() == text:
+                return
+
+    with open(path, "w") as output:
+        output.write(text)
+
+
+class Build(object):
+    """One scenario built for one slot count."""
+
+    def __init__(self, args, scenario, slots):
+        (self.name, self.config, self.target, self.image_size, _,
+         self.options, self.macros, self.images) = scenario
+        self.slots = slots
+        self.key = "%s/%d" % (self.name, slots)
+        self.directory = os.path.join(os.path.abspath(args.build),
+                                      "%s-%d" % (self.name, slots))
+        self.program = os.path.join(self.directory, "bootloader_host")
+        self.run_directory = os.path.join(self.directory, "run")
+        self.json = os.path.join(self.run_directory, "boots.json")
+        self.verbose = args.verbose
+
+    def make(self, args):
+        if not os.path.isdir(self.directory):
+            os.makedirs(self.directory)
+
+        config = os.path.join(self.directory, "config.json")
+        derived_config(self.config, self.target, self.slots, config)
+
+        command = ["make", "-C", HOST_DIR, "-s",
+                   "TARGET=%s" % self.target,
+                   "CONFIG=%s" % config,
+                   "BUILD=%s" % self.directory,
+                   "DEFINES=%s" % " ".join(filter(None, [self.macros, args.defines])),
+                   "PYTHON=%s" % args.python]
+        if args.mbed_os:
+            command.append("MBED_OS=%s" % os.path.abspath(args.mbed_os))
+        if args.cloud_client:
+            command.append("CLOUD_CLIENT=%s" % os.path.abspath(args.cloud_client))
+
+        subprocess.check_call(command)
+
+    def host(self, *arguments):
+        command = [self.program] + self.options + list(arguments)
+        output = None if self.verbose else open(os.devnull, "w")
+
+        try:
+            return subprocess.call(command, cwd=self.run_directory,
+                                   stdout=output, stderr=output)
+        finally:
+            if output:
+                output.close()
+
+    def write_image(self, version):
+        """Write the image of a version.
+
+        @return the file to store and the options that go with it.
+        """
+        path = os.path.join(self.run_directory, "v%d.bin" % version)
+        seed = "%s-%d" % (self.name, version)
+        with open(path, "wb") as output:
+            if self.images == "random":
+                output.write(image(self.image_size, seed))
+            else:
+                output.write(firmware_image(self.image_size, seed))
+
+        if self.images != "lz4":
+            return path, []
+
+        # the header carries the hash of the uncompressed image
+        compressed = os.path.join(self.run_directory, "v%d.lz" % version)
+        with open(os.devnull, "w") as null:
+            subprocess.check_call([sys.executable,
+                                   os.path.join(ROOT_DIR, "tools", "compress_image.py"),
+                                   path, compressed], stdout=null)
+        return compressed, ["--hash-of", path]
+
+    def prepare(self, *arguments):
+        if self.host(*arguments) != 0:
+            raise RuntimeError("%s: %s failed" % (self.key, " ".join(arguments)))
+
+    def boot(self):
+        """Boot once and return the JSON line it appended."""
+        if os.path.exists(self.json):
+            os.remove(self.json)
+
+        self.host("--json", "boots.json", "boot")
+
+        with open(self.json) as boots:
+            return json.loads(boots.readline())
+
+    def run(self):
+        if os.path.isdir(self.run_directory):
+            shutil.rmtree(self.run_directory)
+        os.makedirs(self.run_directory)
+
+        # version 1 is active, the newest image is in the last slot
+        active = os.path.join(self.run_directory, "v1.bin")
+        with open(active, "wb") as output:
+            output.write(image(self.image_size, "%s-1" % self.name))
+        self.prepare("flash", active, "1")
+
+        for slot in range(self.slots):
+            path, options = self.write_image(slot + 2)
+            self.prepare(*(options + ["store", str(slot), path, str(slot + 2)]))
+
+        boots = {"update": self.boot(), "up_to_date": self.boot()}
+
+        newest = self.slots + 2
+        path, options = self.write_image(newest)
+        self.prepare(*(options + ["--corrupt", str(os.path.getsize(path) // 2),
+                                  "store", "0", path, str(newest)]))
+        boots["corrupt"] = self.boot()
+
+        results = []
+        for case in CASES:
+            result = {"key": "%s/%s" % (self.key, case),
+                      "scenario": self.name,
+                      "config": self.config,
+                      "target": self.target,
+                      "slots": self.slots,
+                      "image_size": self.image_size,
+                      "case": case}
+            result.update(boots[case])
+            del result["boot"]
+            results.append(result)
+
+        return results
+
+
+def commit():
+    try:
+        with open(os.devnull, "w") as null:
+            output = subprocess.check_output(["git", "rev-parse", "HEAD"],
+                                             cwd=ROOT_DIR, stderr=null)
+        return output.decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def print_results(results):
+    print("%-28s %7s %10s %10s %10s %10s %10s %10s %9s %8s %6s" %
+          ("case", "forward", "total ms", "active ms", "scan ms", "erase ms",
+           "program ms", "verify ms", "CPU ms", "programs", "erases"))
+
+    for result in results:
+        simulated = result["simulated_us"]
+        print("%-28s %7s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %9.1f %8d %6d" %
+              (result["key"], "yes" if result["forward"] else "no",
+               simulated["total"] / 1000.0, simulated["active_check"] / 1000.0,
+               simulated["slot_scan"] / 1000.0, simulated["erase"] / 1000.0,
+               simulated["program"] / 1000.0, simulated["verify"] / 1000.0,
+               result["cpu_us"]["total"] / 1000.0,
+               result["flash"]["programs"], result["flash"]["erases"]))
+
+
+def print_comparisons(results):
+    """Print the update case of each compared scenario and its reference."""
+    updates = dict((result["scenario"], result) for result in results
+                   if result["case"] == "update" and result["slots"] == 1)
+
+    for scenario, reference, title in COMPARISONS:
+        if scenario not in updates or reference not in updates:
+            continue
+
+        print("")
+        print("%s:" % title)
+        print("%-28s %10s %10s %10s %12s %8s %14s %6s %10s" %
+              ("case", "total ms", "scan ms", "install ms", "image KiB/s",
+               "programs", "program KiB/s", "erases", "erased KiB"))
+
+        for name in (reference, scenario):
+            result = updates[name]
+            simulated = result["simulated_us"]
+            install = simulated["erase"] + simulated["program"] + simulated["verify"]
+
+            # image bytes installed per second of slot scan and install, and
+            # bytes programmed per second of programming
+            print("%-28s %10.1f %10.1f %10.1f %12.1f %8d %14.1f %6d %10.1f" %
+                  (result["key"], simulated["total"] / 1000.0,
+                   simulated["slot_scan"] / 1000.0, install / 1000.0,
+                   result["image_size"] / 1024.0 /
+                   max(simulated["slot_scan"] + install, 1) * 1000000.0,
+                   result["flash"]["programs"],
+                   result["flash"]["program_bytes"] / 1024.0 /
+                   max(simulated["program"], 1) * 1000000.0,
+                   result["flash"]["erases"],
+                   result["flash"]["erase_bytes"] / 1024.0))
+
+
+def compare(results, baseline, threshold):
+    """Print the cases that regressed against a baseline.
+
+    @return the number of regressions.
+    """
+    previous = dict((result["key"], result) for result in baseline["results"])
+    regressions = 0
+
+    for result in results:
+        old = previous.get(result["key"])
+
+        if old is None:
+            continue
+
+        before = old["simulated_us"]["total"]
+        after = result["simulated_us"]["total"]
+
+        if result["forward"] != old["forward"]:
+            print("REGRESSION %s: forward changed from %s to %s" %
+                  (result["key"], old["forward"], result["forward"]))
+            regressions += 1
+        elif after > before * (1 + threshold / 100.0):
+            print("REGRESSION %s: %.1f ms -> %.1f ms (+%.1f%%)" %
+                  (result["key"], before / 1000.0, after / 1000.0,
+                   (after - before) * 100.0 / max(before, 1)))
+            regressions += 1
+
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-o", "--output", default="benchmark.json",
+                        help="results file (benchmark.json)")
+    parser.add_argument("--baseline", help="results of an earlier run")
+    parser.add_argument("--threshold", type=float, default=2.0,
+                        help="allowed slow down in percent (2.0)")
+    parser.add_argument("--filter", default="",
+                        help="only run scenarios whose name contains FILTER")
+    parser.add_argument("--build", default=os.path.join(HOST_DIR, "BUILD", "bench"),
+                        help="build directory (BUILD/bench)")
+    parser.add_argument("--defines", default="",
+                        help="macros for all builds, e.g. -DLAZY_ERASE=1")
+    parser.add_argument("--mbed-os", help="mbed-os directory")
+    parser.add_argument("--cloud-client", help="mbed-cloud-client directory")
+    parser.add_argument("--python", default=sys.executable,
+                        help="python for mbed_config.py")
+    parser.add_argument("-v", "--verbose", action="store_true",
+                        help="show the bootloader output")
+    args = parser.parse_args()
+
+    builds = []
+    for scenario in SCENARIOS:
+        if args.filter in scenario[0]:
+            builds.extend(Build(args, scenario, slots) for slots in scenario[4])
+
+    if not builds:
+        sys.exit("no scenario matches \"%s\"" % args.filter)
+
+    results = []
+    for build in builds:
+        build.make(args)
+        results.extend(build.run())
+
+    with open(args.output, "w") as output:
+        json.dump({"commit": commit(), "defines": args.defines,
+                   "results": results}, output, indent=2, sort_keys=True)
+        output.write("\n")
+
+    print_results(results)
+    print_comparisons(results)
+
+    if args.baseline:
+        with open(args.baseline) as baseline:
+            if compare(results, json.load(baseline), args.threshold):
+                sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
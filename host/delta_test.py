@@ -0,0 +1,216 @@
+#!/usr/bin/env python
+# ----------------------------------------------------------------------------
+# Copyright 2018 ARM Ltd.
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ----------------------------------------------------------------------------
+
+"""Install delta patches on the host build.
+
+Builds the bootloader for K64F with DELTA_UPDATE=1, alone and together
+with SINGLE_PASS_INSTALL=1, and for each build:
+
+  patch       a patch in slot 0 rebuilds the new firmware from the active
+              one, with the old image in slot 1 to recover from
+  corrupt     a corrupt patch is rejected and the active firmware kept
+  nofallback  a patch without a full image in another slot is refused
+              and the active firmware kept
+  powercut    a power cut at every program and erase call of the patch
+              install, with the full new image in slot 1 to recover from
+  powercut-old
+              the same with the old image in slot 1, which is installed
+              again before the patch is applied once more
+
+The patches are made with tools/delta_patch.py. The exit status is 1 if
+any case fails.
+"""
+
+import argparse
+import os
+import shutil
+import subprocess
+import sys
+
+from benchmark import HOST_DIR, ROOT_DIR, derived_config, image
+
+TARGET = "K64F"
+CONFIG = "mbed_app.json"
+SECTOR_SIZE = 4096
+APPLICATION_START = 0xA400
+
+# name: macros
+BUILDS = [
+    ("delta", "-DDELTA_UPDATE=1"),
+    ("delta-single-pass", "-DDELTA_UPDATE=1 -DSINGLE_PASS_INSTALL=1 "
+                          "-DVERIFY_DURING_COPY=1"),
+]
+
+
+def new_image(old):
+    """The old image with a few changed blocks and a longer tail."""
+    new = bytearray(old)
+    for offset in range(0, len(new), 5000):
+        new[offset:offset + 64] = image(64, "change-%d" % offset)
+    return bytes(new) + image(3000, "tail")
+
+
+class Build(object):
+    """One set of macros built for two slots."""
+
+    def __init__(self, args, name, defines):
+        self.name = name
+        self.defines = defines
+        self.directory = os.path.join(os.path.abspath(args.build), name)
+        self.program = os.path.join(self.directory, "bootloader_host")
+        self.run_directory = os.path.join(self.directory, "run")
+        self.verbose = args.verbose
+
+    def make(self, args):
+        if not os.path.isdir(self.directory):
+            os.makedirs(self.directory)
+
+        config = os.path.join(self.directory, "config.json")
+        derived_config(CONFIG, TARGET, 2, config)
+
+        command = ["make", "-C", HOST_DIR, "-s",
+                   "TARGET=%s" % TARGET,
+                   "CONFIG=%s" % config,
+                   "BUILD=%s" % self.directory,
+                   "DEFINES=%s" % self.defines,
+                   "PYTHON=%s" % args.python]
+        if args.mbed_os:
+            command.append("MBED_OS=%s" % os.path.abspath(args.mbed_os))
+        if args.cloud_client:
+            command.append("CLOUD_CLIENT=%s" % os.path.abspath(args.cloud_client))
+
+        subprocess.check_call(command)
+
+    def host(self, *arguments):
+        output = None if self.verbose else open(os.devnull, "w")
+
+        try:
+            return subprocess.call([self.program] + list(arguments),
+                                   cwd=self.run_directory,
+                                   stdout=output, stderr=output)
+        finally:
+            if output:
+                output.close()
+
+    def prepare(self, *arguments):
+        if self.host(*arguments) != 0:
+            raise RuntimeError("%s: %s failed" % (self.name, " ".join(arguments)))
+
+    def reset(self, old):
+        """Start over with the old firmware active and empty slots."""
+        if os.path.isdir(self.run_directory):
+            shutil.rmtree(self.run_directory)
+        os.makedirs(self.run_directory)
+
+        for name, content in old:
+            with open(os.path.join(self.run_directory, name), "wb") as output:
+                output.write(content)
+
+        self.prepare("flash", "old.bin", "1")
+
+    def active(self, size):
+        with open(os.path.join(self.run_directory, "flash.bin"), "rb") as flash:
+            flash.seek(APPLICATION_START)
+            return flash.read(size)
+
+    def run(self, old, new, patch):
+        files = [("old.bin", old), ("new.bin", new), ("patch.bin", patch)]
+        results = []
+
+        self.reset(files)
+        self.prepare("store", "0", "patch.bin", "2")
+        self.prepare("store", "1", "old.bin", "1")
+        results.append(("patch", (self.host("boot") == 0) and
+                        (self.active(len(new)) == new)))
+
+        self.reset(files)
+        self.prepare("--corrupt", str(len(patch) // 2), "store", "0",
+                     "patch.bin", "2")
+        self.prepare("store", "1", "old.bin", "1")
+        results.append(("corrupt", (self.host("boot") == 0) and
+                        (self.active(len(old)) == old)))
+
+        self.reset(files)
+        self.prepare("store", "0", "patch.bin", "2")
+        results.append(("nofallback", (self.host("boot") == 0) and
+                        (self.active(len(old)) == old)))
+
+        self.reset(files)
+        self.prepare("store", "0", "patch.bin", "2")
+        self.prepare("store", "1", "new.bin", "2")
+        results.append(("powercut", self.host("powercut") == 0))
+
+        self.reset(files)
+        self.prepare("store", "0", "patch.bin", "2")
+        self.prepare("store", "1", "old.bin", "1")
+        results.append(("powercut-old", self.host("powercut") == 0))
+
+        return results
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--build", default=os.path.join(HOST_DIR, "BUILD", "delta"),
+                        help="build directory (BUILD/delta)")
+    parser.add_argument("--mbed-os", help="mbed-os directory")
+    parser.add_argument("--cloud-client", help="mbed-cloud-client directory")
+    parser.add_argument("--python", default=sys.executable,
+                        help="python for mbed_config.py")
+    parser.add_argument("-v", "--verbose", action="store_true",
+                        help="show the bootloader output")
+    args = parser.parse_args()
+
+    old = image(40000, "delta-old")
+    new = new_image(old)
+    build_directory = os.path.abspath(args.build)
+
+    if not os.path.isdir(build_directory):
+        os.makedirs(build_directory)
+
+    paths = [os.path.join(build_directory, name)
+             for name in ("old.bin", "new.bin", "patch.bin")]
+    for path, content in zip(paths, (old, new)):
+        with open(path, "wb") as output:
+            output.write(content)
+
+    subprocess.check_call([args.python,
+                           os.path.join(ROOT_DIR, "tools", "delta_patch.py"),
+                           "--sector-size", str(SECTOR_SIZE),
+                           "--app-start", hex(APPLICATION_START)] + paths)
+
+    with open(paths[2], "rb") as patch_file:
+        patch = patch_file.read()
+
+    failures = 0
+    for name, defines in BUILDS:
+        build = Build(args, name, defines)
+        build.make(args)
+
+        for case, passed in build.run(old, new, patch):
+            print("%-20s %-12s %s" % (name, case, "ok" if passed else "FAIL"))
+            failures += 0 if passed else 1
+
+    if failures:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
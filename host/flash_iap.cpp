@@ -0,0 +1,577 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#include "host.h"
+#include "mbed.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <vector>
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+/* read the internal flash through its memory map, see active_application.cpp */
+#ifndef MEMORY_MAPPED_FLASH
+#define MEMORY_MAPPED_FLASH 0
+#endif
+
+#define MBED_FLASH_INVALID_SIZE 0xFFFFFFFF
+
+/* run of equal sized sectors */
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+    uint32_t sector_size;
+} sector_run_t;
+
+/* region rejected by program and erase */
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+} read_only_t;
+
+host_stats_t hostStats;
+
+static int flashFile = -1;
+static uint8_t *flashMemory = NULL;
+static uint32_t flashStart = 0;
+static uint32_t flashSize = 0;
+static uint32_t flashPageSize = 0;
+static uint8_t flashEraseValue = 0xFF;
+static std::vector<sector_run_t> sectorRuns;
+static std::vector<read_only_t> readOnly;
+
+/* power cut during a program or erase call */
+static uint32_t flashOperations = 0;
+static uint32_t flashCutAt = 0;
+static host_power_cut_t *flashCutReport = NULL;
+static uint32_t flashCutRandom = 0;
+
+/**
+ * Parse a size with an optional K or M suffix
+ * @return the size, 0 if it is not valid.
+ */
+static uint32_t parseSize(const char *text, char **end)
+{
+    unsigned long value = strtoul(text, end, 0);
+
+    if (**end == 'K' || **end == 'k') {
+        value *= 1024;
+        (*end)++;
+    } else if (**end == 'M' || **end == 'm') {
+        value *= 1024 * 1024;
+        (*end)++;
+    }
+
+    return (uint32_t) value;
+}
+
+/**
+ * Build the sector map from "SIZE[xCOUNT],..."
+ * @detail The last run is extended to the end of the flash.
+ */
+static bool parseSectorMap(const char *sectors)
+{
+    uint32_t address = flashStart;
+    const char *text = sectors;
+
+    sectorRuns.clear();
+
+    while ((*text != '\0') && (address < flashStart + flashSize)) {
+        char *end = NULL;
+        uint32_t sectorSize = parseSize(text, &end);
+        uint32_t count = 0;
+
+        if (*end == 'x' || *end == '*') {
+            count = strtoul(end + 1, &end, 0);
+        } else {
+            count = 1;
+        }
+
+        if ((sectorSize == 0) || (count == 0) ||
+                (sectorSize % flashPageSize != 0) ||
+                ((*end != ',') && (*end != '\0'))) {
+            fprintf(stderr, "flash: invalid sector map \"%s\"\n", sectors);
+            return false;
+        }
+
+        /* the last run repeats to the end of the flash */
+        if (*end == '\0') {
+            count = (flashStart + flashSize - address) / sectorSize;
+        }
+
+        sector_run_t run;
+        run.start = address;
+        run.end = address + sectorSize * count;
+        run.sector_size = sectorSize;
+        sectorRuns.push_back(run);
+
+        address = run.end;
+        text = (*end == ',') ? end + 1 : end;
+    }
+
+    if (address != flashStart + flashSize) {
+        fprintf(stderr, "flash: sector map covers 0x%08X-0x%08X instead of "
+                "0x%08X-0x%08X\n", flashStart, address,
+                flashStart, flashStart + flashSize);
+        return false;
+    }
+
+    return true;
+}
+
+static bool inFlash(uint32_t address, uint32_t size)
+{
+    return (address >= flashStart) &&
+           (size <= flashSize) &&
+           (address - flashStart <= flashSize - size);
+}
+
+/**
+ * Stop on a program or erase of a read-only region
+ */
+static void checkWritable(const char *operation, uint32_t address, uint32_t size)
+{
+    for (size_t index = 0; index < readOnly.size(); index++) {
+        if ((address < readOnly[index].end) &&
+                (address + size > readOnly[index].start)) {
+            fprintf(stderr, "flash: %s of 0x%08X-0x%08X touches read-only "
+                    "region 0x%08X-0x%08X\n", operation, address,
+                    address + size, readOnly[index].start,
+                    readOnly[index].end);
+            abort();
+        }
+    }
+}
+
+bool hostFlashOpen(const host_flash_config_t *config)
+{
+    flashStart = config->start;
+    flashSize = config->size;
+    flashPageSize = config->page_size;
+    flashEraseValue = config->erase_value;
+
+    if ((flashSize == 0) || (flashPageSize == 0) ||
+            !parseSectorMap(config->sectors)) {
+        return false;
+    }
+
+    flashFile = open(config->path, O_RDWR | O_CREAT, 0644);
+
+    if (flashFile < 0) {
+        fprintf(stderr, "flash: cannot open %s: %s\n", config->path,
+                strerror(errno));
+        return false;
+    }
+
+    /* a new or short file is erased flash */
+    struct stat status;
+    fstat(flashFile, &status);
+
+    if ((uint64_t) status.st_size < flashSize) {
+        std::vector<uint8_t> erased(flashSize - status.st_size, flashEraseValue);
+
+        if (pwrite(flashFile, &erased[0], erased.size(), status.st_size) !=
+                (ssize_t) erased.size()) {
+            fprintf(stderr, "flash: cannot extend %s\n", config->path);
+            hostFlashClose();
+            return false;
+        }
+    }
+
+#if MEMORY_MAPPED_FLASH
+    /* the bootloader reads the flash at its own addresses */
+    void *memory = mmap((void *)(uintptr_t) flashStart, flashSize, PROT_READ,
+                        MAP_SHARED | MAP_FIXED_NOREPLACE, flashFile, 0);
+
+    if ((memory != MAP_FAILED) && (memory != (void *)(uintptr_t) flashStart)) {
+        munmap(memory, flashSize);
+        memory = MAP_FAILED;
+    }
+
+    if (memory == MAP_FAILED) {
+        fprintf(stderr, "flash: cannot map the flash at 0x%08X, build with "
+                "MEMORY_MAPPED_FLASH=0\n", flashStart);
+        hostFlashClose();
+        return false;
+    }
+#else
+    void *memory = mmap(NULL, flashSize, PROT_READ, MAP_SHARED, flashFile, 0);
+
+    if (memory == MAP_FAILED) {
+        fprintf(stderr, "flash: cannot map %s\n", config->path);
+        hostFlashClose();
+        return false;
+    }
+#endif
+
+    flashMemory = (uint8_t *) memory;
+
+    return true;
+}
+
+bool hostFlashPrivate(void)
+{
+    FILE *copy = tmpfile();
+    int file = copy ? dup(fileno(copy)) : -1;
+
+    if (copy) {
+        fclose(copy);
+    }
+
+    if (!flashMemory || (file < 0) ||
+            (pwrite(file, flashMemory, flashSize, 0) != (ssize_t) flashSize) ||
+            (mmap(flashMemory, flashSize, PROT_READ, MAP_SHARED | MAP_FIXED,
+                  file, 0) != flashMemory)) {
+        fprintf(stderr, "flash: cannot copy the flash\n");
+
+        if (file >= 0) {
+            close(file);
+        }
+
+        return false;
+    }
+
+    close(flashFile);
+    flashFile = file;
+
+    return true;
+}
+
+void hostFlashClose(void)
+{
+    if (flashMemory) {
+        munmap(flashMemory, flashSize);
+        flashMemory = NULL;
+    }
+
+    if (flashFile >= 0) {
+        close(flashFile);
+        flashFile = -1;
+    }
+
+    readOnly.clear();
+}
+
+bool hostFlashReadOnly(uint32_t address, uint32_t size)
+{
+    if (!inFlash(address, size)) {
+        return false;
+    }
+
+    read_only_t region;
+    region.start = address;
+    region.end = address + size;
+    readOnly.push_back(region);
+
+    return true;
+}
+
+bool hostFlashRead(uint32_t address, void *buffer, uint32_t size)
+{
+    if (!flashMemory || !inFlash(address, size)) {
+        return false;
+    }
+
+    memcpy(buffer, &flashMemory[address - flashStart], size);
+
+    return true;
+}
+
+bool hostFlashWrite(uint32_t address, const void *buffer, uint32_t size)
+{
+    return flashMemory && inFlash(address, size) &&
+           (pwrite(flashFile, buffer, size, address - flashStart) == (ssize_t) size);
+}
+
+uint32_t hostFlashSectorSize(uint32_t address)
+{
+    for (size_t index = 0; index < sectorRuns.size(); index++) {
+        if ((address >= sectorRuns[index].start) &&
+                (address < sectorRuns[index].end)) {
+            return sectorRuns[index].sector_size;
+        }
+    }
+
+    return 0;
+}
+
+bool hostFlashMapped(const void *pointer, uint32_t *address)
+{
+    const uint8_t *byte = (const uint8_t *) pointer;
+
+    if (!flashMemory || (byte < flashMemory) ||
+            (byte >= flashMemory + flashSize)) {
+        return false;
+    }
+
+    *address = flashStart + (uint32_t)(byte - flashMemory);
+
+    return true;
+}
+
+void hostFlashPowerCut(uint32_t operation, host_power_cut_t *report)
+{
+    flashOperations = 0;
+    flashCutAt = operation;
+    flashCutReport = report;
+
+    /* the same cut point always tears the same way */
+    flashCutRandom = operation * 2654435761U + 1;
+
+    if (report) {
+        memset(report, 0, sizeof(*report));
+        report->dirty_start = UINT32_MAX;
+    }
+}
+
+uint32_t hostFlashOperations(void)
+{
+    return flashOperations;
+}
+
+static uint32_t cutRandom(void)
+{
+    /* xorshift32 */
+    flashCutRandom ^= flashCutRandom << 13;
+    flashCutRandom ^= flashCutRandom >> 17;
+    flashCutRandom ^= flashCutRandom << 5;
+
+    return flashCutRandom;
+}
+
+static void markDirty(uint32_t address, uint32_t size)
+{
+    if (flashCutReport) {
+        if (address < flashCutReport->dirty_start) {
+            flashCutReport->dirty_start = address;
+        }
+
+        if (address + size > flashCutReport->dirty_end) {
+            flashCutReport->dirty_end = address + size;
+        }
+    }
+}
+
+/* pages are programmed and sectors erased one at a time */
+static uint32_t cutUnit(const uint8_t *data, uint32_t address)
+{
+    return data ? flashPageSize : hostFlashSectorSize(address);
+}
+
+/**
+ * Complete part of a program or erase call and cut the power
+ * @param  data  Data programmed, NULL for an erase.
+ */
+static void powerCut(const uint8_t *data, uint32_t address, uint32_t size)
+{
+    uint32_t units = 0;
+
+    for (uint32_t offset = 0; offset < size;
+            offset += cutUnit(data, address + offset)) {
+        units++;
+    }
+
+    uint32_t done = 0;
+
+    for (uint32_t unit = cutRandom() % (units + 1); unit > 0; unit--) {
+        done += cutUnit(data, address + done);
+    }
+
+    uint32_t torn = (done < size) ? cutUnit(data, address + done) : 0;
+
+    if (done + torn > 0) {
+        std::vector<uint8_t> content(done + torn, flashEraseValue);
+
+        if (data) {
+            memcpy(&content[0], data, content.size());
+        }
+
+        /* bits of the torn unit may not have reached their new value */
+        const uint8_t *current = &flashMemory[address - flashStart];
+
+        for (uint32_t offset = done; offset < content.size(); offset++) {
+            uint8_t changed = current[offset] ^ content[offset];
+            content[offset] ^= changed & (uint8_t) cutRandom();
+        }
+
+        hostFlashWrite(address, &content[0], content.size());
+        markDirty(address, content.size());
+    }
+
+    if (flashCutReport) {
+        flashCutReport->operation = flashOperations;
+        flashCutReport->erase = data ? 0 : 1;
+        flashCutReport->address = address;
+        flashCutReport->size = size;
+        flashCutReport->done = done;
+    }
+
+    fflush(stdout);
+    _exit(HOST_EXIT_POWER_CUT);
+}
+
+/* start of the sector holding an address */
+static uint32_t sectorStart(uint32_t address)
+{
+    for (size_t index = 0; index < sectorRuns.size(); index++) {
+        const sector_run_t &run = sectorRuns[index];
+
+        if ((address >= run.start) && (address < run.end)) {
+            return address - (address - run.start) % run.sector_size;
+        }
+    }
+
+    return MBED_FLASH_INVALID_SIZE;
+}
+
+int FlashIAP::init()
+{
+    return flashMemory ? 0 : -1;
+}
+
+int FlashIAP::deinit()
+{
+    return 0;
+}
+
+int FlashIAP::read(void *buffer, uint32_t addr, uint32_t size)
+{
+    if (!hostFlashRead(addr, buffer, size)) {
+        return -1;
+    }
+
+    hostStats.flash_reads++;
+    hostStats.flash_read_bytes += size;
+    hostTimingFlashRead(buffer, size);
+
+    return 0;
+}
+
+int FlashIAP::program(const void *buffer, uint32_t addr, uint32_t size)
+{
+    if (!flashMemory || !inFlash(addr, size) ||
+            (addr % flashPageSize != 0) || (size % flashPageSize != 0)) {
+        fprintf(stderr, "flash: program of 0x%08X-0x%08X is not page aligned "
+                "or outside the flash\n", addr, addr + size);
+        return -1;
+    }
+
+    checkWritable("program", addr, size);
+
+    /* programming can only move bits away from the erase value */
+    const uint8_t *data = (const uint8_t *) buffer;
+    const uint8_t *current = &flashMemory[addr - flashStart];
+
+    for (uint32_t offset = 0; offset < size; offset++) {
+        uint8_t result = (flashEraseValue == 0xFF) ?
+                         (uint8_t)(current[offset] & data[offset]) :
+                         (uint8_t)(current[offset] | data[offset]);
+
+        if (result != data[offset]) {
+            fprintf(stderr, "flash: program of 0x%08X over data that is not "
+                    "erased\n", addr + offset);
+            abort();
+        }
+    }
+
+    if (++flashOperations == flashCutAt) {
+        powerCut(data, addr, size);
+    }
+
+    if (!hostFlashWrite(addr, buffer, size)) {
+        return -1;
+    }
+
+    markDirty(addr, size);
+
+    hostStats.flash_programs++;
+    hostStats.flash_program_bytes += size;
+    hostTimingProgram(size);
+
+    return 0;
+}
+
+int FlashIAP::erase(uint32_t addr, uint32_t size)
+{
+    if (!flashMemory || !inFlash(addr, size) || (size == 0) ||
+            (sectorStart(addr) != addr) ||
+            ((addr + size < flashStart + flashSize) &&
+             (sectorStart(addr + size) != addr + size))) {
+        fprintf(stderr, "flash: erase of 0x%08X-0x%08X is not sector "
+                "aligned or outside the flash\n", addr, addr + size);
+        return -1;
+    }
+
+    checkWritable("erase", addr, size);
+
+    if (++flashOperations == flashCutAt) {
+        powerCut(NULL, addr, size);
+    }
+
+    std::vector<uint8_t> erased(size, flashEraseValue);
+
+    if (!hostFlashWrite(addr, &erased[0], size)) {
+        return -1;
+    }
+
+    markDirty(addr, size);
+
+    hostStats.flash_erases++;
+    hostStats.flash_erase_bytes += size;
+
+    for (uint32_t address = addr; address < addr + size;
+            address += hostFlashSectorSize(address)) {
+        hostTimingErase(hostFlashSectorSize(address));
+    }
+
+    return 0;
+}
+
+uint32_t FlashIAP::get_sector_size(uint32_t addr) const
+{
+    uint32_t sectorSize = hostFlashSectorSize(addr);
+
+    return (sectorSize > 0) ? sectorSize : MBED_FLASH_INVALID_SIZE;
+}
+
+uint32_t FlashIAP::get_flash_start() const
+{
+    return flashStart;
+}
+
+uint32_t FlashIAP::get_flash_size() const
+{
+    return flashSize;
+}
+
+uint32_t FlashIAP::get_page_size() const
+{
+    return flashPageSize;
+}
+
+uint8_t FlashIAP::get_erase_value() const
+{
+    return flashEraseValue;
+}
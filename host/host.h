@@ -0,0 +1,280 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef HOST_H
+#define HOST_H
+
+/* File-backed internal flash and firmware storage for the host build.
+
+   The internal flash is a file mapped read only at the flash start address,
+   so the bootloader can read it through the memory map as on the target.
+   It is changed through FlashIAP only, which checks alignment, the sector
+   map, read-only regions and that programming only clears bits.
+
+   The firmware storage is a PAAL that keeps its slots either in a separate
+   file, like an SD card, or in the internal flash, like ARM_UCP_FLASHIAP.
+   Each slot holds a metadata header followed by the firmware.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "update-client-paal/arm_uc_paal_update_api.h"
+#include "boot_phase.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    const char *path;         /* file holding the flash content */
+    uint32_t    start;        /* flash start address */
+    uint32_t    size;         /* flash size in bytes */
+    const char *sectors;      /* sector map "SIZE[xCOUNT],...", the last
+                                 size repeats to the end of the flash */
+    uint32_t    page_size;
+    uint8_t     erase_value;
+} host_flash_config_t;
+
+typedef struct {
+    const char *path;         /* storage file, NULL for internal flash */
+    uint32_t    address;      /* start of the storage in internal flash */
+    uint32_t    size;         /* storage size in bytes */
+    uint32_t    locations;    /* number of firmware slots */
+} host_storage_config_t;
+
+typedef struct {
+    uint32_t flash_reads;
+    uint32_t flash_programs;
+    uint32_t flash_erases;
+    uint64_t flash_read_bytes;
+    uint64_t flash_program_bytes;
+    uint64_t flash_erase_bytes;
+    uint32_t storage_reads;
+    uint64_t storage_read_bytes;
+} host_stats_t;
+
+extern host_stats_t hostStats;
+
+/**
+ * Open the file-backed internal flash
+ * @detail The file is created filled with the erase value, or extended to
+ *         the flash size.
+ * @return false if the file could not be opened or mapped, or the sector
+ *         map is invalid.
+ */
+bool hostFlashOpen(const host_flash_config_t *config);
+
+void hostFlashClose(void);
+
+/**
+ * Continue on a private copy of the flash
+ * @detail Changes after the call are not written to the flash file, nor
+ *         seen by other processes that share it.
+ */
+bool hostFlashPrivate(void);
+
+/**
+ * Reject FlashIAP program and erase calls in a region
+ * @detail A call that touches the region aborts the host build, so the
+ *         offending call is on the stack.
+ */
+bool hostFlashReadOnly(uint32_t address, uint32_t size);
+
+/**
+ * Access the flash content without the FlashIAP checks, for programming
+ * images before a boot
+ */
+bool hostFlashRead(uint32_t address, void *buffer, uint32_t size);
+bool hostFlashWrite(uint32_t address, const void *buffer, uint32_t size);
+
+/**
+ * @return size of the sector at an address, 0 outside the flash.
+ */
+uint32_t hostFlashSectorSize(uint32_t address);
+
+/**
+ * Find the flash address of a pointer into the memory map
+ * @return false if the pointer is not inside the flash.
+ */
+bool hostFlashMapped(const void *pointer, uint32_t *address);
+
+/* exit status of a process whose power was cut */
+#define HOST_EXIT_POWER_CUT 3
+
+typedef struct {
+    uint32_t operation;       /* program or erase call cut, counted from 1 */
+    uint32_t erase;           /* 1 for an erase, 0 for a program */
+    uint32_t address;
+    uint32_t size;
+    uint32_t done;            /* bytes completed before the cut */
+    uint32_t dirty_start;     /* flash changed by program and erase calls */
+    uint32_t dirty_end;
+} host_power_cut_t;
+
+/**
+ * Cut the power during a program or erase call
+ * @detail The call is torn: a random number of whole pages or sectors is
+ *         completed, the next one is left half done with random bits
+ *         changed, and the process exits with HOST_EXIT_POWER_CUT.
+ * @param  operation  Number of the call to cut, counted from 1 from now
+ *                    on, 0 to count without cutting.
+ * @param  report     Filled with the cut call and the flash range changed,
+ *                    or NULL.
+ */
+void hostFlashPowerCut(uint32_t operation, host_power_cut_t *report);
+
+/**
+ * @return number of program and erase calls since hostFlashPowerCut().
+ */
+uint32_t hostFlashOperations(void);
+
+/**
+ * Open the firmware storage used by ARM_UCP_HOST
+ * @return false if the storage file could not be opened, or the storage
+ *         does not fit the internal flash.
+ */
+bool hostStorageOpen(const host_storage_config_t *config);
+
+void hostStorageClose(void);
+
+/**
+ * @return true if an internal flash address is inside the firmware storage.
+ */
+bool hostStorageHolds(uint32_t address);
+
+extern const ARM_UC_PAAL_UPDATE ARM_UCP_HOST;
+
+/**
+ * Run the bootloader once, as main.cpp does on the target
+ * @param  index  Number of the boot, for the output.
+ * @param  json   File to append the results to, or NULL.
+ * @return true if the bootloader would forward to the application.
+ */
+bool hostBoot(uint32_t index, FILE *json);
+
+typedef struct {
+    uint32_t    flash_start;  /* flash restored before every cut point */
+    uint32_t    flash_size;
+    const char *nvstore_path; /* NVStore file, restored with the flash */
+    uint32_t    every;        /* cut every Nth program or erase call */
+    uint32_t    jobs;         /* processes cutting in parallel, 0 for one
+                                 per CPU */
+    FILE       *json;         /* file to append every cut point to, or NULL */
+} host_power_cut_config_t;
+
+/**
+ * Cut the power at every program and erase call of an update
+ * @detail For every cut point the flash and NVStore are restored, the
+ *         bootloader is booted until the power is cut, and booted again
+ *         with fresh RAM to recover. The recovered active firmware is
+ *         checked against its header. Each boot runs in its own process,
+ *         the output of the bootloader is discarded. The cut points are
+ *         shared by parallel jobs, each on a private copy of the flash and
+ *         NVStore, so the flash and NVStore files are left as they are.
+ * @return 0 if every recovery ends with a valid active firmware.
+ */
+int hostPowerCutRun(const host_power_cut_config_t *config);
+
+/* Simulated boot time.
+
+   Every FlashIAP call, storage read and SHA-256 update advances a simulated
+   clock by the time the target would take according to a timing model of
+   its MCU and firmware storage. us_ticker_read() returns this clock. The
+   time is split by the boot phases from boot_phase.h, and the install phase
+   further into erase, program and verify: erasing is erase time, reading
+   and hashing the internal flash is verify time and everything else, such
+   as reading the storage and programming, is program time. Reads through
+   the memory map are only charged when the data is hashed.
+*/
+
+typedef struct {
+    uint32_t erase_us;        /* per sector erase */
+    uint32_t erase_kb_us;     /* per KiB of an erased sector */
+    uint32_t program_us;      /* per program call */
+    uint32_t program_unit;    /* bytes programmed by one flash command */
+    uint32_t program_unit_us; /* per flash program command */
+    uint32_t read_ns;         /* per byte read from internal flash */
+    uint32_t hash_ns;         /* per byte hashed with SHA-256 */
+} host_mcu_timing_t;
+
+typedef struct {
+    uint32_t command_us;      /* per read command, 0 for internal flash */
+    uint32_t block_size;      /* bytes per block read */
+    uint32_t block_us;        /* per block read */
+    uint32_t byte_ns;         /* per byte transferred */
+} host_storage_timing_t;
+
+typedef enum {
+    HOST_TIME_INIT,
+    HOST_TIME_ACTIVE_CHECK,
+    HOST_TIME_SLOT_SCAN,
+    HOST_TIME_ERASE,
+    HOST_TIME_PROGRAM,
+    HOST_TIME_VERIFY,
+    HOST_TIME_JUMP,
+    HOST_TIMES
+} host_time_t;
+
+typedef struct {
+    uint64_t simulated_ns[HOST_TIMES];  /* simulated time per part */
+    uint64_t cpu_ns[BOOT_PHASES];       /* host CPU time per boot phase */
+} host_boot_time_t;
+
+extern host_boot_time_t hostBootTime;
+
+/**
+ * Select the timing model of the MCU or the storage
+ * @param  spec  Model name followed by optional overrides of its
+ *               parameters, e.g. "stm32f4,hash_ns=150". A target name
+ *               selects the model of its MCU. The storage model "flash"
+ *               reads at the speed of the internal flash.
+ * @return false if the name or a parameter is unknown.
+ */
+bool hostTimingMcu(const char *spec);
+bool hostTimingStorage(const char *spec);
+
+/**
+ * Print the names and parameters of the timing models
+ */
+void hostTimingList(void);
+
+/**
+ * Clear hostBootTime and start in BOOT_PHASE_INIT
+ */
+void hostTimingReset(void);
+
+/**
+ * Add the CPU time since the last phase change to the current phase
+ */
+void hostTimingStop(void);
+
+/**
+ * Charge the time of a device operation to the simulated clock
+ */
+void hostTimingFlashRead(const void *buffer, uint32_t size);
+void hostTimingProgram(uint32_t size);
+void hostTimingErase(uint32_t sectorSize);
+void hostTimingStorageRead(uint32_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_H
@@ -0,0 +1,69 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef HOST_CONFIG_H
+#define HOST_CONFIG_H
+
+/* Included before every source of the host build, in place of the
+   mbed_config.h generated by mbed-cli. */
+
+#include "mbed_config.h"
+
+/* the firmware storage is the host PAAL, not an SD card */
+#undef ARM_UC_USE_PAL_BLOCKDEVICE
+#define ARM_UC_USE_PAL_BLOCKDEVICE 0
+
+/* Without flash-start-address the flash is taken to start at the 16M
+   boundary below the application, which holds for the supported targets. */
+#if defined(MBED_CONF_APP_FLASH_START_ADDRESS)
+#define HOST_FLASH_START MBED_CONF_APP_FLASH_START_ADDRESS
+#else
+#define HOST_FLASH_START (MBED_CONF_APP_APPLICATION_START_ADDRESS & 0xFF000000)
+#endif
+
+/* The flash is mapped at its own address, which is only possible above the
+   first pages of the address space. Targets with flash at 0 read it through
+   FlashIAP on the host. */
+#if HOST_FLASH_START < 0x10000
+#undef MEMORY_MAPPED_FLASH
+#define MEMORY_MAPPED_FLASH 0
+#undef MAPPED_STORAGE
+#define MAPPED_STORAGE 0
+#endif
+
+/* boot phases split the simulated boot time, see host/timing_model.cpp */
+#undef BOOT_PHASE_HOOK
+#define BOOT_PHASE_HOOK 1
+
+/* the boot timing record is left in a buffer of host/main.cpp, which
+   checks it after every boot that forwards to the application */
+#ifndef BOOT_TIMING_RECORD_ADDRESS
+#ifdef __cplusplus
+extern "C" unsigned char hostBootTimingRecord[];
+#else
+extern unsigned char hostBootTimingRecord[];
+#endif
+#define BOOT_TIMING_RECORD_ADDRESS hostBootTimingRecord
+#endif
+
+/* NVStore is the file-backed stand-in in host/nvstore.cpp */
+#ifndef NVSTORE_ENABLED
+#define NVSTORE_ENABLED 1
+#endif
+
+#endif // HOST_CONFIG_H
@@ -0,0 +1,62 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef HOST_MBED_H
+#define HOST_MBED_H
+
+/* The parts of the mbed OS API used by the bootloader core, for the host
+   build. FlashIAP is backed by a file, see host/flash_iap.cpp.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmsis.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @return microseconds since the host build started, wraps like the
+ *         target ticker.
+ */
+uint32_t us_ticker_read(void);
+
+#ifdef __cplusplus
+}
+
+class FlashIAP {
+public:
+    int init();
+    int deinit();
+    int read(void *buffer, uint32_t addr, uint32_t size);
+    int program(const void *buffer, uint32_t addr, uint32_t size);
+    int erase(uint32_t addr, uint32_t size);
+    uint32_t get_sector_size(uint32_t addr) const;
+    uint32_t get_flash_start() const;
+    uint32_t get_flash_size() const;
+    uint32_t get_page_size() const;
+    uint8_t get_erase_value() const;
+};
+#endif
+
+#endif // HOST_MBED_H
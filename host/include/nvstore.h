@@ -0,0 +1,78 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef HOST_NVSTORE_H
+#define HOST_NVSTORE_H
+
+/* File-backed stand-in for the mbed OS NVStore, for the host build.
+   Records are kept in memory and the whole store is written back to the
+   file given to hostNVStoreOpen() on every change.
+*/
+
+#include <stdint.h>
+
+#ifndef NVSTORE_ENABLED
+#define NVSTORE_ENABLED 1
+#endif
+
+#ifndef NVSTORE_MAX_KEYS
+#if defined(MBED_CONF_NVSTORE_MAX_KEYS)
+#define NVSTORE_MAX_KEYS MBED_CONF_NVSTORE_MAX_KEYS
+#else
+#define NVSTORE_MAX_KEYS 16
+#endif
+#endif
+
+enum {
+    NVSTORE_SUCCESS                =  0,
+    NVSTORE_READ_ERROR             = -1,
+    NVSTORE_WRITE_ERROR            = -2,
+    NVSTORE_NOT_FOUND              = -3,
+    NVSTORE_DATA_CORRUPT           = -4,
+    NVSTORE_BAD_VALUE              = -5,
+    NVSTORE_BUFF_TOO_SMALL         = -6,
+    NVSTORE_FLASH_AREA_TOO_SMALL   = -7,
+    NVSTORE_OS_ERROR               = -8,
+    NVSTORE_ALREADY_EXISTS         = -9
+};
+
+class NVStore {
+public:
+    static NVStore &get_instance();
+
+    int init();
+    int deinit();
+    int get(uint16_t key, uint16_t buf_size, void *buf, uint16_t &actual_size);
+    int get_item_size(uint16_t key, uint16_t &actual_size);
+    int set(uint16_t key, uint16_t buf_size, const void *buf);
+    int remove(uint16_t key);
+    uint16_t get_max_keys() const;
+
+private:
+    NVStore();
+};
+
+/**
+ * Set the file that holds the store
+ * @detail Without a file the store starts empty and is not kept.
+ * @param  path  File name, created on the first write.
+ * @return true if the file could be loaded or does not exist yet.
+ */
+bool hostNVStoreOpen(const char *path);
+
+#endif // HOST_NVSTORE_H
@@ -0,0 +1,752 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef __STDC_FORMAT_MACROS
+#define __STDC_FORMAT_MACROS
+#endif
+
+#include "host.h"
+#include "nvstore.h"
+
+#include "update-client-common/arm_uc_metadata_header_v2.h"
+#include "update-client-paal/arm_uc_paal_update.h"
+#include "mbedtls/sha256.h"
+#include "mbed.h"
+
+#include "active_application.h"
+#include "bootloader_common.h"
+#include "boot_timing.h"
+#include "upgrade.h"
+
+#include <inttypes.h>
+#include <vector>
+
+/* storage used when update-client.storage-address is not internal flash */
+#define HOST_STORAGE_FILE "storage.bin"
+
+#if defined(FLASH_SECTOR_SIZE)
+#define HOST_SECTOR_MAP_DEFAULT NULL
+#else
+#define HOST_SECTOR_MAP_DEFAULT "4K"
+#endif
+
+#if defined(FLASH_PAGE_SIZE)
+#define HOST_PAGE_SIZE FLASH_PAGE_SIZE
+#define HOST_ERASE_VALUE FLASH_ERASE_VALUE
+#else
+#define HOST_PAGE_SIZE 8
+#define HOST_ERASE_VALUE 0xFF
+#endif
+
+/* NVStore key of the device root of trust, see nvstore_rot.cpp */
+#define HOST_NVSTORE_KEY_ROT 4
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: bootloader_host [options] boot\n"
+            "       bootloader_host [options] flash <image> <version>\n"
+            "       bootloader_host [options] store <location> <image> <version>\n"
+            "       bootloader_host [options] powercut\n"
+            "       bootloader_host timing\n"
+            "\n"
+            "  boot      run the bootloader, exit status 0 if it would jump to\n"
+            "            the application\n"
+            "  flash     program an image and its header as the active\n"
+            "            application, like a debugger\n"
+            "  store     write an image to a firmware storage location\n"
+            "  powercut  cut the power at every program and erase call of the\n"
+            "            boot, recover and check the active application, exit\n"
+            "            status 0 if every recovery ends with a valid one\n"
+            "  timing    list the timing models\n"
+            "\n"
+            "options:\n"
+            "  --flash FILE           internal flash content (flash.bin)\n"
+            "  --storage FILE         firmware storage file, default internal\n"
+            "                         flash if update-client.storage-address\n"
+            "                         is inside it and " HOST_STORAGE_FILE " if not\n"
+            "  --nvstore FILE         NVStore content (nvstore.bin)\n"
+            "  --flash-start ADDRESS  flash start address\n"
+            "  --flash-size SIZE      flash size\n"
+            "  --sectors MAP          sector map SIZE[xCOUNT],... where the last\n"
+            "                         size repeats, e.g. 16Kx4,64K,128K\n"
+            "  --page-size SIZE       program page size\n"
+            "  --erase-value VALUE    value of erased bytes\n"
+            "  --read-only ADDR:SIZE  reject program and erase in a region, the\n"
+            "                         bootloader and the storage are read-only\n"
+            "                         during a boot\n"
+            "  --boots N              boot N times without a power cycle, as\n"
+            "                         when the application resets the device\n"
+            "  --timing MODEL         timing model of the MCU, default the one\n"
+            "                         of the target, followed by overrides such\n"
+            "                         as ,erase_us=20000\n"
+            "  --storage-timing MODEL timing model of the firmware storage,\n"
+            "                         default flash for internal storage and sd\n"
+            "  --json FILE            append the results of every boot, or of\n"
+            "                         every cut point, to FILE as one line of\n"
+            "                         JSON\n"
+            "  --cut-every N          cut the power at every Nth program and\n"
+            "                         erase call only\n"
+            "  --jobs N               cut the power in N processes in parallel,\n"
+            "                         default one per CPU\n"
+            "  --corrupt OFFSET       flash or store the image with the byte at\n"
+            "                         OFFSET inverted after its hash is taken\n"
+            "  --hash-of FILE         store the image with the hash of FILE in\n"
+            "                         its header, e.g. a compressed image with\n"
+            "                         the hash of the uncompressed one\n");
+    exit(2);
+}
+
+static uint32_t parseNumber(const char *text)
+{
+    char *end = NULL;
+    unsigned long value = strtoul(text, &end, 0);
+
+    if (*end == 'K' || *end == 'k') {
+        value *= 1024;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        value *= 1024 * 1024;
+        end++;
+    }
+
+    if ((end == text) || (*end != '\0')) {
+        fprintf(stderr, "invalid number \"%s\"\n", text);
+        usage();
+    }
+
+    return (uint32_t) value;
+}
+
+static bool loadImage(const char *path, std::vector<uint8_t> &image)
+{
+    FILE *file = fopen(path, "rb");
+
+    if (!file) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+
+    uint8_t block[4096];
+    size_t size;
+
+    while ((size = fread(block, 1, sizeof(block), file)) > 0) {
+        image.insert(image.end(), block, block + size);
+    }
+
+    fclose(file);
+
+    return true;
+}
+
+static arm_uc_firmware_details_t imageDetails(const std::vector<uint8_t> &image,
+                                              uint64_t version)
+{
+    arm_uc_firmware_details_t details;
+    memset(&details, 0, sizeof(details));
+
+    details.version = version;
+    details.size = image.size();
+    mbedtls_sha256(image.empty() ? NULL : &image[0], image.size(), details.hash, 0);
+
+    return details;
+}
+
+/**
+ * Compute the header details of an image, then invert one byte of the image
+ * if asked to, so that the header no longer matches
+ * @param  corrupt  Offset of the byte, outside the image for none.
+ */
+static arm_uc_firmware_details_t corruptImage(std::vector<uint8_t> &image,
+                                              const char *version,
+                                              uint32_t corrupt)
+{
+    arm_uc_firmware_details_t details = imageDetails(image,
+                                                     strtoull(version, NULL, 0));
+
+    if (corrupt < image.size()) {
+        image[corrupt] ^= 0xFF;
+    }
+
+    return details;
+}
+
+/**
+ * Program an image and its header as the active application
+ */
+static bool flashImage(const std::vector<uint8_t> &image,
+                       arm_uc_firmware_details_t details)
+{
+    std::vector<uint8_t> header(ARM_UC_INTERNAL_HEADER_SIZE_V2, HOST_ERASE_VALUE);
+    arm_uc_buffer_t buffer = {
+        .size_max = ARM_UC_INTERNAL_HEADER_SIZE_V2,
+        .size     = 0,
+        .ptr      = &header[0]
+    };
+
+    if ((image.size() > MBED_CONF_APP_MAX_APPLICATION_SIZE) ||
+            (arm_uc_create_internal_header_v2(&details, &buffer).error != ERR_NONE)) {
+        return false;
+    }
+
+    return hostFlashWrite(FIRMWARE_METADATA_HEADER_ADDRESS, &header[0], header.size()) &&
+           (image.empty() ||
+            hostFlashWrite(MBED_CONF_APP_APPLICATION_START_ADDRESS, &image[0], image.size()));
+}
+
+/**
+ * Write an image to a firmware storage location through the PAAL
+ */
+static bool storeImage(uint32_t location,
+                       const std::vector<uint8_t> &image,
+                       arm_uc_firmware_details_t details)
+{
+    uint8_t header[ARM_UC_EXTERNAL_HEADER_SIZE_V2];
+    arm_uc_buffer_t buffer = {
+        .size_max = sizeof(header),
+        .size     = 0,
+        .ptr      = header
+    };
+
+    if (ARM_UCP_HOST.Prepare(location, &details, &buffer).error != ERR_NONE) {
+        return false;
+    }
+
+    for (uint32_t offset = 0; offset < image.size(); offset += BUFFER_SIZE) {
+        uint32_t size = image.size() - offset;
+
+        if (size > BUFFER_SIZE) {
+            size = BUFFER_SIZE;
+        }
+
+        buffer.size_max = size;
+        buffer.size = size;
+        buffer.ptr = (uint8_t *) &image[offset];
+
+        if (ARM_UCP_HOST.Write(location, offset, &buffer).error != ERR_NONE) {
+            return false;
+        }
+    }
+
+    return ARM_UCP_HOST.Finalize(location).error == ERR_NONE;
+}
+
+#if defined(ARM_BOOTLOADER_USE_NVSTORE_ROT) && (ARM_BOOTLOADER_USE_NVSTORE_ROT == 1)
+/**
+ * Give a new device a root of trust, as provisioning does on the target
+ */
+static void provisionRootOfTrust(void)
+{
+    uint8_t rot[16];
+    uint16_t size = 0;
+
+    if (NVStore::get_instance().get(HOST_NVSTORE_KEY_ROT, sizeof(rot), rot, size) ==
+            NVSTORE_NOT_FOUND) {
+        FILE *random = fopen("/dev/urandom", "rb");
+
+        if (random && (fread(rot, 1, sizeof(rot), random) == sizeof(rot))) {
+            NVStore::get_instance().set(HOST_NVSTORE_KEY_ROT, sizeof(rot), rot);
+        }
+
+        if (random) {
+            fclose(random);
+        }
+    }
+}
+#endif
+
+/* RAM the bootloader hands the boot timing record in */
+unsigned char hostBootTimingRecord[sizeof(boot_timing_record_t)]
+__attribute__((aligned(4)));
+
+#if defined(BOOT_TIMING_RECORD) && (BOOT_TIMING_RECORD == 1)
+/**
+ * Print the boot timing record as the application would find it
+ */
+static void printBootTimingRecord(void)
+{
+    const boot_timing_record_t *record =
+        (const boot_timing_record_t *) hostBootTimingRecord;
+
+    if (!bootTimingRecordValid(record)) {
+        printf("[HOST] Boot timing record is not valid\r\n");
+        return;
+    }
+
+    printf("[HOST] Record us: init %" PRIu32 ", active check %" PRIu32
+           ", slot scan %" PRIu32 ", install %" PRIu32 " (erase %" PRIu32
+           ", program %" PRIu32 ", verify %" PRIu32 "), jump %" PRIu32
+           ", total %" PRIu32 "\r\n",
+           record->phase_us[BOOT_PHASE_INIT],
+           record->phase_us[BOOT_PHASE_ACTIVE_CHECK],
+           record->phase_us[BOOT_PHASE_SLOT_SCAN],
+           record->phase_us[BOOT_PHASE_INSTALL],
+           record->erase_us, record->program_us, record->verify_us,
+           record->phase_us[BOOT_PHASE_JUMP], record->total_us);
+
+    for (uint32_t slot = 0; slot < BOOT_TIMING_SLOTS; slot++) {
+        if (record->slot_header_us[slot] || record->slot_hash_us[slot]) {
+            printf("[HOST] Record slot %" PRIu32 " us: header %" PRIu32
+                   ", hash %" PRIu32 "\r\n", slot,
+                   record->slot_header_us[slot], record->slot_hash_us[slot]);
+        }
+    }
+
+    printf("[HOST] Record bytes: flash read %" PRIu32 ", storage read %"
+           PRIu32 ", programmed %" PRIu32 ", erased %" PRIu32 "\r\n",
+           record->flash_read_bytes, record->storage_read_bytes,
+           record->program_bytes, record->erase_bytes);
+}
+#endif
+
+/**
+ * Append the results of a boot as one line of JSON
+ */
+static void writeBootJson(FILE *json,
+                          uint32_t index,
+                          bool forward,
+                          uint64_t simulated,
+                          uint64_t cpu)
+{
+    static const char *const simulatedNames[HOST_TIMES] = {
+        "init", "active_check", "slot_scan", "erase", "program", "verify", "jump"
+    };
+    static const char *const cpuNames[BOOT_PHASES] = {
+        "init", "active_check", "slot_scan", "install", "jump"
+    };
+
+    fprintf(json, "{\"boot\": %" PRIu32 ", \"forward\": %s, \"simulated_us\": {",
+            index, forward ? "true" : "false");
+
+    for (uint32_t part = 0; part < HOST_TIMES; part++) {
+        fprintf(json, "\"%s\": %" PRIu64 ", ", simulatedNames[part],
+                hostBootTime.simulated_ns[part] / 1000);
+    }
+
+    fprintf(json, "\"total\": %" PRIu64 "}, \"cpu_us\": {", simulated / 1000);
+
+    for (uint32_t phase = 0; phase < BOOT_PHASES; phase++) {
+        fprintf(json, "\"%s\": %" PRIu64 ", ", cpuNames[phase],
+                hostBootTime.cpu_ns[phase] / 1000);
+    }
+
+    fprintf(json, "\"total\": %" PRIu64 "}, "
+            "\"flash\": {\"reads\": %" PRIu32 ", \"read_bytes\": %" PRIu64 ", "
+            "\"programs\": %" PRIu32 ", \"program_bytes\": %" PRIu64 ", "
+            "\"erases\": %" PRIu32 ", \"erase_bytes\": %" PRIu64 "}, "
+            "\"storage\": {\"reads\": %" PRIu32 ", \"read_bytes\": %" PRIu64 "}}\n",
+            cpu / 1000,
+            hostStats.flash_reads, hostStats.flash_read_bytes,
+            hostStats.flash_programs, hostStats.flash_program_bytes,
+            hostStats.flash_erases, hostStats.flash_erase_bytes,
+            hostStats.storage_reads, hostStats.storage_read_bytes);
+    fflush(json);
+}
+
+bool hostBoot(uint32_t index, FILE *json)
+{
+    bool canForward = false;
+
+    memset(&hostStats, 0, sizeof(hostStats));
+    memset(hostBootTimingRecord, 0, sizeof(hostBootTimingRecord));
+    hostTimingReset();
+    bootPhaseEnter(BOOT_PHASE_INIT);
+
+    ARM_UCP_SetPAALUpdate(&ARM_UCP_HOST);
+    arm_uc_error_t ucp_result = ARM_UCP_Initialize(arm_ucp_event_handler);
+
+    if ((ucp_result.error == ERR_NONE) && activeStorageInit()) {
+        canForward = upgradeApplicationFromStorage();
+        activeStorageDeinit();
+    }
+
+    if (canForward) {
+        bootPhaseEnter(BOOT_PHASE_JUMP);
+        bootTimingFinish();
+    }
+
+    hostTimingStop();
+
+    uint64_t simulated = 0;
+    uint64_t cpu = 0;
+
+    for (uint32_t part = 0; part < HOST_TIMES; part++) {
+        simulated += hostBootTime.simulated_ns[part];
+    }
+
+    for (uint32_t phase = 0; phase < BOOT_PHASES; phase++) {
+        cpu += hostBootTime.cpu_ns[phase];
+    }
+
+    if (canForward) {
+        printf("[HOST] Boot %" PRIu32 ": forward to 0x%08" PRIX32, index,
+               activeApplicationJumpAddress());
+    } else {
+        printf("[HOST] Boot %" PRIu32 ": no valid application", index);
+    }
+
+    printf(" after %.3f ms simulated, %.3f ms CPU\r\n",
+           simulated / 1e6, cpu / 1e6);
+    printf("[HOST] Simulated ms: init %.3f, active check %.3f, slot scan %.3f, "
+           "erase %.3f, program %.3f, verify %.3f\r\n",
+           hostBootTime.simulated_ns[HOST_TIME_INIT] / 1e6,
+           hostBootTime.simulated_ns[HOST_TIME_ACTIVE_CHECK] / 1e6,
+           hostBootTime.simulated_ns[HOST_TIME_SLOT_SCAN] / 1e6,
+           hostBootTime.simulated_ns[HOST_TIME_ERASE] / 1e6,
+           hostBootTime.simulated_ns[HOST_TIME_PROGRAM] / 1e6,
+           hostBootTime.simulated_ns[HOST_TIME_VERIFY] / 1e6);
+
+    printf("[HOST] Flash: %" PRIu32 " reads (%" PRIu64 " B), %" PRIu32
+           " programs (%" PRIu64 " B), %" PRIu32 " erases (%" PRIu64 " B)\r\n",
+           hostStats.flash_reads, hostStats.flash_read_bytes,
+           hostStats.flash_programs, hostStats.flash_program_bytes,
+           hostStats.flash_erases, hostStats.flash_erase_bytes);
+    printf("[HOST] Storage: %" PRIu32 " reads (%" PRIu64 " B)\r\n",
+           hostStats.storage_reads, hostStats.storage_read_bytes);
+
+#if defined(BOOT_TIMING_RECORD) && (BOOT_TIMING_RECORD == 1)
+    if (canForward) {
+        printBootTimingRecord();
+    }
+#endif
+
+    if (json) {
+        writeBootJson(json, index, canForward, simulated, cpu);
+    }
+
+    return canForward;
+}
+
+int main(int argc, char **argv)
+{
+    const char *flashPath = "flash.bin";
+    const char *storagePath = NULL;
+    const char *nvstorePath = "nvstore.bin";
+    const char *sectors = HOST_SECTOR_MAP_DEFAULT;
+    uint32_t flashStart = HOST_FLASH_START;
+    uint32_t flashSize = 0;
+    uint32_t pageSize = HOST_PAGE_SIZE;
+    uint32_t eraseValue = HOST_ERASE_VALUE;
+    uint32_t boots = 1;
+    const char *timing = HOST_TARGET;
+    const char *storageTiming = NULL;
+    const char *jsonPath = NULL;
+    uint32_t corrupt = UINT32_MAX;
+    const char *hashPath = NULL;
+    uint32_t cutEvery = 1;
+    uint32_t jobs = 0;
+    std::vector<uint32_t> readOnly;
+    int arg = 1;
+
+    for ( ; (arg < argc) && (strncmp(argv[arg], "--", 2) == 0); arg += 2) {
+        if (arg + 1 >= argc) {
+            usage();
+        }
+
+        const char *option = argv[arg];
+        const char *value = argv[arg + 1];
+
+        if (strcmp(option, "--flash") == 0) {
+            flashPath = value;
+        } else if (strcmp(option, "--storage") == 0) {
+            storagePath = value;
+        } else if (strcmp(option, "--nvstore") == 0) {
+            nvstorePath = value;
+        } else if (strcmp(option, "--flash-start") == 0) {
+            flashStart = parseNumber(value);
+        } else if (strcmp(option, "--flash-size") == 0) {
+            flashSize = parseNumber(value);
+        } else if (strcmp(option, "--sectors") == 0) {
+            sectors = value;
+        } else if (strcmp(option, "--page-size") == 0) {
+            pageSize = parseNumber(value);
+        } else if (strcmp(option, "--erase-value") == 0) {
+            eraseValue = parseNumber(value);
+        } else if (strcmp(option, "--boots") == 0) {
+            boots = parseNumber(value);
+        } else if (strcmp(option, "--timing") == 0) {
+            timing = value;
+        } else if (strcmp(option, "--storage-timing") == 0) {
+            storageTiming = value;
+        } else if (strcmp(option, "--json") == 0) {
+            jsonPath = value;
+        } else if (strcmp(option, "--corrupt") == 0) {
+            corrupt = parseNumber(value);
+        } else if (strcmp(option, "--hash-of") == 0) {
+            hashPath = value;
+        } else if (strcmp(option, "--cut-every") == 0) {
+            cutEvery = parseNumber(value);
+        } else if (strcmp(option, "--jobs") == 0) {
+            jobs = parseNumber(value);
+        } else if (strcmp(option, "--read-only") == 0) {
+            char region[32];
+            char *separator = NULL;
+
+            strncpy(region, value, sizeof(region) - 1);
+            region[sizeof(region) - 1] = '\0';
+            separator = strchr(region, ':');
+
+            if (!separator) {
+                usage();
+            }
+
+            *separator = '\0';
+            readOnly.push_back(parseNumber(region));
+            readOnly.push_back(parseNumber(separator + 1));
+        } else {
+            usage();
+        }
+    }
+
+    if (arg >= argc) {
+        usage();
+    }
+
+    if ((strcmp(argv[arg], "timing") == 0) && (arg + 1 == argc)) {
+        hostTimingList();
+        return 0;
+    }
+
+    /* the regions the bootloader may program, everything else is the
+       bootloader itself or belongs to the application */
+    std::vector<uint32_t> writable;
+    writable.push_back(FIRMWARE_METADATA_HEADER_ADDRESS);
+    writable.push_back(ARM_UC_INTERNAL_HEADER_SIZE_V2);
+    writable.push_back(MBED_CONF_APP_APPLICATION_START_ADDRESS);
+    writable.push_back(MBED_CONF_APP_MAX_APPLICATION_SIZE);
+
+#if defined(XIP_AB_BOOT) && (XIP_AB_BOOT == 1)
+    writable.push_back(APPLICATION_B_HEADER_ADDRESS);
+    writable.push_back(ARM_UC_INTERNAL_HEADER_SIZE_V2);
+    writable.push_back(APPLICATION_B_START_ADDRESS);
+    writable.push_back(MBED_CONF_APP_MAX_APPLICATION_SIZE);
+#endif
+
+    /* the flash ends after the last of these regions, or after the storage
+       when it directly follows the application, rounded up to 128K so that
+       the last sector is whole */
+    uint32_t flashEnd = 0;
+
+    for (size_t index = 0; index + 1 < writable.size(); index += 2) {
+        if (writable[index] + writable[index + 1] > flashEnd) {
+            flashEnd = writable[index] + writable[index + 1];
+        }
+    }
+
+    if (MBED_CONF_UPDATE_CLIENT_STORAGE_ADDRESS ==
+            MBED_CONF_APP_APPLICATION_START_ADDRESS + MBED_CONF_APP_MAX_APPLICATION_SIZE) {
+        flashEnd = MBED_CONF_UPDATE_CLIENT_STORAGE_ADDRESS +
+                   MBED_CONF_UPDATE_CLIENT_STORAGE_SIZE;
+    }
+
+    if (flashSize == 0) {
+#if defined(MBED_CONF_APP_FLASH_SIZE)
+        flashSize = MBED_CONF_APP_FLASH_SIZE;
+#else
+        flashSize = (flashEnd - flashStart + 0x1FFFF) & ~0x1FFFFUL;
+#endif
+    }
+
+#if defined(FLASH_SECTOR_SIZE)
+    /* uniform sectors of the configured size, unless given */
+    char uniform[16];
+    snprintf(uniform, sizeof(uniform), "%u", (unsigned) FLASH_SECTOR_SIZE);
+
+    if (!sectors) {
+        sectors = uniform;
+    }
+#endif
+
+    host_flash_config_t flashConfig;
+    flashConfig.path        = flashPath;
+    flashConfig.start       = flashStart;
+    flashConfig.size        = flashSize;
+    flashConfig.sectors     = sectors;
+    flashConfig.page_size   = pageSize;
+    flashConfig.erase_value = (uint8_t) eraseValue;
+
+    if (!hostFlashOpen(&flashConfig)) {
+        return 1;
+    }
+
+    /* storage inside the flash is the internal flash PAAL layout */
+    host_storage_config_t storageConfig;
+    storageConfig.path      = storagePath;
+    storageConfig.address   = MBED_CONF_UPDATE_CLIENT_STORAGE_ADDRESS;
+    storageConfig.size      = MBED_CONF_UPDATE_CLIENT_STORAGE_SIZE;
+    storageConfig.locations = MAX_FIRMWARE_LOCATIONS;
+
+    if (!storagePath &&
+            ((storageConfig.address < flashStart) ||
+             (storageConfig.address - flashStart >= flashSize))) {
+        storageConfig.path = HOST_STORAGE_FILE;
+    }
+
+    if (!hostStorageOpen(&storageConfig) || !hostNVStoreOpen(nvstorePath)) {
+        return 1;
+    }
+
+    if (!storageTiming) {
+        storageTiming = storageConfig.path ? "sd" : "flash";
+    }
+
+    if (!hostTimingMcu(timing) || !hostTimingStorage(storageTiming)) {
+        fprintf(stderr, "unknown timing model \"%s\" or \"%s\", see "
+                "bootloader_host timing\n", timing, storageTiming);
+        return 2;
+    }
+
+    int result = 0;
+    const char *command = argv[arg];
+
+    if (((strcmp(command, "boot") == 0) || (strcmp(command, "powercut") == 0)) &&
+            (arg + 1 == argc)) {
+#if defined(ARM_BOOTLOADER_USE_NVSTORE_ROT) && (ARM_BOOTLOADER_USE_NVSTORE_ROT == 1)
+        provisionRootOfTrust();
+#endif
+
+        /* the bootloader never writes itself or the storage, the header
+           regions extend to the end of their sector */
+        uint32_t address = flashStart;
+
+        while (address < flashStart + flashSize) {
+            uint32_t end = flashStart + flashSize;
+            bool inside = false;
+
+            for (size_t index = 0; index + 1 < writable.size(); index += 2) {
+                uint32_t start = writable[index];
+                uint32_t regionEnd = start + writable[index + 1];
+
+                if ((address >= start) && (address < regionEnd)) {
+                    inside = true;
+                    end = regionEnd;
+                } else if ((start > address) && (start < end)) {
+                    end = start;
+                }
+            }
+
+            if (inside) {
+                /* round up to a whole sector */
+                uint32_t sector = address;
+
+                while ((sector < end) && hostFlashSectorSize(sector)) {
+                    sector += hostFlashSectorSize(sector);
+                }
+
+                address = sector;
+            } else {
+                hostFlashReadOnly(address, end - address);
+                address = end;
+            }
+        }
+
+        if (!storageConfig.path) {
+            hostFlashReadOnly(storageConfig.address, storageConfig.size);
+        }
+
+        for (size_t index = 0; index + 1 < readOnly.size(); index += 2) {
+            if (!hostFlashReadOnly(readOnly[index], readOnly[index + 1])) {
+                fprintf(stderr, "read-only region outside the flash\n");
+                return 2;
+            }
+        }
+
+        /* kept across boots in RAM, as on the target */
+        heapVersion = (uint64_t *) malloc(sizeof(uint64_t));
+        bootCounter = (uint8_t *) malloc(1);
+        *heapVersion = 0;
+        *bootCounter = 0;
+#if defined(VERIFIED_IMAGE_CACHE) && (VERIFIED_IMAGE_CACHE == 1)
+        /* no valid count after power up, as on the target */
+        verifiedImageSkips = (uint32_t *) malloc(2 * sizeof(uint32_t));
+        memset(verifiedImageSkips, 0, 2 * sizeof(uint32_t));
+#endif
+
+        FILE *json = NULL;
+
+        if (jsonPath && !(json = fopen(jsonPath, "a"))) {
+            fprintf(stderr, "cannot open %s\n", jsonPath);
+            return 2;
+        }
+
+        if (strcmp(command, "powercut") == 0) {
+            host_power_cut_config_t cutConfig;
+            cutConfig.flash_start  = flashStart;
+            cutConfig.flash_size   = flashSize;
+            cutConfig.nvstore_path = nvstorePath;
+            cutConfig.every        = cutEvery;
+            cutConfig.jobs         = jobs;
+            cutConfig.json         = json;
+
+            result = hostPowerCutRun(&cutConfig);
+        } else {
+            for (uint32_t index = 0; index < boots; index++) {
+                result = hostBoot(index, json) ? 0 : 1;
+            }
+        }
+
+        if (json) {
+            fclose(json);
+        }
+
+        free(heapVersion);
+        free(bootCounter);
+#if defined(VERIFIED_IMAGE_CACHE) && (VERIFIED_IMAGE_CACHE == 1)
+        free(verifiedImageSkips);
+#endif
+    } else if ((strcmp(command, "flash") == 0) && (arg + 3 == argc)) {
+        std::vector<uint8_t> image;
+
+        if (!loadImage(argv[arg + 1], image) ||
+                !flashImage(image, corruptImage(image, argv[arg + 2], corrupt))) {
+            fprintf(stderr, "cannot program %s as the active application\n",
+                    argv[arg + 1]);
+            result = 1;
+        }
+    } else if ((strcmp(command, "store") == 0) && (arg + 4 == argc)) {
+        std::vector<uint8_t> image;
+        std::vector<uint8_t> hashed;
+        bool stored = loadImage(argv[arg + 2], image) &&
+                      (!hashPath || loadImage(hashPath, hashed));
+
+        if (stored) {
+            arm_uc_firmware_details_t details = corruptImage(image, argv[arg + 3],
+                                                             corrupt);
+
+            if (hashPath) {
+                mbedtls_sha256(hashed.empty() ? NULL : &hashed[0], hashed.size(),
+                               details.hash, 0);
+            }
+
+            stored = storeImage(parseNumber(argv[arg + 1]), image, details);
+        }
+
+        if (!stored) {
+            fprintf(stderr, "cannot store %s in location %s\n",
+                    argv[arg + 2], argv[arg + 1]);
+            result = 1;
+        }
+    } else {
+        usage();
+    }
+
+    hostStorageClose();
+    hostFlashClose();
+
+    return result;
+}
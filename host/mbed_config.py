@@ -0,0 +1,126 @@
+#!/usr/bin/env python
+# ----------------------------------------------------------------------------
+# Copyright 2018 ARM Ltd.
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ----------------------------------------------------------------------------
+
+"""Generate mbed_config.h for the host build from an mbed application config.
+
+Follows the mbed-cli rules for the parts of the config the bootloader uses:
+the "macros" list, the application "config" parameters as MBED_CONF_APP_*,
+and the "*" and target specific "target_overrides", where library
+parameters such as "update-client.storage-address" become
+MBED_CONF_UPDATE_CLIENT_STORAGE_ADDRESS. Target settings are ignored, apart
+from "target.macros_add". Macros defined on the compiler command line take
+precedence over the "macros" list.
+"""
+
+import argparse
+import json
+import sys
+
+
+def macro_name(prefix, name):
+    return "MBED_CONF_%s_%s" % (prefix.upper().replace("-", "_"),
+                                name.upper().replace("-", "_").replace(".", "_"))
+
+
+def macro_value(value):
+    if isinstance(value, bool):
+        return "1" if value else "0"
+    return str(value)
+
+
+def parse_macro(macro):
+    name, _, value = macro.partition("=")
+    return name, value if value else "1"
+
+
+def generate(config, target):
+    macros = []
+    params = {}
+
+    for macro in config.get("macros", []):
+        macros.append(parse_macro(macro))
+
+    for name, param in config.get("config", {}).items():
+        value = param.get("value") if isinstance(param, dict) else param
+        params[macro_name("app", name)] = value
+
+    overrides = config.get("target_overrides", {})
+
+    if target not in overrides:
+        raise ValueError("no target_overrides for %s" % target)
+
+    for section in ("*", target):
+        for key, value in overrides.get(section, {}).items():
+            prefix, _, name = key.rpartition(".")
+
+            if prefix == "target":
+                if name == "macros_add":
+                    macros.extend(parse_macro(macro) for macro in value)
+            elif prefix:
+                params[macro_name(prefix, name)] = value
+            else:
+                params[macro_name("app", name)] = value
+
+    lines = ["/* generated by host/mbed_config.py for %s, do not edit */" % target,
+             "",
+             "#ifndef MBED_CONFIG_H",
+             "#define MBED_CONFIG_H",
+             ""]
+
+    for name in sorted(params):
+        if params[name] is not None:
+            lines.append("#define %s %s" % (name, macro_value(params[name])))
+
+    lines.append("")
+
+    # macros given on the command line take precedence
+    for name, value in macros:
+        lines.append("#ifndef %s" % name)
+        lines.append("#define %s %s" % (name, value))
+        lines.append("#endif")
+
+    lines.extend(["", "#endif", ""])
+
+    return "\n".join(lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("config", help="application config, e.g. mbed_app.json")
+    parser.add_argument("target", help="target name, e.g. K64F")
+    parser.add_argument("-o", "--output", help="output file, default stdout")
+    args = parser.parse_args()
+
+    with open(args.config) as config_file:
+        config = json.load(config_file)
+
+    try:
+        header = generate(config, args.target)
+    except ValueError as error:
+        sys.exit("%s: %s" % (args.config, error))
+
+    if args.output:
+        with open(args.output, "w") as output:
+            output.write(header)
+    else:
+        sys.stdout.write(header)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,177 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#include "nvstore.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+typedef std::map<uint16_t, std::vector<uint8_t> > record_map_t;
+
+static record_map_t records;
+static std::string storePath;
+
+/* file layout: key and size as 16 bit little endian values, then the data */
+static bool load(void)
+{
+    FILE *file = fopen(storePath.c_str(), "rb");
+
+    records.clear();
+
+    if (!file) {
+        return true;
+    }
+
+    uint8_t header[4];
+    bool result = true;
+
+    while (result && (fread(header, 1, sizeof(header), file) == sizeof(header))) {
+        uint16_t key = header[0] | (header[1] << 8);
+        uint16_t size = header[2] | (header[3] << 8);
+        std::vector<uint8_t> data(size);
+
+        result = (size == 0) || (fread(&data[0], 1, size, file) == size);
+        records[key] = data;
+    }
+
+    fclose(file);
+
+    return result;
+}
+
+static bool save(void)
+{
+    if (storePath.empty()) {
+        return true;
+    }
+
+    FILE *file = fopen(storePath.c_str(), "wb");
+    bool result = (file != NULL);
+
+    for (record_map_t::const_iterator record = records.begin();
+            result && (record != records.end()); ++record) {
+        uint8_t header[4] = {
+            (uint8_t) record->first, (uint8_t)(record->first >> 8),
+            (uint8_t) record->second.size(), (uint8_t)(record->second.size() >> 8)
+        };
+
+        result = (fwrite(header, 1, sizeof(header), file) == sizeof(header)) &&
+                 (record->second.empty() ||
+                  (fwrite(&record->second[0], 1, record->second.size(), file) ==
+                   record->second.size()));
+    }
+
+    if (file && (fclose(file) != 0)) {
+        result = false;
+    }
+
+    return result;
+}
+
+bool hostNVStoreOpen(const char *path)
+{
+    storePath = path ? path : "";
+
+    return load();
+}
+
+NVStore::NVStore()
+{
+}
+
+NVStore &NVStore::get_instance()
+{
+    static NVStore instance;
+
+    return instance;
+}
+
+int NVStore::init()
+{
+    return NVSTORE_SUCCESS;
+}
+
+int NVStore::deinit()
+{
+    return NVSTORE_SUCCESS;
+}
+
+int NVStore::get(uint16_t key, uint16_t buf_size, void *buf, uint16_t &actual_size)
+{
+    record_map_t::const_iterator record = records.find(key);
+
+    actual_size = 0;
+
+    if (key >= get_max_keys()) {
+        return NVSTORE_BAD_VALUE;
+    }
+
+    if (record == records.end()) {
+        return NVSTORE_NOT_FOUND;
+    }
+
+    actual_size = record->second.size();
+
+    if (buf_size < actual_size) {
+        return NVSTORE_BUFF_TOO_SMALL;
+    }
+
+    if (actual_size > 0) {
+        memcpy(buf, &record->second[0], actual_size);
+    }
+
+    return NVSTORE_SUCCESS;
+}
+
+int NVStore::get_item_size(uint16_t key, uint16_t &actual_size)
+{
+    int status = get(key, 0, NULL, actual_size);
+
+    return (status == NVSTORE_BUFF_TOO_SMALL) ? NVSTORE_SUCCESS : status;
+}
+
+int NVStore::set(uint16_t key, uint16_t buf_size, const void *buf)
+{
+    if (key >= get_max_keys()) {
+        return NVSTORE_BAD_VALUE;
+    }
+
+    records[key].assign((const uint8_t *) buf, (const uint8_t *) buf + buf_size);
+
+    return save() ? NVSTORE_SUCCESS : NVSTORE_WRITE_ERROR;
+}
+
+int NVStore::remove(uint16_t key)
+{
+    if (key >= get_max_keys()) {
+        return NVSTORE_BAD_VALUE;
+    }
+
+    records.erase(key);
+
+    return save() ? NVSTORE_SUCCESS : NVSTORE_WRITE_ERROR;
+}
+
+uint16_t NVStore::get_max_keys() const
+{
+    return NVSTORE_MAX_KEYS;
+}
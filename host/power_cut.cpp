@@ -0,0 +1,494 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef __STDC_FORMAT_MACROS
+#define __STDC_FORMAT_MACROS
+#endif
+
+#include "host.h"
+#include "nvstore.h"
+
+#include "update-client-common/arm_uc_metadata_header_v2.h"
+#include "mbedtls/sha256.h"
+
+#include "active_application.h"
+#include "bootloader_config.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+/* what a boot process leaves behind for the driver */
+typedef struct {
+    host_power_cut_t cut;
+    uint32_t operations;      /* program and erase calls made */
+    uint32_t forward;         /* would jump to the application */
+    uint32_t valid;           /* active firmware matches its header */
+    uint64_t version;
+    uint64_t simulated_ns;
+} power_cut_boot_t;
+
+/* a cut point, or the update without power cuts for cut 0 */
+typedef struct {
+    uint32_t cut;             /* program or erase call to cut the power at */
+    int cut_status;           /* exit status of the boots, see bootProcess() */
+    int recovery_status;
+    power_cut_boot_t boot;    /* boot until the power is cut */
+    power_cut_boot_t recovery;
+} power_cut_point_t;
+
+/* exit status of a boot process that was not cut */
+#define POWER_CUT_EXIT_DONE 0
+
+/* state every cut point starts from */
+static std::vector<uint8_t> savedFlash;
+static std::vector<uint8_t> savedNVStore;
+static bool savedNVStoreExists = false;
+
+/**
+ * Check the active firmware against its header, straight from the flash
+ * rather than through the bootloader
+ */
+static bool activeFirmwareValid(uint64_t *version)
+{
+    uint32_t headerAddress = FIRMWARE_METADATA_HEADER_ADDRESS;
+    uint8_t header[ARM_UC_INTERNAL_HEADER_SIZE_V2];
+    arm_uc_firmware_details_t details;
+    uint8_t hash[32];
+
+#if defined(XIP_AB_BOOT) && (XIP_AB_BOOT == 1)
+    if (activeRegionSelected() == 1) {
+        headerAddress = APPLICATION_B_HEADER_ADDRESS;
+    }
+#endif
+
+    if (!hostFlashRead(headerAddress, header, sizeof(header)) ||
+            (arm_uc_parse_internal_header_v2(header, &details).error != ERR_NONE) ||
+            (details.size > MBED_CONF_APP_MAX_APPLICATION_SIZE)) {
+        return false;
+    }
+
+    std::vector<uint8_t> firmware(details.size);
+
+    if (!firmware.empty() &&
+            !hostFlashRead(activeApplicationStartAddress(), &firmware[0],
+                           firmware.size())) {
+        return false;
+    }
+
+    mbedtls_sha256(firmware.empty() ? NULL : &firmware[0], firmware.size(),
+                   hash, 0);
+    *version = details.version;
+
+    return memcmp(hash, details.hash, sizeof(hash)) == 0;
+}
+
+/**
+ * Boot in a new process, as after a power cycle
+ * @param  cut  Program or erase call to cut the power at, 0 for none.
+ * @return exit status of the process, POWER_CUT_EXIT_DONE if the boot
+ *         finished and HOST_EXIT_POWER_CUT if the power was cut, or the
+ *         negative signal number that killed it.
+ */
+static int bootProcess(const char *nvstorePath,
+                       uint32_t cut,
+                       power_cut_boot_t *result)
+{
+    memset(result, 0, sizeof(*result));
+    fflush(NULL);
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        /* RAM starts from the state before the first boot, NVStore from
+           the restored file */
+        if (!freopen("/dev/null", "w", stdout) ||
+                !hostNVStoreOpen(nvstorePath)) {
+            _exit(2);
+        }
+
+        hostFlashPowerCut(cut, &result->cut);
+
+        result->forward = hostBoot(0, NULL);
+        result->operations = hostFlashOperations();
+
+        for (uint32_t part = 0; part < HOST_TIMES; part++) {
+            result->simulated_ns += hostBootTime.simulated_ns[part];
+        }
+
+        result->valid = result->forward && activeFirmwareValid(&result->version);
+
+        fflush(stdout);
+        _exit(POWER_CUT_EXIT_DONE);
+    }
+
+    int status = 0;
+
+    if ((pid < 0) || (waitpid(pid, &status, 0) != pid)) {
+        perror("power cut: fork");
+        exit(1);
+    }
+
+    return WIFSIGNALED(status) ? -WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+static bool readFile(const char *path, std::vector<uint8_t> &content, bool *exists)
+{
+    FILE *file = fopen(path, "rb");
+    uint8_t buffer[512];
+    size_t size;
+
+    content.clear();
+    *exists = (file != NULL);
+
+    if (!file) {
+        return true;
+    }
+
+    while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        content.insert(content.end(), buffer, buffer + size);
+    }
+
+    bool result = !ferror(file);
+    fclose(file);
+
+    return result;
+}
+
+static bool writeFile(const char *path, const std::vector<uint8_t> &content, bool exists)
+{
+    if (!exists) {
+        return (unlink(path) == 0) || (errno == ENOENT);
+    }
+
+    FILE *file = fopen(path, "wb");
+    bool result = (file != NULL) &&
+                  (content.empty() ||
+                   (fwrite(&content[0], 1, content.size(), file) == content.size()));
+
+    if (file && (fclose(file) != 0)) {
+        result = false;
+    }
+
+    return result;
+}
+
+static uint64_t wallNanoseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void describeCut(char *text, size_t size, const host_power_cut_t *cut)
+{
+    snprintf(text, size, "%s of 0x%08" PRIX32 "-0x%08" PRIX32 ", %" PRIu32
+             " B done", cut->erase ? "erase" : "program", cut->address,
+             cut->address + cut->size, cut->done);
+}
+
+static void describeStatus(char *text, size_t size, int status)
+{
+    if (status < 0) {
+        snprintf(text, size, "killed by signal %d", -status);
+    } else {
+        snprintf(text, size, "exit status %d", status);
+    }
+}
+
+/* extend a flash range by the range a boot changed */
+static void addDirty(const host_power_cut_t *cut, uint32_t *start, uint32_t *end)
+{
+    if (cut->dirty_start < cut->dirty_end) {
+        if (cut->dirty_start < *start) {
+            *start = cut->dirty_start;
+        }
+
+        if (cut->dirty_end > *end) {
+            *end = cut->dirty_end;
+        }
+    }
+}
+
+/**
+ * Start a process that runs every jobs-th cut point from the first
+ * @detail The process works on a private copy of the flash and its own
+ *         NVStore file, and restores only what the last cut point changed.
+ */
+static pid_t startJob(const host_power_cut_config_t *config,
+                      power_cut_point_t *points,
+                      uint32_t count,
+                      uint32_t first,
+                      uint32_t jobs)
+{
+    fflush(NULL);
+
+    pid_t pid = fork();
+
+    if (pid != 0) {
+        return pid;
+    }
+
+    char nvstorePath[256];
+    snprintf(nvstorePath, sizeof(nvstorePath), "%s.%" PRIu32,
+             config->nvstore_path, first);
+
+    uint32_t dirtyStart = UINT32_MAX;
+    uint32_t dirtyEnd = 0;
+    bool result = hostFlashPrivate();
+
+    for (uint32_t index = first; result && (index < count); index += jobs) {
+        power_cut_point_t *point = &points[index];
+
+        if (dirtyStart < dirtyEnd) {
+            result = hostFlashWrite(dirtyStart,
+                                    &savedFlash[dirtyStart - config->flash_start],
+                                    dirtyEnd - dirtyStart);
+        }
+
+        if (!result || !writeFile(nvstorePath, savedNVStore, savedNVStoreExists)) {
+            fprintf(stderr, "power cut: cannot restore the flash or NVStore\n");
+            result = false;
+            break;
+        }
+
+        dirtyStart = UINT32_MAX;
+        dirtyEnd = 0;
+
+        if (point->cut > 0) {
+            point->cut_status = bootProcess(nvstorePath, point->cut, &point->boot);
+            addDirty(&point->boot.cut, &dirtyStart, &dirtyEnd);
+        }
+
+        point->recovery_status = bootProcess(nvstorePath, 0, &point->recovery);
+        addDirty(&point->recovery.cut, &dirtyStart, &dirtyEnd);
+    }
+
+    unlink(nvstorePath);
+    _exit(result ? 0 : 1);
+}
+
+static bool runJobs(const host_power_cut_config_t *config,
+                    power_cut_point_t *points,
+                    uint32_t count,
+                    uint32_t jobs)
+{
+    std::vector<pid_t> pids;
+    bool result = true;
+
+    for (uint32_t first = 0; first < jobs; first++) {
+        pid_t pid = startJob(config, points, count, first, jobs);
+
+        if (pid < 0) {
+            perror("power cut: fork");
+            result = false;
+            break;
+        }
+
+        pids.push_back(pid);
+    }
+
+    for (size_t index = 0; index < pids.size(); index++) {
+        int status = 0;
+
+        if ((waitpid(pids[index], &status, 0) != pids[index]) ||
+                !WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+            result = false;
+        }
+    }
+
+    return result;
+}
+
+static power_cut_point_t *mapPoints(uint32_t count)
+{
+    void *memory = mmap(NULL, (count + 1) * sizeof(power_cut_point_t),
+                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (memory == MAP_FAILED) {
+        perror("power cut: mmap");
+        return NULL;
+    }
+
+    memset(memory, 0, (count + 1) * sizeof(power_cut_point_t));
+
+    return (power_cut_point_t *) memory;
+}
+
+int hostPowerCutRun(const host_power_cut_config_t *config)
+{
+    savedFlash.resize(config->flash_size);
+
+    if (!hostFlashRead(config->flash_start, &savedFlash[0], savedFlash.size()) ||
+            !readFile(config->nvstore_path, savedNVStore, &savedNVStoreExists)) {
+        fprintf(stderr, "power cut: cannot read the flash or NVStore\n");
+        return 1;
+    }
+
+    /* an update without power cuts, for the number of cut points and the
+       version it installs */
+    power_cut_point_t *update = mapPoints(1);
+
+    if (!update || !runJobs(config, update, 1, 1)) {
+        return 1;
+    }
+
+    uint32_t operations = update->recovery.operations;
+    uint64_t version = update->recovery.version;
+    uint32_t failures = 0;
+
+    if ((update->recovery_status != POWER_CUT_EXIT_DONE) || !update->recovery.valid) {
+        char text[64];
+        describeStatus(text, sizeof(text), update->recovery_status);
+
+        printf("[HOST] Boot without power cuts: %s, %s\r\n", text,
+               update->recovery.forward ? "invalid active firmware" :
+               "no valid application");
+        failures++;
+    }
+
+    munmap(update, 2 * sizeof(power_cut_point_t));
+
+    uint32_t every = config->every ? config->every : 1;
+    uint32_t count = operations / every;
+    uint32_t jobs = config->jobs;
+    power_cut_point_t *points = mapPoints(count);
+
+    if (!points) {
+        return 1;
+    }
+
+    if (jobs == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = (cpus > 0) ? (uint32_t) cpus : 1;
+    }
+
+    if (jobs > count) {
+        jobs = count ? count : 1;
+    }
+
+    for (uint32_t index = 0; index < count; index++) {
+        points[index].cut = (index + 1) * every;
+    }
+
+    uint64_t start = wallNanoseconds();
+
+    if (!runJobs(config, points, count, jobs)) {
+        failures++;
+    }
+
+    double seconds = (wallNanoseconds() - start) / 1e9;
+
+    uint32_t outdated = 0;
+    uint32_t recoveries = 0;
+    uint64_t recoveryMin = UINT64_MAX;
+    uint64_t recoveryMax = 0;
+    uint64_t recoveryTotal = 0;
+    const power_cut_point_t *slowest = NULL;
+
+    for (uint32_t index = 0; index < count; index++) {
+        const power_cut_point_t *point = &points[index];
+        const power_cut_boot_t *recovery = &point->recovery;
+        bool poweredOff = (point->cut_status == HOST_EXIT_POWER_CUT);
+        bool valid = (point->recovery_status == POWER_CUT_EXIT_DONE) &&
+                     recovery->valid;
+        char where[96];
+        char text[64];
+
+        if (poweredOff) {
+            describeCut(where, sizeof(where), &point->boot.cut);
+        } else {
+            snprintf(where, sizeof(where), "not reached, %" PRIu32
+                     " program and erase calls", point->boot.operations);
+        }
+
+        if (!poweredOff && (point->cut_status != POWER_CUT_EXIT_DONE)) {
+            describeStatus(text, sizeof(text), point->cut_status);
+            printf("[HOST] Cut %" PRIu32 " (%s): boot %s\r\n", point->cut, where,
+                   text);
+            failures++;
+        } else if (point->recovery_status != POWER_CUT_EXIT_DONE) {
+            describeStatus(text, sizeof(text), point->recovery_status);
+            printf("[HOST] Cut %" PRIu32 " (%s): recovery %s\r\n", point->cut,
+                   where, text);
+            failures++;
+        } else if (!valid) {
+            printf("[HOST] Cut %" PRIu32 " (%s): %s after recovery\r\n",
+                   point->cut, where, recovery->forward ?
+                   "invalid active firmware" : "no valid application");
+            failures++;
+        } else if (recovery->version != version) {
+            outdated++;
+        }
+
+        if (point->recovery_status == POWER_CUT_EXIT_DONE) {
+            recoveries++;
+            recoveryTotal += recovery->simulated_ns;
+
+            if (recovery->simulated_ns < recoveryMin) {
+                recoveryMin = recovery->simulated_ns;
+            }
+
+            if (recovery->simulated_ns >= recoveryMax) {
+                recoveryMax = recovery->simulated_ns;
+                slowest = point;
+            }
+        }
+
+        if (config->json) {
+            fprintf(config->json, "{\"cut\": %" PRIu32 ", \"powered_off\": %s, "
+                    "\"operation\": \"%s\", \"address\": %" PRIu32 ", "
+                    "\"size\": %" PRIu32 ", \"done\": %" PRIu32 ", "
+                    "\"valid\": %s, \"version\": %" PRIu64 ", "
+                    "\"recovery_us\": %" PRIu64 "}\n",
+                    point->cut, poweredOff ? "true" : "false",
+                    point->boot.cut.erase ? "erase" : "program",
+                    point->boot.cut.address, point->boot.cut.size,
+                    point->boot.cut.done, valid ? "true" : "false",
+                    recovery->version, recovery->simulated_ns / 1000);
+        }
+    }
+
+    printf("[HOST] Power cut: %" PRIu32 " program and erase calls, %" PRIu32
+           " cut points in %.2f s (%.0f per second, %" PRIu32 " jobs)\r\n",
+           operations, count, seconds, (seconds > 0) ? count / seconds : 0.0, jobs);
+    printf("[HOST] Recovered: %" PRIu32 " failed, %" PRIu32 " kept the old "
+           "firmware\r\n", failures, outdated);
+
+    if (slowest) {
+        char where[96];
+        describeCut(where, sizeof(where), &slowest->boot.cut);
+
+        printf("[HOST] Recovery boot simulated ms: min %.3f, average %.3f, "
+               "max %.3f at cut %" PRIu32 " (%s)\r\n", recoveryMin / 1e6,
+               recoveryTotal / 1e6 / recoveries, recoveryMax / 1e6,
+               slowest->cut, where);
+    }
+
+    munmap(points, (count + 1) * sizeof(power_cut_point_t));
+
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,352 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#include "host.h"
+
+#include "update-client-common/arm_uc_metadata_header_v2.h"
+#include "update-client-paal/arm_uc_paal_update_api.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* slots in a storage file are aligned to SD card blocks */
+#define HOST_STORAGE_BLOCK_SIZE 512
+
+static ARM_UC_PAAL_UPDATE_SignalEvent_t storageCallback = NULL;
+static host_storage_config_t storage;
+static int storageFile = -1;
+
+/* layout of each slot: a header followed by the firmware */
+static uint32_t slotSize = 0;
+static uint32_t slotHeaderSize = 0;
+
+static bool storageRead(uint32_t offset, void *buffer, uint32_t size)
+{
+    if (storage.path) {
+        return pread(storageFile, buffer, size, offset) == (ssize_t) size;
+    }
+
+    return hostFlashRead(storage.address + offset, buffer, size);
+}
+
+static bool storageWrite(uint32_t offset, const void *buffer, uint32_t size)
+{
+    if (storage.path) {
+        return pwrite(storageFile, buffer, size, offset) == (ssize_t) size;
+    }
+
+    return hostFlashWrite(storage.address + offset, buffer, size);
+}
+
+static void signal(uint32_t event)
+{
+    if (storageCallback) {
+        storageCallback(event);
+    }
+}
+
+bool hostStorageOpen(const host_storage_config_t *config)
+{
+    storage = *config;
+
+    if (storage.locations == 0) {
+        return false;
+    }
+
+    /* same slot layout as the internal flash PAAL: sector aligned slots
+       with the header rounded up to a sector */
+    uint32_t align = HOST_STORAGE_BLOCK_SIZE;
+
+    if (!storage.path) {
+        align = hostFlashSectorSize(storage.address);
+
+        if ((align == 0) ||
+                (hostFlashSectorSize(storage.address + storage.size - 1) == 0)) {
+            fprintf(stderr, "storage: 0x%08X-0x%08X is outside the internal "
+                    "flash\n", storage.address, storage.address + storage.size);
+            return false;
+        }
+    }
+
+    slotSize = storage.size / storage.locations / align * align;
+    slotHeaderSize = (ARM_UC_EXTERNAL_HEADER_SIZE_V2 + align - 1) / align * align;
+
+    if (slotSize <= slotHeaderSize) {
+        fprintf(stderr, "storage: %u byte slots are too small\n", slotSize);
+        return false;
+    }
+
+    if (storage.path) {
+        storageFile = open(storage.path, O_RDWR | O_CREAT, 0644);
+
+        if (storageFile < 0) {
+            fprintf(stderr, "storage: cannot open %s: %s\n", storage.path,
+                    strerror(errno));
+            return false;
+        }
+
+        /* a new file reads as erased */
+        struct stat status;
+        fstat(storageFile, &status);
+
+        if ((uint64_t) status.st_size < storage.size) {
+            uint8_t erased[HOST_STORAGE_BLOCK_SIZE];
+            memset(erased, 0xFF, sizeof(erased));
+
+            for (uint32_t offset = status.st_size; offset < storage.size;
+                    offset += sizeof(erased)) {
+                uint32_t size = storage.size - offset;
+
+                if (size > sizeof(erased)) {
+                    size = sizeof(erased);
+                }
+
+                if (!storageWrite(offset, erased, size)) {
+                    hostStorageClose();
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+void hostStorageClose(void)
+{
+    if (storageFile >= 0) {
+        close(storageFile);
+        storageFile = -1;
+    }
+}
+
+bool hostStorageHolds(uint32_t address)
+{
+    return !storage.path && (storage.locations > 0) &&
+           (address >= storage.address) &&
+           (address - storage.address < storage.size);
+}
+
+static arm_uc_error_t hostInitialize(ARM_UC_PAAL_UPDATE_SignalEvent_t callback)
+{
+    arm_uc_error_t result = { ERR_NONE };
+
+    storageCallback = callback;
+    signal(ARM_UC_PAAL_EVENT_INITIALIZE_DONE);
+
+    return result;
+}
+
+static ARM_UC_PAAL_UPDATE_CAPABILITIES hostGetCapabilities(void)
+{
+    ARM_UC_PAAL_UPDATE_CAPABILITIES result;
+    memset(&result, 0, sizeof(result));
+
+    return result;
+}
+
+static uint32_t hostGetMaxID(void)
+{
+    return storage.locations;
+}
+
+/**
+ * Erase a slot and write its header
+ */
+static arm_uc_error_t hostPrepare(uint32_t location,
+                                  const arm_uc_firmware_details_t *details,
+                                  arm_uc_buffer_t *buffer)
+{
+    arm_uc_error_t result = { ERR_INVALID_PARAMETER };
+
+    if ((location < storage.locations) && details && buffer &&
+            (details->size <= slotSize - slotHeaderSize)) {
+        uint8_t *erased = (uint8_t *) malloc(slotSize);
+        memset(erased, 0xFF, slotSize);
+
+        bool ok = storageWrite(location * slotSize, erased, slotSize);
+        free(erased);
+
+        buffer->size = 0;
+
+        if (ok &&
+                (arm_uc_create_internal_header_v2(details, buffer).error == ERR_NONE) &&
+                storageWrite(location * slotSize, buffer->ptr, buffer->size)) {
+            result.error = ERR_NONE;
+            signal(ARM_UC_PAAL_EVENT_PREPARE_DONE);
+        }
+    }
+
+    return result;
+}
+
+static arm_uc_error_t hostWrite(uint32_t location,
+                                uint32_t offset,
+                                const arm_uc_buffer_t *buffer)
+{
+    arm_uc_error_t result = { ERR_INVALID_PARAMETER };
+
+    if ((location < storage.locations) && buffer &&
+            (offset <= slotSize - slotHeaderSize) &&
+            (buffer->size <= slotSize - slotHeaderSize - offset) &&
+            storageWrite(location * slotSize + slotHeaderSize + offset,
+                         buffer->ptr, buffer->size)) {
+        result.error = ERR_NONE;
+        signal(ARM_UC_PAAL_EVENT_WRITE_DONE);
+    }
+
+    return result;
+}
+
+static arm_uc_error_t hostFinalize(uint32_t location)
+{
+    arm_uc_error_t result = { ERR_INVALID_PARAMETER };
+
+    if (location < storage.locations) {
+        if (storageFile >= 0) {
+            fsync(storageFile);
+        }
+
+        result.error = ERR_NONE;
+        signal(ARM_UC_PAAL_EVENT_FINALIZE_DONE);
+    }
+
+    return result;
+}
+
+/**
+ * Read firmware from a slot, short at the end of the stored firmware
+ */
+static arm_uc_error_t hostRead(uint32_t location,
+                               uint32_t offset,
+                               arm_uc_buffer_t *buffer)
+{
+    arm_uc_error_t result = { ERR_INVALID_PARAMETER };
+    uint8_t header[ARM_UC_INTERNAL_HEADER_SIZE_V2];
+    arm_uc_firmware_details_t details;
+
+    if ((location < storage.locations) && buffer &&
+            storageRead(location * slotSize, header, sizeof(header)) &&
+            (arm_uc_parse_internal_header_v2(header, &details).error == ERR_NONE) &&
+            (details.size <= slotSize - slotHeaderSize) &&
+            (offset <= details.size)) {
+        uint32_t size = details.size - offset;
+
+        if (size > buffer->size_max) {
+            size = buffer->size_max;
+        }
+
+        if (storageRead(location * slotSize + slotHeaderSize + offset,
+                        buffer->ptr, size)) {
+            buffer->size = size;
+            result.error = ERR_NONE;
+
+            hostStats.storage_reads++;
+            hostStats.storage_read_bytes += size;
+            hostTimingStorageRead(size);
+
+            signal(ARM_UC_PAAL_EVENT_READ_DONE);
+        }
+    }
+
+    return result;
+}
+
+static arm_uc_error_t hostActivate(uint32_t location)
+{
+    arm_uc_error_t result = { ERR_INVALID_PARAMETER };
+    (void) location;
+
+    return result;
+}
+
+static arm_uc_error_t hostGetActiveFirmwareDetails(arm_uc_firmware_details_t *details)
+{
+    arm_uc_error_t result = { ERR_INVALID_PARAMETER };
+    uint8_t header[ARM_UC_INTERNAL_HEADER_SIZE_V2];
+
+    if (details) {
+        result.error = ERR_NONE;
+
+        bool read = hostFlashRead(MBED_CONF_UPDATE_CLIENT_APPLICATION_DETAILS,
+                                  header, sizeof(header));
+        hostTimingFlashRead(header, sizeof(header));
+
+        if (read &&
+                (arm_uc_parse_internal_header_v2(header, details).error == ERR_NONE)) {
+            signal(ARM_UC_PAAL_EVENT_GET_ACTIVE_FIRMWARE_DETAILS_DONE);
+        } else {
+            signal(ARM_UC_PAAL_EVENT_GET_ACTIVE_FIRMWARE_DETAILS_ERROR);
+        }
+    }
+
+    return result;
+}
+
+static arm_uc_error_t hostGetFirmwareDetails(uint32_t location,
+                                             arm_uc_firmware_details_t *details)
+{
+    arm_uc_error_t result = { ERR_INVALID_PARAMETER };
+    uint8_t header[ARM_UC_INTERNAL_HEADER_SIZE_V2];
+
+    if ((location < storage.locations) && details) {
+        result.error = ERR_NONE;
+
+        hostStats.storage_reads++;
+        hostStats.storage_read_bytes += sizeof(header);
+        hostTimingStorageRead(sizeof(header));
+
+        if (storageRead(location * slotSize, header, sizeof(header)) &&
+                (arm_uc_parse_internal_header_v2(header, details).error == ERR_NONE)) {
+            signal(ARM_UC_PAAL_EVENT_GET_FIRMWARE_DETAILS_DONE);
+        } else {
+            signal(ARM_UC_PAAL_EVENT_GET_FIRMWARE_DETAILS_ERROR);
+        }
+    }
+
+    return result;
+}
+
+static arm_uc_error_t hostGetInstallerDetails(arm_uc_installer_details_t *details)
+{
+    arm_uc_error_t result = { ERR_NONE };
+    (void) details;
+
+    signal(ARM_UC_PAAL_EVENT_GET_INSTALLER_DETAILS_ERROR);
+
+    return result;
+}
+
+const ARM_UC_PAAL_UPDATE ARM_UCP_HOST = {
+    .Initialize               = hostInitialize,
+    .GetCapabilities          = hostGetCapabilities,
+    .GetMaxID                 = hostGetMaxID,
+    .Prepare                  = hostPrepare,
+    .Write                    = hostWrite,
+    .Finalize                 = hostFinalize,
+    .Read                     = hostRead,
+    .Activate                 = hostActivate,
+    .GetActiveFirmwareDetails = hostGetActiveFirmwareDetails,
+    .GetFirmwareDetails       = hostGetFirmwareDetails,
+    .GetInstallerDetails      = hostGetInstallerDetails
+};
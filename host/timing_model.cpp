@@ -0,0 +1,376 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#include "host.h"
+#include "mbed.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mbedtls/sha256.h"
+
+/* named timing model */
+typedef struct {
+    const char *name;
+    host_mcu_timing_t timing;
+} mcu_model_t;
+
+typedef struct {
+    const char *name;
+    host_storage_timing_t timing;
+} storage_model_t;
+
+/* Typical datasheet figures. The hash time is what mbedtls takes for one
+   byte at the core clock of the family. */
+static const mcu_model_t mcuModels[] = {
+    /* K64F class Kinetis, 120 MHz, 8 byte phrases */
+    { "kinetis", { 14000,     0, 5,  8,  65, 10, 290 } },
+    /* STM32F4 and F2, 180 MHz, x32 parallelism, 16K to 128K sectors */
+    { "stm32f4", { 143000, 6700, 5,  4,  16,  5, 195 } },
+    /* STM32L4, 80 MHz, 2K pages, 8 byte double words */
+    { "stm32l4", { 22000,     0, 5,  8,  82, 12, 440 } },
+    /* STM32F3, 72 MHz, 2K pages, 2 byte half words */
+    { "stm32f3", { 20000,     0, 5,  2,  40, 14, 490 } },
+    /* nRF52, 64 MHz, 4K pages, 4 byte words, maximum figures */
+    { "nrf52",   { 85000,     0, 5,  4,  41, 16, 550 } }
+};
+
+static const storage_model_t storageModels[] = {
+    /* internal flash, charged at the flash read speed */
+    { "flash",   { 0,    0,  0,   0 } },
+    /* SD card on a 25 MHz SPI bus */
+    { "sd",      { 500, 512, 40, 320 } },
+    /* SPI NOR flash on a 40 MHz bus */
+    { "spif",    { 10,  256,  0, 200 } }
+};
+
+/* default MCU model per target name prefix */
+static const struct {
+    const char *prefix;
+    const char *model;
+} targetModels[] = {
+    { "K6",                  "kinetis" },
+    { "KW",                  "kinetis" },
+    { "NUCLEO_F2",           "stm32f4" },
+    { "NUCLEO_F4",           "stm32f4" },
+    { "UBLOX_",              "stm32f4" },
+    { "NUCLEO_L4",           "stm32l4" },
+    { "DISCO_L4",            "stm32l4" },
+    { "NUCLEO_F3",           "stm32f3" },
+    { "NRF52",               "nrf52"   }
+};
+
+/* parameter names, in the order of the fields */
+static const char *const mcuParameters[] = {
+    "erase_us", "erase_kb_us", "program_us", "program_unit",
+    "program_unit_us", "read_ns", "hash_ns"
+};
+
+static const char *const storageParameters[] = {
+    "command_us", "block_size", "block_us", "byte_ns"
+};
+
+host_boot_time_t hostBootTime;
+
+static host_mcu_timing_t mcu = mcuModels[0].timing;
+static host_storage_timing_t storage = storageModels[0].timing;
+static bool storageInternal = true;
+
+/* buffer filled by the last FlashIAP read, hashing it is verify time */
+static const uint8_t *flashReadBuffer = NULL;
+static uint32_t flashReadSize = 0;
+
+static uint64_t simulatedNanoseconds = 0;
+static boot_phase_t currentPhase = BOOT_PHASE_INIT;
+static uint64_t phaseCpuStart = 0;
+
+/* kinds of charged time, see host.h for how they are split */
+typedef enum {
+    CHARGE_ERASE,
+    CHARGE_PROGRAM,
+    CHARGE_FLASH,
+    CHARGE_STORAGE
+} charge_t;
+
+static uint64_t cpuNanoseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void charge(charge_t kind, uint64_t nanoseconds)
+{
+    host_time_t part;
+
+    switch (currentPhase) {
+        case BOOT_PHASE_INIT:
+            part = HOST_TIME_INIT;
+            break;
+        case BOOT_PHASE_ACTIVE_CHECK:
+            part = HOST_TIME_ACTIVE_CHECK;
+            break;
+        case BOOT_PHASE_SLOT_SCAN:
+            part = HOST_TIME_SLOT_SCAN;
+            break;
+        case BOOT_PHASE_INSTALL:
+            part = (kind == CHARGE_ERASE) ? HOST_TIME_ERASE :
+                   (kind == CHARGE_FLASH) ? HOST_TIME_VERIFY :
+                   HOST_TIME_PROGRAM;
+            break;
+        default:
+            part = HOST_TIME_JUMP;
+            break;
+    }
+
+    hostBootTime.simulated_ns[part] += nanoseconds;
+    simulatedNanoseconds += nanoseconds;
+}
+
+/**
+ * @return length of the model name at the start of a spec.
+ */
+static size_t nameLength(const char *spec)
+{
+    const char *end = strchr(spec, ',');
+
+    return end ? (size_t)(end - spec) : strlen(spec);
+}
+
+/**
+ * Apply the ",key=value..." part of a spec to the parameters of a model,
+ * which are all uint32_t
+ * @return false if a key is unknown.
+ */
+static bool applyOverrides(const char *spec,
+                           const char *const *parameters,
+                           size_t count,
+                           uint32_t *timing)
+{
+    const char *end = strchr(spec, ',');
+
+    while (end) {
+        const char *key = end + 1;
+        const char *equals = strchr(key, '=');
+        bool found = false;
+
+        end = strchr(key, ',');
+
+        if (!equals || (end && (equals > end))) {
+            return false;
+        }
+
+        for (size_t index = 0; index < count; index++) {
+            if ((strlen(parameters[index]) == (size_t)(equals - key)) &&
+                    (strncmp(parameters[index], key, equals - key) == 0)) {
+                timing[index] = strtoul(equals + 1, NULL, 0);
+                found = true;
+            }
+        }
+
+        if (!found) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool hostTimingMcu(const char *spec)
+{
+    size_t length = nameLength(spec);
+    const char *name = NULL;
+
+    /* a target name selects the model of its MCU */
+    for (size_t index = 0;
+            index < sizeof(targetModels) / sizeof(targetModels[0]);
+            index++) {
+        if (strncmp(spec, targetModels[index].prefix,
+                    strlen(targetModels[index].prefix)) == 0) {
+            name = targetModels[index].model;
+        }
+    }
+
+    for (size_t index = 0; index < sizeof(mcuModels) / sizeof(mcuModels[0]); index++) {
+        if (name ? (strcmp(mcuModels[index].name, name) == 0) :
+                ((strlen(mcuModels[index].name) == length) &&
+                 (strncmp(mcuModels[index].name, spec, length) == 0))) {
+            mcu = mcuModels[index].timing;
+
+            return applyOverrides(spec, mcuParameters,
+                                  sizeof(mcuParameters) / sizeof(mcuParameters[0]),
+                                  (uint32_t *) &mcu);
+        }
+    }
+
+    return false;
+}
+
+bool hostTimingStorage(const char *spec)
+{
+    size_t length = nameLength(spec);
+
+    for (size_t index = 0;
+            index < sizeof(storageModels) / sizeof(storageModels[0]);
+            index++) {
+        if ((strlen(storageModels[index].name) == length) &&
+                (strncmp(storageModels[index].name, spec, length) == 0)) {
+            storage = storageModels[index].timing;
+            storageInternal = (index == 0);
+
+            return applyOverrides(spec, storageParameters,
+                                  sizeof(storageParameters) / sizeof(storageParameters[0]),
+                                  (uint32_t *) &storage);
+        }
+    }
+
+    return false;
+}
+
+void hostTimingList(void)
+{
+    for (size_t index = 0; index < sizeof(mcuModels) / sizeof(mcuModels[0]); index++) {
+        const uint32_t *timing = (const uint32_t *) &mcuModels[index].timing;
+
+        printf("%-8s", mcuModels[index].name);
+
+        for (size_t parameter = 0;
+                parameter < sizeof(mcuParameters) / sizeof(mcuParameters[0]);
+                parameter++) {
+            printf(" %s=%u", mcuParameters[parameter], (unsigned) timing[parameter]);
+        }
+
+        printf("\n");
+    }
+
+    for (size_t index = 0; index < sizeof(storageModels) / sizeof(storageModels[0]); index++) {
+        const uint32_t *timing = (const uint32_t *) &storageModels[index].timing;
+
+        printf("%-8s", storageModels[index].name);
+
+        for (size_t parameter = 0;
+                parameter < sizeof(storageParameters) / sizeof(storageParameters[0]);
+                parameter++) {
+            printf(" %s=%u", storageParameters[parameter], (unsigned) timing[parameter]);
+        }
+
+        printf("\n");
+    }
+}
+
+void hostTimingReset(void)
+{
+    memset(&hostBootTime, 0, sizeof(hostBootTime));
+
+    flashReadBuffer = NULL;
+    flashReadSize = 0;
+
+    currentPhase = BOOT_PHASE_INIT;
+    phaseCpuStart = cpuNanoseconds();
+}
+
+void bootPhaseHook(boot_phase_t phase)
+{
+    uint64_t now = cpuNanoseconds();
+
+    if ((uint32_t) currentPhase < BOOT_PHASES) {
+        hostBootTime.cpu_ns[currentPhase] += now - phaseCpuStart;
+    }
+
+    currentPhase = phase;
+    phaseCpuStart = now;
+}
+
+void hostTimingStop(void)
+{
+    bootPhaseHook(currentPhase);
+}
+
+void hostTimingFlashRead(const void *buffer, uint32_t size)
+{
+    flashReadBuffer = (const uint8_t *) buffer;
+    flashReadSize = size;
+
+    charge(CHARGE_FLASH, (uint64_t) size * mcu.read_ns);
+}
+
+void hostTimingProgram(uint32_t size)
+{
+    uint32_t unit = (mcu.program_unit > 0) ? mcu.program_unit : 1;
+    uint64_t units = (size + unit - 1) / unit;
+
+    charge(CHARGE_PROGRAM,
+           (mcu.program_us + units * mcu.program_unit_us) * 1000ULL);
+}
+
+void hostTimingErase(uint32_t sectorSize)
+{
+    charge(CHARGE_ERASE,
+           (mcu.erase_us + (uint64_t) mcu.erase_kb_us * sectorSize / 1024) * 1000ULL);
+}
+
+void hostTimingStorageRead(uint32_t size)
+{
+    if (storageInternal) {
+        charge(CHARGE_STORAGE, (uint64_t) size * mcu.read_ns);
+    } else {
+        uint32_t block = (storage.block_size > 0) ? storage.block_size : 1;
+        uint64_t blocks = (size + block - 1) / block;
+
+        charge(CHARGE_STORAGE,
+               (storage.command_us + blocks * storage.block_us) * 1000ULL +
+               (uint64_t) size * storage.byte_ns);
+    }
+}
+
+uint32_t us_ticker_read(void)
+{
+    return (uint32_t)(simulatedNanoseconds / 1000);
+}
+
+/* linked in place of mbedtls_sha256_update() with --wrap, to charge the
+   hash time and reads of the flash through its memory map */
+extern "C" void __real_mbedtls_sha256_update(mbedtls_sha256_context *ctx,
+                                             const unsigned char *input,
+                                             size_t ilen);
+
+extern "C" void __wrap_mbedtls_sha256_update(mbedtls_sha256_context *ctx,
+                                             const unsigned char *input,
+                                             size_t ilen)
+{
+    uint32_t address = 0;
+
+    if (hostFlashMapped(input, &address)) {
+        if (hostStorageHolds(address)) {
+            charge(CHARGE_STORAGE, (uint64_t) ilen * (mcu.read_ns + mcu.hash_ns));
+        } else {
+            charge(CHARGE_FLASH, (uint64_t) ilen * (mcu.read_ns + mcu.hash_ns));
+        }
+    } else if ((input >= flashReadBuffer) &&
+               (input + ilen <= flashReadBuffer + flashReadSize)) {
+        charge(CHARGE_FLASH, (uint64_t) ilen * mcu.hash_ns);
+    } else {
+        charge(CHARGE_PROGRAM, (uint64_t) ilen * mcu.hash_ns);
+    }
+
+    __real_mbedtls_sha256_update(ctx, input, ilen);
+}
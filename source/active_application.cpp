@@ -22,6 +22,9 @@
 
 #include "active_application.h"
 #include "bootloader_common.h"
+#include "boot_timing.h"
+#include "transfer_sizing.h"
+#include "ucp_request.h"
 
 #include "update-client-common/arm_uc_metadata_header_v2.h"
 #include "update-client-common/arm_uc_utilities.h"
@@ -31,12 +34,464 @@
 
 #include <inttypes.h>
 
+#if defined(TRANSFER_CALIBRATION) && (TRANSFER_CALIBRATION == 1) && \
+    defined(ARM_UC_USE_PAL_BLOCKDEVICE) && (ARM_UC_USE_PAL_BLOCKDEVICE == 1)
+#include "BlockDevice.h"
+
+/* storage device of the block device PAAL, see main.cpp */
+extern BlockDevice *arm_uc_blockdevice;
+#endif
+
+#if defined(CHUNK_MANIFEST) && (CHUNK_MANIFEST == 1)
+#include "chunk_manifest.h"
+
+/* chunk manifest of the active application and the result of its check */
+static chunk_manifest_t activeManifest;
+static chunk_check_t activeChunkCheck;
+#endif
+
+#if defined(VERIFIED_IMAGE_CACHE) && (VERIFIED_IMAGE_CACHE == 1)
+#if !defined(NVSTORE_ENABLED) || !NVSTORE_ENABLED
+#error "VERIFIED_IMAGE_CACHE requires NVStore"
+#endif
+
+#include "nvstore_record.h"
+
+/* Hash the active application in full at least every N boots, even if it
+   was verified before. 0 disables the forced check.
+*/
+#ifndef VERIFIED_IMAGE_CACHE_CHECK_INTERVAL
+#define VERIFIED_IMAGE_CACHE_CHECK_INTERVAL 16
+#endif
+
+/* record of the last active application that passed a full hash check */
+typedef struct {
+    uint64_t version;
+    uint64_t size;
+    uint8_t  hash[SIZEOF_SHA256];
+} verified_image_record_t;
+
+/* one record per application region */
+#define VERIFIED_IMAGE_KEY(region) (((region) == 0) ? NVSTORE_KEY_VERIFIED_IMAGE : \
+                                    NVSTORE_KEY_VERIFIED_IMAGE_B)
+#endif
+
+#if defined(RESUMABLE_INSTALL) && (RESUMABLE_INSTALL == 1)
+#if !defined(NVSTORE_ENABLED) || !NVSTORE_ENABLED
+#error "RESUMABLE_INSTALL requires NVStore"
+#endif
+
+#include "nvstore_record.h"
+
+/* Update the install journal after at least this many bytes, limits the
+   number of NVStore writes per install. */
+#ifndef INSTALL_JOURNAL_INTERVAL
+#define INSTALL_JOURNAL_INTERVAL (64 * 1024)
+#endif
+
+/* progress of the install that is in progress */
+typedef struct {
+    uint64_t version;
+    uint64_t size;
+    uint8_t  hash[SIZEOF_SHA256];
+    uint8_t  campaign[ARM_UC_GUID_SIZE];
+    uint32_t slot;
+    uint32_t completed;
+} install_journal_record_t;
+#endif
+
+#if defined(BOOTLOADER_POWER_CUT_TEST) && (BOOTLOADER_POWER_CUT_TEST == 1)
+#include "bootloader_power_cut_test.h"
+#endif
+
+#if defined(DELTA_UPDATE) && (DELTA_UPDATE == 1)
+#include "delta_patch.h"
+
+/* size of the buffer used to read delta patch operations from storage */
+#ifndef DELTA_PATCH_BUFFER_SIZE
+#define DELTA_PATCH_BUFFER_SIZE 1024
+#endif
+
+#if defined(VERIFIED_IMAGE_CACHE) && (VERIFIED_IMAGE_CACHE == 1)
+#include "nvstore_record.h"
+#endif
+#endif
+
+#if defined(COMPRESSED_IMAGES) && (COMPRESSED_IMAGES == 1)
+#include "compressed_image.h"
+#endif
+
+/* largest number of bytes handed to a single FlashIAP program call,
+   0 programs up to the next sector boundary */
+#ifndef PROGRAM_RUN_SIZE
+#define PROGRAM_RUN_SIZE 0
+#endif
+
+/* largest number of bytes handed to a single FlashIAP erase call,
+   0 erases a whole run of equal sized sectors at once */
+#ifndef ERASE_RUN_SIZE
+#define ERASE_RUN_SIZE 0
+#endif
+
+/* skip erasing sectors that already hold the erased value. Only safe on
+   flash without ECC that may be programmed again over words that were
+   programmed with the erase value, so it is off by default. */
+#ifndef BLANK_CHECK
+#define BLANK_CHECK 0
+#endif
+
+/* number of runs of equal sized sectors kept in the sector map */
+#ifndef SECTOR_MAP_REGIONS
+#define SECTOR_MAP_REGIONS 8
+#endif
+
+#if defined(XIP_AB_BOOT) && (XIP_AB_BOOT == 1)
+#if defined(DELTA_UPDATE) && (DELTA_UPDATE == 1)
+#error "DELTA_UPDATE patches the active region in place and cannot be used with XIP_AB_BOOT"
+#endif
+
+#if defined(RESUMABLE_INSTALL) && (RESUMABLE_INSTALL == 1)
+#error "RESUMABLE_INSTALL cannot be used with XIP_AB_BOOT"
+#endif
+
+/* application region the firmware runs from */
+typedef struct {
+    uint32_t header;
+    uint32_t start;
+    uint32_t jump;
+} application_region_t;
+
+static const application_region_t applicationRegions[APPLICATION_REGION_COUNT] = {
+    {
+        FIRMWARE_METADATA_HEADER_ADDRESS,
+        MBED_CONF_APP_APPLICATION_START_ADDRESS,
+        MBED_CONF_APP_APPLICATION_JUMP_ADDRESS
+    },
+    {
+        APPLICATION_B_HEADER_ADDRESS,
+        APPLICATION_B_START_ADDRESS,
+        APPLICATION_B_JUMP_ADDRESS
+    }
+};
+
+/* region read, checked and written by the functions below */
+static uint32_t activeRegion = 0;
+
+#define ACTIVE_REGION                    activeRegion
+#define ACTIVE_HEADER_ADDRESS            (applicationRegions[activeRegion].header)
+#define ACTIVE_APPLICATION_START_ADDRESS (applicationRegions[activeRegion].start)
+#define ACTIVE_APPLICATION_JUMP_ADDRESS  (applicationRegions[activeRegion].jump)
+#else
+#define ACTIVE_REGION                    0
+#define ACTIVE_HEADER_ADDRESS            FIRMWARE_METADATA_HEADER_ADDRESS
+#define ACTIVE_APPLICATION_START_ADDRESS MBED_CONF_APP_APPLICATION_START_ADDRESS
+#define ACTIVE_APPLICATION_JUMP_ADDRESS  MBED_CONF_APP_APPLICATION_JUMP_ADDRESS
+#endif
+
+/* read the internal flash through its memory map instead of FlashIAP::read.
+   Enabled per target in the application config, only for targets whose
+   internal flash can be read at its own addresses. */
+#ifndef MEMORY_MAPPED_FLASH
+#define MEMORY_MAPPED_FLASH 0
+#endif
+
+/* read firmware stored in internal flash through its memory map */
+#ifndef MAPPED_STORAGE
+#define MAPPED_STORAGE 0
+#endif
+
+#if MAPPED_STORAGE
+#if !MEMORY_MAPPED_FLASH
+#error "MAPPED_STORAGE requires MEMORY_MAPPED_FLASH"
+#endif
+
+#if !defined(MBED_CONF_UPDATE_CLIENT_STORAGE_ADDRESS) || \
+    !defined(MBED_CONF_UPDATE_CLIENT_STORAGE_SIZE)
+#error "MAPPED_STORAGE requires update-client.storage-address and update-client.storage-size"
+#endif
+#endif
+
+/* size of the stack buffer used to read back programmed pages */
+#define VERIFY_READBACK_SIZE 32
+
 static FlashIAP flash;
 
+/**
+ * Flash geometry, fixed at compile time when the target declares it in the
+ * configuration and queried from the flash driver otherwise.
+ */
+static inline uint32_t flashSectorSize(uint32_t address)
+{
+#if defined(FLASH_SECTOR_SIZE)
+    (void) address;
+    return FLASH_SECTOR_SIZE;
+#else
+    return flash.get_sector_size(address);
+#endif
+}
+
+static inline uint32_t flashPageSize(void)
+{
+#if defined(FLASH_PAGE_SIZE)
+    return FLASH_PAGE_SIZE;
+#else
+    return flash.get_page_size();
+#endif
+}
+
+static inline uint8_t flashEraseValue(void)
+{
+#if defined(FLASH_ERASE_VALUE)
+    return FLASH_ERASE_VALUE;
+#else
+    return flash.get_erase_value();
+#endif
+}
+
+/**
+ * Get the content of an internal flash region
+ * @detail Points straight into the memory mapped flash when possible,
+ *         otherwise the region is read into the buffer given.
+ * @param  buffer   Caller-allocated buffer of at least size bytes.
+ * @param  address  Flash address to read.
+ * @param  size     Number of bytes to read.
+ * @return the content, or NULL if the flash could not be read.
+ */
+static const uint8_t *readActiveFlash(uint8_t *buffer,
+                                      uint32_t address,
+                                      uint32_t size)
+{
+#if MEMORY_MAPPED_FLASH
+    (void) buffer;
+    (void) size;
+
+    return (const uint8_t *)(uintptr_t) address;
+#else
+    return (flash.read(buffer, address, size) == 0) ? buffer : NULL;
+#endif
+}
+
+/* run of equal sized sectors */
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+    uint32_t sectorSize;
+} sector_region_t;
+
+static sector_region_t sectorMap[SECTOR_MAP_REGIONS];
+static uint32_t sectorMapRegions = 0;
+
+/**
+ * Build the map of equal sized sector runs for the internal flash
+ * @detail The map is left empty if the flash has more runs than
+ *         SECTOR_MAP_REGIONS, the sector sizes are then queried one
+ *         sector at a time as before.
+ */
+static void buildSectorMap(void)
+{
+    uint32_t address = flash.get_flash_start();
+    uint32_t end = address + flash.get_flash_size();
+
+#if defined(FLASH_SECTOR_SIZE)
+    /* the whole flash is one run */
+    sectorMap[0].start = address;
+    sectorMap[0].end = end;
+    sectorMap[0].sectorSize = FLASH_SECTOR_SIZE;
+    sectorMapRegions = 1;
+#else
+    sectorMapRegions = 0;
+
+    while (address < end) {
+        uint32_t sectorSize = flash.get_sector_size(address);
+
+        if (sectorSize == 0) {
+            sectorMapRegions = 0;
+            break;
+        }
+
+        if ((sectorMapRegions > 0) &&
+                (sectorMap[sectorMapRegions - 1].sectorSize == sectorSize)) {
+            sectorMap[sectorMapRegions - 1].end = address + sectorSize;
+        } else if (sectorMapRegions < SECTOR_MAP_REGIONS) {
+            sectorMap[sectorMapRegions].start = address;
+            sectorMap[sectorMapRegions].end = address + sectorSize;
+            sectorMap[sectorMapRegions].sectorSize = sectorSize;
+            sectorMapRegions++;
+        } else {
+            tr_debug("More than %d sector regions", SECTOR_MAP_REGIONS);
+            sectorMapRegions = 0;
+            break;
+        }
+
+        address += sectorSize;
+    }
+#endif
+
+    tr_debug("Sector map regions: %" PRIu32, sectorMapRegions);
+}
+
+/**
+ * Find the run of equal sized sectors holding an address
+ * @return NULL if the address is not covered by the sector map.
+ */
+static const sector_region_t *findSectorRegion(uint32_t address)
+{
+    for (uint32_t index = 0; index < sectorMapRegions; index++) {
+        if ((address >= sectorMap[index].start) &&
+                (address < sectorMap[index].end)) {
+            return &sectorMap[index];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Offset of an address from the start of its sector
+ */
+static uint32_t sectorOffset(uint32_t address)
+{
+#if defined(FLASH_SECTOR_SIZE)
+    return address & (FLASH_SECTOR_SIZE - 1);
+#else
+    const sector_region_t *region = findSectorRegion(address);
+
+    if (region) {
+        return (address - region->start) % region->sectorSize;
+    }
+
+    return (address - flash.get_flash_start()) % flash.get_sector_size(address);
+#endif
+}
+
+#if defined(FLASH_SECTOR_SIZE)
+/**
+ * Check the flash geometry declared in the configuration against the driver
+ * @return true if the driver reports the same geometry.
+ */
+static bool checkFlashGeometry(void)
+{
+    bool result = (flash.get_page_size() == FLASH_PAGE_SIZE) &&
+                  (flash.get_erase_value() == FLASH_ERASE_VALUE) &&
+                  (flash.get_sector_size(FIRMWARE_METADATA_HEADER_ADDRESS) ==
+                   FLASH_SECTOR_SIZE) &&
+                  (flash.get_sector_size(MBED_CONF_APP_APPLICATION_START_ADDRESS) ==
+                   FLASH_SECTOR_SIZE);
+
+#if defined(XIP_AB_BOOT) && (XIP_AB_BOOT == 1)
+    result = result &&
+             (flash.get_sector_size(APPLICATION_B_HEADER_ADDRESS) ==
+              FLASH_SECTOR_SIZE) &&
+             (flash.get_sector_size(APPLICATION_B_START_ADDRESS) ==
+              FLASH_SECTOR_SIZE);
+#endif
+
+    if (!result) {
+        tr_error("Flash geometry does not match flash-sector-size, "
+                 "flash-page-size or flash-erase-value");
+    }
+
+    return result;
+}
+#endif
+
+#if defined(TRANSFER_CALIBRATION) && (TRANSFER_CALIBRATION == 1)
+/**
+ * Read from the firmware storage area for transfer size calibration
+ * @detail A block device or internal flash storage is read straight from
+ *         the start of update-client.storage-address, so the timing does
+ *         not depend on what the slots hold. Other storage drivers are
+ *         read through the PAAL from the first firmware location.
+ * @return true if all requested bytes were read.
+ */
+static bool readStorageForTiming(uint32_t offset, uint32_t size)
+{
+#if defined(ARM_UC_USE_PAL_BLOCKDEVICE) && (ARM_UC_USE_PAL_BLOCKDEVICE == 1)
+    return (size <= MBED_CONF_UPDATE_CLIENT_STORAGE_SIZE) &&
+           (offset <= MBED_CONF_UPDATE_CLIENT_STORAGE_SIZE - size) &&
+           (arm_uc_blockdevice->read(buffer_array,
+                                     MBED_CONF_UPDATE_CLIENT_STORAGE_ADDRESS + offset,
+                                     size) == 0);
+#else
+#if defined(MBED_CONF_UPDATE_CLIENT_STORAGE_ADDRESS) && \
+    defined(MBED_CONF_UPDATE_CLIENT_STORAGE_SIZE)
+    const uint32_t storageStart = MBED_CONF_UPDATE_CLIENT_STORAGE_ADDRESS;
+    const uint32_t flashStart = flash.get_flash_start();
+    const uint32_t flashEnd = flashStart + flash.get_flash_size();
+
+    if ((storageStart >= flashStart) && (storageStart < flashEnd)) {
+        return (size <= MBED_CONF_UPDATE_CLIENT_STORAGE_SIZE) &&
+               (offset <= MBED_CONF_UPDATE_CLIENT_STORAGE_SIZE - size) &&
+               (size <= flashEnd - storageStart) &&
+               (offset <= flashEnd - storageStart - size) &&
+               (flash.read(buffer_array, storageStart + offset, size) == 0);
+    }
+#endif
+
+    arm_uc_buffer_t buffer = {
+        .size_max = size,
+        .size     = size,
+        .ptr      = buffer_array
+    };
+
+    ucp_request_t request;
+    ucpRequestRead(&request, 0, offset, &buffer);
+
+    return ucpRun(&request) && (buffer.size == size);
+#endif
+}
+#endif
+
+/**
+ * Time transfers for transfer size calibration
+ * @detail Storage reads are made from the start of the storage area, see
+ *         readStorageForTiming(), flash reads from the start of the active
+ *         application. Nothing is written, so the program phase is timed by
+ *         its storage reads alone.
+ */
+static bool timeTransfer(transfer_phase_t phase,
+                         uint32_t size,
+                         uint32_t count,
+                         uint32_t *elapsed)
+{
+    bool result = true;
+    uint32_t startTime = us_ticker_read();
+
+    for (uint32_t index = 0; (index < count) && result; index++) {
+        if (phase == TRANSFER_FLASH_READ) {
+            result = (flash.read(buffer_array,
+                                 ACTIVE_APPLICATION_START_ADDRESS + index * size,
+                                 size) == 0);
+        } else {
+#if defined(TRANSFER_CALIBRATION) && (TRANSFER_CALIBRATION == 1)
+            result = readStorageForTiming(index * size, size);
+#else
+            result = false;
+#endif
+        }
+    }
+
+    *elapsed = us_ticker_read() - startTime;
+
+    return result;
+}
+
 bool activeStorageInit(void)
 {
     int rc = flash.init();
 
+#if defined(FLASH_SECTOR_SIZE)
+    if ((rc == 0) && !checkFlashGeometry()) {
+        rc = -1;
+    }
+#endif
+
+    if (rc == 0) {
+        buildSectorMap();
+
+        transferSizingInit(flashPageSize(), MEMORY_MAPPED_FLASH, timeTransfer);
+    }
+
     return (rc == 0);
 }
 
@@ -58,29 +513,280 @@ bool readActiveFirmwareHeader(arm_uc_firmware_details_t *details)
     bool result = false;
 
     if (details) {
-        /* clear most recent UCP event */
-        event_callback = CLEAR_EVENT;
+#if defined(XIP_AB_BOOT) && (XIP_AB_BOOT == 1)
+        /* the storage driver only knows the first region, parse the header
+           of the selected region straight from internal flash */
+        uint8_t header[ARM_UC_INTERNAL_HEADER_SIZE_V2];
+
+        result = (flash.read(header,
+                             ACTIVE_HEADER_ADDRESS,
+                             sizeof(header)) == 0) &&
+                 (arm_uc_parse_internal_header_v2(header, details).error == ERR_NONE);
+#else
+        /* get active firmware details using UCP and wait for the result */
+        ucp_request_t request;
+        ucpRequestActiveFirmwareDetails(&request, details);
+
+        result = ucpRun(&request);
+#endif
+    }
 
-        /* get active firmware details using UCP */
-        arm_uc_error_t status = ARM_UCP_GetActiveFirmwareDetails(details);
+    return result;
+}
 
-        /* if the call was accepted,
-           the event will indicate if the call succeeded
-        */
-        if (status.error == ERR_NONE) {
-            /* wait until the event has been set */
-            while (event_callback == CLEAR_EVENT) {
-                __WFI();
+#if defined(XIP_AB_BOOT) && (XIP_AB_BOOT == 1)
+void activeRegionSelect(uint32_t region)
+{
+    if (region < APPLICATION_REGION_COUNT) {
+        activeRegion = region;
+    }
+}
+
+uint32_t activeRegionSelected(void)
+{
+    return activeRegion;
+}
+#endif
+
+uint32_t activeApplicationStartAddress(void)
+{
+    return ACTIVE_APPLICATION_START_ADDRESS;
+}
+
+uint32_t activeApplicationJumpAddress(void)
+{
+    return ACTIVE_APPLICATION_JUMP_ADDRESS;
+}
+
+#if defined(VERIFIED_IMAGE_CACHE) && (VERIFIED_IMAGE_CACHE == 1)
+/* pointer to the skipped hash check counter in the heap, followed by its
+   complement. RAM that was not kept across a reset, such as after a power
+   cycle, holds no valid count and forces a full check. */
+uint32_t *verifiedImageSkips = NULL;
+
+#if VERIFIED_IMAGE_CACHE_CHECK_INTERVAL > 0
+/**
+ * Get the number of hash checks skipped since the last full check
+ * @return the count, or VERIFIED_IMAGE_CACHE_CHECK_INTERVAL if the counter
+ *         does not hold a valid count.
+ */
+static uint32_t verifiedImageSkipsGet(void)
+{
+    uint32_t count = VERIFIED_IMAGE_CACHE_CHECK_INTERVAL;
+
+    if (verifiedImageSkips &&
+            (verifiedImageSkips[0] == ~verifiedImageSkips[1])) {
+        count = verifiedImageSkips[0];
+    }
+
+    return count;
+}
+#endif
+
+/**
+ * Set the number of hash checks skipped since the last full check
+ */
+static void verifiedImageSkipsSet(uint32_t count)
+{
+    if (verifiedImageSkips) {
+        verifiedImageSkips[0] = count;
+        verifiedImageSkips[1] = ~count;
+    }
+}
+
+/**
+ * Check if the active application was verified on a previous boot
+ * @detail The record must match the version, size and hash in the header.
+ *         Every hit is counted in RAM, like bootCounter, so that a full
+ *         hash check is forced every VERIFIED_IMAGE_CACHE_CHECK_INTERVAL
+ *         boots without writing to NVStore.
+ * @param  details   Header of the active application.
+ * @param  recorded  Set to true if the header matches the record.
+ * @return true if the full hash check can be skipped.
+ */
+static bool verifiedImageCacheHit(const arm_uc_firmware_details_t *details,
+                                  bool *recorded)
+{
+    verified_image_record_t record;
+
+    bool hit = nvstoreRecordRead(VERIFIED_IMAGE_KEY(ACTIVE_REGION),
+                                 &record,
+                                 sizeof(record)) &&
+               (record.version == details->version) &&
+               (record.size == details->size) &&
+               (memcmp(record.hash, details->hash, SIZEOF_SHA256) == 0);
+
+    *recorded = hit;
+
+#if VERIFIED_IMAGE_CACHE_CHECK_INTERVAL > 0
+    if (hit) {
+        /* without a valid count the boot hashes in full */
+        uint32_t count = verifiedImageSkipsGet();
+
+        if (count + 1 < VERIFIED_IMAGE_CACHE_CHECK_INTERVAL) {
+            verifiedImageSkipsSet(count + 1);
+        } else {
+            hit = false;
+        }
+    }
+#endif
+
+    return hit;
+}
+
+/**
+ * Record that the active application passed a full hash check
+ * @param  details  Header of the active application.
+ */
+static void verifiedImageCacheStore(const arm_uc_firmware_details_t *details)
+{
+    verified_image_record_t record;
+    memset(&record, 0, sizeof(record));
+
+    record.version = details->version;
+    record.size = details->size;
+    memcpy(record.hash, details->hash, SIZEOF_SHA256);
+
+    if (!nvstoreRecordWrite(VERIFIED_IMAGE_KEY(ACTIVE_REGION), &record, sizeof(record))) {
+        tr_warning("Failed to store verified image record");
+    }
+
+    verifiedImageSkipsSet(0);
+}
+#endif
+
+#if defined(CHUNK_MANIFEST) && (CHUNK_MANIFEST == 1)
+/**
+ * Load the chunk manifest of the application in the ACTIVE app region
+ * @param  size  Size of the application payload.
+ * @return the manifest, or NULL if the application does not carry one.
+ */
+static const chunk_manifest_t *loadActiveChunkManifest(uint32_t size)
+{
+    const chunk_manifest_t *manifest = NULL;
+    uint32_t appStart = ACTIVE_APPLICATION_START_ADDRESS;
+    uint8_t footer[CHUNK_MANIFEST_FOOTER_SIZE];
+
+    if ((size > CHUNK_MANIFEST_FOOTER_SIZE) &&
+            (flash.read(footer,
+                        appStart + size - CHUNK_MANIFEST_FOOTER_SIZE,
+                        CHUNK_MANIFEST_FOOTER_SIZE) == 0) &&
+            chunkManifestParse(footer, size, &activeManifest)) {
+        uint32_t digestsSize = activeManifest.chunk_count * SIZEOF_SHA256;
+
+        if ((flash.read(activeManifest.digest[0],
+                        appStart + activeManifest.image_size,
+                        digestsSize) == 0) &&
+                (flash.read(activeManifest.root,
+                            appStart + activeManifest.image_size + digestsSize,
+                            SIZEOF_SHA256) == 0)) {
+            if (chunkManifestCheckRoot(&activeManifest)) {
+                manifest = &activeManifest;
+            } else {
+                tr_error("Active firmware chunk manifest does not match "
+                         "its root");
+            }
+        }
+    }
+
+    return manifest;
+}
+#endif
+
+/**
+ * Compute the hash of the application in the ACTIVE app region
+ * @detail If the application carries a chunk manifest, every chunk is also
+ *         checked on its own and the failed chunks are left in
+ *         activeChunkCheck.
+ * @param  size            Size of the application in bytes.
+ * @param  SHA             Caller-allocated buffer for the resulting SHA256.
+ * @param  stopAtBadChunk  Stop hashing at the first chunk that does not
+ *                         match the manifest instead of checking them all.
+ * @return true if the full application could be read and hashed.
+ */
+static bool hashActiveFirmware(uint32_t size,
+                               uint8_t SHA[SIZEOF_SHA256],
+                               bool stopAtBadChunk)
+{
+    uint32_t appStart = ACTIVE_APPLICATION_START_ADDRESS;
+
+#if defined(CHUNK_MANIFEST) && (CHUNK_MANIFEST == 1)
+    chunkCheckStart(&activeChunkCheck, loadActiveChunkManifest(size));
+#else
+    (void) stopAtBadChunk;
+#endif
+
+    /* initialize hashing facility */
+    mbedtls_sha256_context mbedtls_ctx;
+    mbedtls_sha256_init(&mbedtls_ctx);
+    mbedtls_sha256_starts(&mbedtls_ctx, 0);
+
+    uint32_t remaining = size;
+    int32_t status = 0;
+
+    /* read full image */
+    while ((remaining > 0) && (status == 0)) {
+        /* read full buffer or what is remaining */
+        uint32_t readSize = (remaining > transferSize(TRANSFER_FLASH_READ)) ?
+                            transferSize(TRANSFER_FLASH_READ) : remaining;
+
+        /* hash straight from the memory mapped flash when possible */
+        const uint8_t *data = readActiveFlash(buffer_array,
+                                              appStart + (size - remaining),
+                                              readSize);
+
+        if (data == NULL) {
+            status = -1;
+            break;
+        }
+
+        /* update hash */
+        mbedtls_sha256_update(&mbedtls_ctx, data, readSize);
+
+#if defined(CHUNK_MANIFEST) && (CHUNK_MANIFEST == 1)
+        uint32_t checked = activeChunkCheck.offset;
+        uint32_t failed = chunkCheckUpdate(&activeChunkCheck, data, readSize);
+
+        if (failed > 0) {
+            /* report every chunk that failed in this part */
+            for (uint32_t chunk = checked / activeManifest.chunk_size;
+                    (failed > 0) && (chunk < activeManifest.chunk_count);
+                    chunk++) {
+                if (chunkCheckFailed(&activeChunkCheck, chunk)) {
+                    tr_trace("\r\n");
+                    tr_error("Active firmware chunk %" PRIu32 " (offset 0x%08"
+                             PRIX32 ") failed integrity check", chunk,
+                             chunk * activeManifest.chunk_size);
+                    failed--;
+                }
             }
 
-            /* mark the firmware details as valid if so indicated by the event */
-            if (event_callback == ARM_UC_PAAL_EVENT_GET_ACTIVE_FIRMWARE_DETAILS_DONE) {
-                result = true;
+            if (stopAtBadChunk) {
+                status = -1;
             }
         }
+#endif
+
+        /* update remaining bytes */
+        remaining -= readSize;
+
+#if defined(SHOW_PROGRESS_BAR) && SHOW_PROGRESS_BAR == 1
+        printProgress(size - remaining, size);
+#endif
     }
 
-    return result;
+    /* finalize hash */
+    mbedtls_sha256_finish(&mbedtls_ctx, SHA);
+    mbedtls_sha256_free(&mbedtls_ctx);
+
+#if defined(CHUNK_MANIFEST) && (CHUNK_MANIFEST == 1)
+    chunkCheckFree(&activeChunkCheck);
+#endif
+
+    tr_debug("Hashed %" PRIu32 " bytes", size - remaining);
+    bootTimingFlashRead(size - remaining);
+
+    return (status == 0);
 }
 
 /**
@@ -95,363 +801,1834 @@ bool readActiveFirmwareHeader(arm_uc_firmware_details_t *details)
  *         EMPTY   if no active application is present
  *         ERROR   if the validation fails
  */
-int checkActiveApplication(arm_uc_firmware_details_t *details)
+int checkActiveApplication(arm_uc_firmware_details_t *details)
+{
+    tr_debug("checkActiveApplication");
+
+    int result = RESULT_ERROR;
+
+    if (details) {
+        /* Read header and verify that it is valid. The header is written
+           last during an install, so a missing header also identifies an
+           interrupted install without reading the application.
+        */
+        bool headerValid = readActiveFirmwareHeader(details);
+
+        /* calculate hash if header is valid and slot is not empty */
+        if ((headerValid) && (details->size > 0)) {
+            tr_debug("header start: 0x%08" PRIX32,
+                     (uint32_t) ACTIVE_HEADER_ADDRESS);
+            tr_debug("app start: 0x%08" PRIX32,
+                     (uint32_t) ACTIVE_APPLICATION_START_ADDRESS);
+            tr_debug("app size: %" PRIu64, details->size);
+
+            bool verified = false;
+
+#if defined(VERIFIED_IMAGE_CACHE) && (VERIFIED_IMAGE_CACHE == 1)
+            /* skip the hash if this exact header was verified before */
+            bool recorded = false;
+            verified = verifiedImageCacheHit(details, &recorded);
+
+            if (verified) {
+                tr_info("Active firmware verified on a previous boot");
+                result = RESULT_SUCCESS;
+            }
+#endif
+
+            if (!verified) {
+                uint8_t SHA[SIZEOF_SHA256] = { 0 };
+
+                bool hashed = hashActiveFirmware(details->size, SHA, true);
+
+                /* compare calculated hash with hash from header */
+                int diff = memcmp(details->hash, SHA, SIZEOF_SHA256);
+
+                if (hashed && (diff == 0)) {
+                    result = RESULT_SUCCESS;
+
+#if defined(VERIFIED_IMAGE_CACHE) && (VERIFIED_IMAGE_CACHE == 1)
+                    /* a forced check of a recorded header only restarts
+                       the count */
+                    if (!recorded) {
+                        verifiedImageCacheStore(details);
+                    } else {
+                        verifiedImageSkipsSet(0);
+                    }
+#endif
+                } else {
+                    printSHA256(details->hash);
+                    printSHA256(SHA);
+                }
+            }
+        } else if ((headerValid) && (details->size == 0)) {
+            /* header is valid but application size is 0 */
+            result = RESULT_EMPTY;
+        }
+    }
+
+    return result;
+}
+
+#if defined(BLANK_CHECK) && (BLANK_CHECK == 1)
+/**
+ * Check if a sector already holds the erased value
+ * @detail The sector is read a word at a time, straight from the memory
+ *         mapped internal flash when possible.
+ * @param  address  Start of the sector, word aligned.
+ * @param  size     Size of the sector, multiple of the word size.
+ * @return true if every byte in the sector equals the erase value.
+ */
+static bool sectorIsBlank(uint32_t address, uint32_t size)
+{
+    const uint32_t blank = 0x01010101UL * flashEraseValue();
+    uint32_t readback[VERIFY_READBACK_SIZE / sizeof(uint32_t)];
+    uint32_t offset = 0;
+
+    while (offset < size) {
+        uint32_t length = size - offset;
+
+#if !MEMORY_MAPPED_FLASH
+        if (length > sizeof(readback)) {
+            length = sizeof(readback);
+        }
+#endif
+
+        const uint32_t *word = (const uint32_t *) readActiveFlash((uint8_t *) readback,
+                                                                  address + offset,
+                                                                  length);
+
+        if (word == NULL) {
+            return false;
+        }
+
+        for (uint32_t index = 0; index < length / sizeof(uint32_t); index++) {
+            if (word[index] != blank) {
+                return false;
+            }
+        }
+
+        offset += length;
+    }
+
+    return true;
+}
+#endif
+
+int eraseSectorBySector(uint32_t addr, uint32_t size)
+{
+    tr_debug("Erasing from 0x%08" PRIX32 " to 0x%08" PRIX32,
+             (uint32_t) addr, (uint32_t) addr + size);
+
+    int result = -1;
+    uint32_t erase_address = addr;
+    uint32_t calls = 0;
+    uint32_t blank = 0;
+    uint32_t erased = 0;
+    uint32_t startTime = us_ticker_read();
+
+    /* Erase flash to make place for new application. Some platforms have
+       variable sector sizes and mbed-os cannot deal with erasing multiple
+       sectors successfully in that case. https://github.com/ARMmbed/mbed-os/issues/6077
+       Sectors of the same size are merged into one erase call, sectors of
+       different sizes are never erased together. */
+    while (erase_address < (addr + size)) {
+        const sector_region_t *region = findSectorRegion(erase_address);
+        uint32_t sector_size = region ? region->sectorSize :
+                               flashSectorSize(erase_address);
+
+#if defined(BLANK_CHECK) && (BLANK_CHECK == 1)
+        if (sectorIsBlank(erase_address, sector_size)) {
+            erase_address += sector_size;
+            blank++;
+            result = 0;
+            continue;
+        }
+#endif
+
+        uint32_t erase_size = sector_size;
+
+        if (region) {
+            /* extend over the following sectors in the range and region */
+            while (((erase_address + erase_size) < (addr + size)) &&
+                    ((erase_address + erase_size) < region->end)) {
+#if ERASE_RUN_SIZE > 0
+                if ((erase_size + sector_size) > ERASE_RUN_SIZE) {
+                    break;
+                }
+#endif
+#if defined(BLANK_CHECK) && (BLANK_CHECK == 1)
+                if (sectorIsBlank(erase_address + erase_size, sector_size)) {
+                    break;
+                }
+#endif
+                erase_size += sector_size;
+            }
+        }
+
+        result = flash.erase(erase_address,
+                             erase_size);
+        calls++;
+
+        if (result != 0) {
+            tr_debug("Erasing from 0x%08" PRIX32 " to 0x%08" PRIX32 " failed with retval %i",
+                     erase_address, erase_address + erase_size, result);
+            break;
+        } else {
+            erase_address += erase_size;
+            erased += erase_size;
+        }
+    }
+
+    tr_debug("Erase calls: %" PRIu32 ", blank sectors: %" PRIu32 ", time: %" PRIu32 " ms",
+             calls, blank, (us_ticker_read() - startTime) / 1000);
+    bootTimingErase(us_ticker_read() - startTime, erased);
+    (void) blank;
+
+    return result;
+}
+
+uint32_t getSectorAlignedSize(uint32_t addr, uint32_t size)
+{
+    tr_debug("getSectorAlignedSize at 0x%08" PRIX32 " of size 0x%08" PRIX32,
+             (uint32_t) addr, (uint32_t) size);
+
+#if defined(FLASH_SECTOR_SIZE)
+    (void) addr;
+
+    return (size + FLASH_SECTOR_SIZE - 1) & ~((uint32_t) FLASH_SECTOR_SIZE - 1);
+#else
+    /* Find the exact end sector boundary. Some platforms have different sector
+       sizes from sector to sector. Hence we count the sizes 1 region or
+       1 sector at a time here */
+    uint32_t erase_address = addr;
+    while (erase_address < (addr + size)) {
+        const sector_region_t *region = findSectorRegion(erase_address);
+
+        if (region) {
+            uint32_t remaining = (addr + size) - erase_address;
+            uint32_t aligned = (remaining + region->sectorSize - 1)
+                               / region->sectorSize * region->sectorSize;
+
+            erase_address += (aligned < (region->end - erase_address)) ?
+                             aligned : (region->end - erase_address);
+        } else {
+            erase_address += flash.get_sector_size(erase_address);
+        }
+    }
+
+    return erase_address - addr;
+#endif
+}
+
+/**
+ * Wipe the ACTIVE firmware region in the flash
+ */
+bool eraseActiveFirmware(uint32_t firmwareSize)
+{
+    tr_debug("eraseActiveFirmware");
+
+    uint32_t fw_metadata_hdr_size = getSectorAlignedSize(ACTIVE_HEADER_ADDRESS,
+                                                         ARM_UC_INTERNAL_HEADER_SIZE_V2);
+    uint32_t size_needed = 0;
+    uint32_t erase_start_addr = 0;
+    int result = 0;
+
+    if (((ACTIVE_HEADER_ADDRESS + fw_metadata_hdr_size) < \
+            (ACTIVE_APPLICATION_START_ADDRESS)) || \
+            (ACTIVE_HEADER_ADDRESS > ACTIVE_APPLICATION_START_ADDRESS)) {
+        /* header separate from app */
+        tr_debug("Erasing header separately from active application");
+
+        /* erase header section first */
+        result = eraseSectorBySector(ACTIVE_HEADER_ADDRESS, fw_metadata_hdr_size);
+
+        /* setup erase of the application region */
+        size_needed = firmwareSize;
+        erase_start_addr = ACTIVE_APPLICATION_START_ADDRESS;
+    } else { /* header contiguous with app */
+        /* setup erase of the header + application region */
+        size_needed = (ACTIVE_APPLICATION_START_ADDRESS - ACTIVE_HEADER_ADDRESS) + firmwareSize;
+        erase_start_addr = ACTIVE_HEADER_ADDRESS;
+    }
+
+    if (result == 0) {
+        uint32_t erase_end_addr = erase_start_addr + \
+                                  getSectorAlignedSize(erase_start_addr,
+                                                       size_needed);
+        uint32_t max_end_addr = MBED_CONF_APP_MAX_APPLICATION_SIZE + \
+                                ACTIVE_APPLICATION_START_ADDRESS;
+        /* check that the erase will not exceed MBED_CONF_APP_MAX_APPLICATION_SIZE */
+        if (erase_end_addr <= max_end_addr) {
+            result = eraseSectorBySector(erase_start_addr, size_needed);
+        } else {
+            result = -1;
+            tr_error("Firmware size 0x%" PRIX32 " rounded up to the nearest sector boundary 0x%" \
+                     PRIX32 " is larger than the maximum application size 0x%" PRIX32,
+                     firmwareSize, erase_end_addr - ACTIVE_APPLICATION_START_ADDRESS,
+                     MBED_CONF_APP_MAX_APPLICATION_SIZE);
+        }
+    }
+
+    return (result == 0);
+}
+
+/**
+ * Compare a flash region with a RAM buffer
+ * @param  data      Expected content.
+ * @param  address   Flash address to compare.
+ * @param  size      Number of bytes to compare.
+ * @param  mismatch  Set to the start of the first block that differs.
+ * @return 0 if the flash region matches the buffer, 1 if it differs and
+ *         -1 if the flash could not be read.
+ */
+static int compareActiveFlash(const uint8_t *data,
+                              uint32_t address,
+                              uint32_t size,
+                              uint32_t *mismatch)
+{
+    int result = 0;
+    uint8_t readback[VERIFY_READBACK_SIZE];
+    uint32_t step = VERIFY_READBACK_SIZE;
+
+#if MEMORY_MAPPED_FLASH
+    /* compare the whole region in place */
+    if (size > 0) {
+        step = size;
+    }
+#endif
+
+    for (uint32_t offset = 0; (offset < size) && (result == 0);
+            offset += step) {
+        uint32_t length = (size - offset) > step ? step : (size - offset);
+
+        const uint8_t *content = readActiveFlash(readback, address + offset, length);
+
+        if (content == NULL) {
+            result = -1;
+        } else if (memcmp(content, &data[offset], length) != 0) {
+            *mismatch = address + offset;
+            result = 1;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Check that a flash region holds the content of a RAM buffer
+ * @param  data     Expected content.
+ * @param  address  Flash address to compare.
+ * @param  size     Number of bytes to compare.
+ * @return 0 if the flash region matches the buffer.
+ */
+static int verifyActiveFlash(const uint8_t *data, uint32_t address, uint32_t size)
+{
+    uint32_t mismatch = 0;
+
+    int result = compareActiveFlash(data, address, size, &mismatch);
+
+    if (result == 1) {
+        tr_error("Flash verification failed at 0x%08" PRIX32, mismatch);
+        result = -1;
+    }
+
+    return result;
+}
+
+/**
+ * Program a flash region from RAM
+ * @detail The region is programmed in runs that never cross a sector
+ *         boundary, and no longer than PROGRAM_RUN_SIZE when that is set.
+ *         When VERIFY_DURING_COPY is enabled each run is read back and
+ *         compared with the source straight after programming.
+ * @param  data     Source buffer.
+ * @param  address  Flash address to program, page aligned.
+ * @param  size     Number of bytes to program, multiple of the page size.
+ * @return 0 if programming (and verification) succeeds.
+ */
+static int programActiveFlash(const uint8_t *data, uint32_t address, uint32_t size)
+{
+    int result = 0;
+    uint32_t offset = 0;
+
+    while ((offset < size) && (result == 0)) {
+        uint32_t runAddress = address + offset;
+        uint32_t runSize = flashSectorSize(runAddress) - sectorOffset(runAddress);
+
+        if (runSize > (size - offset)) {
+            runSize = size - offset;
+        }
+
+#if PROGRAM_RUN_SIZE > 0
+        if (runSize > PROGRAM_RUN_SIZE) {
+            runSize = PROGRAM_RUN_SIZE;
+        }
+#endif
+
+        result = flash.program(&data[offset], runAddress, runSize);
+
+        if (result == 0) {
+            bootTimingProgram(runSize);
+        }
+
+#if defined(VERIFY_DURING_COPY) && (VERIFY_DURING_COPY == 1)
+        if (result == 0) {
+            uint32_t startTime = us_ticker_read();
+            result = verifyActiveFlash(&data[offset], runAddress, runSize);
+            bootTimingVerify(us_ticker_read() - startTime);
+        }
+#endif
+
+        offset += runSize;
+    }
+
+    return result;
+}
+
+bool writeActiveFirmwareHeader(arm_uc_firmware_details_t *details)
+{
+    tr_debug("writeActiveFirmwareHeader");
+
+    bool result = false;
+
+    if (details) {
+        /* round up program size to nearest page size */
+        const uint32_t pageSize = flashPageSize();
+        const uint32_t programSize = (ARM_UC_INTERNAL_HEADER_SIZE_V2 + pageSize - 1)
+                                     / pageSize * pageSize;
+        const uint32_t fw_metadata_hdr_size = \
+                                              getSectorAlignedSize(ACTIVE_HEADER_ADDRESS,
+                                                                   ARM_UC_INTERNAL_HEADER_SIZE_V2);
+
+        /* coverity[no_escape] */
+        MBED_BOOTLOADER_ASSERT((programSize <= BUFFER_SIZE),
+                               "Header program size %" PRIu32 " bigger than buffer %d\r\n",
+                               programSize, BUFFER_SIZE);
+
+        /* coverity[no_escape] */
+        MBED_BOOTLOADER_ASSERT((programSize <= fw_metadata_hdr_size),
+                               "Header program size %" PRIu32 " bigger than expected header %d\r\n",
+                               programSize, fw_metadata_hdr_size);
+
+        /* pad buffer with the erase value */
+        memset(buffer_array, flashEraseValue(), programSize);
+
+        /* create internal header in temporary buffer */
+        arm_uc_buffer_t output_buffer = {
+            .size_max = BUFFER_SIZE,
+            .size     = 0,
+            .ptr      = buffer_array
+        };
+
+        arm_uc_error_t status = arm_uc_create_internal_header_v2(details,
+                                                                 &output_buffer);
+
+        if ((status.error == ERR_NONE) &&
+                (output_buffer.size == ARM_UC_INTERNAL_HEADER_SIZE_V2)) {
+            /* write header using FlashIAP API */
+            int ret = flash.program(buffer_array,
+                                    ACTIVE_HEADER_ADDRESS,
+                                    programSize);
+
+            /* the header commits the install, always read it back */
+            if (ret == 0) {
+                bootTimingProgram(programSize);
+
+                uint32_t startTime = us_ticker_read();
+                ret = verifyActiveFlash(buffer_array,
+                                        ACTIVE_HEADER_ADDRESS,
+                                        programSize);
+                bootTimingVerify(us_ticker_read() - startTime);
+            }
+
+            result = (ret == 0);
+        }
+    }
+
+    return result;
+}
+
+#if MAPPED_STORAGE
+/* set for the slots whose firmware was hashed in place and matched its
+   header, only these are programmed from their mapped address */
+static bool mappedConfirmed[MAX_FIRMWARE_LOCATIONS] = { false };
+
+const uint8_t *mappedStoredFirmware(uint32_t index, uint32_t size)
+{
+    const uint8_t *result = NULL;
+
+    /* slot layout of the internal flash PAAL, from the same configuration:
+       update-client.storage-size is split into
+       update-client.storage-locations slots rounded down to whole sectors,
+       and the firmware follows the slot header rounded up to a whole
+       sector */
+    const uint32_t storageStart = MBED_CONF_UPDATE_CLIENT_STORAGE_ADDRESS;
+    const uint32_t sectorSize = flashSectorSize(storageStart);
+    const uint32_t flashEnd = flash.get_flash_start() + flash.get_flash_size();
+
+    if ((sectorSize > 0) && (size > 0) &&
+            (index < MBED_CONF_UPDATE_CLIENT_STORAGE_LOCATIONS)) {
+        const uint32_t slotSize = MBED_CONF_UPDATE_CLIENT_STORAGE_SIZE /
+                                  MBED_CONF_UPDATE_CLIENT_STORAGE_LOCATIONS /
+                                  sectorSize * sectorSize;
+        const uint32_t headerSize = (ARM_UC_EXTERNAL_HEADER_SIZE_V2 +
+                                     sectorSize - 1) / sectorSize * sectorSize;
+        const uint32_t address = storageStart + index * slotSize + headerSize;
+
+        if ((slotSize > headerSize) && (size <= slotSize - headerSize) &&
+                (address < flashEnd) && (size <= flashEnd - address)) {
+            result = (const uint8_t *)(uintptr_t) address;
+
+            tr_debug("Slot %" PRIu32 " is mapped at 0x%08" PRIX32,
+                     index, address);
+        }
+    }
+
+    return result;
+}
+
+void mappedStoredFirmwareConfirm(uint32_t index)
+{
+    if (index < MAX_FIRMWARE_LOCATIONS) {
+        mappedConfirmed[index] = true;
+    }
+}
+
+/**
+ * Check if two internal flash ranges lie in different banks
+ * @detail Flash that is read while a sector in the same bank is programmed
+ *         stalls or faults on single bank parts. Without flash-bank-size
+ *         the whole flash is one bank.
+ * @return true if no bank holds part of both ranges.
+ */
+static bool flashBanksDiffer(uint32_t first, uint32_t firstSize,
+                             uint32_t second, uint32_t secondSize)
+{
+#if defined(FLASH_BANK_SIZE) && (FLASH_BANK_SIZE > 0)
+    const uint32_t start = flash.get_flash_start();
+
+    return (((first + firstSize - 1 - start) / FLASH_BANK_SIZE) <
+            ((second - start) / FLASH_BANK_SIZE)) ||
+           (((second + secondSize - 1 - start) / FLASH_BANK_SIZE) <
+            ((first - start) / FLASH_BANK_SIZE));
+#else
+    (void) first;
+    (void) firstSize;
+    (void) second;
+    (void) secondSize;
+
+    return false;
+#endif
+}
+#endif
+
+#if defined(VERIFY_DURING_COPY) && (VERIFY_DURING_COPY == 1)
+/* set when the firmware hashed while it was copied does not match its
+   header, copying it again reads the same data */
+static bool copyMismatch = false;
+#endif
+
+bool writeActiveFirmware(uint32_t index, arm_uc_firmware_details_t *details)
+{
+    tr_debug("writeActiveFirmware");
+
+    bool result = false;
+
+    if (details) {
+        const uint32_t pageSize = flashPageSize();
+
+        /* we require app_start_addr fall on a page size boundary,
+           checked by bootloader_config.h when the geometry is declared */
+        uint32_t app_start_addr = ACTIVE_APPLICATION_START_ADDRESS;
+
+#if !defined(FLASH_PAGE_SIZE)
+        /* coverity[no_escape] */
+        MBED_BOOTLOADER_ASSERT((app_start_addr % pageSize) == 0,
+                               "Application (0x%" PRIX32 ") does not start on a "
+                               "page size (0x%" PRIX32 ") aligned address\r\n",
+                               app_start_addr,
+                               pageSize);
+#endif
+
+        /* a multiple of the page size that still fits inside the main
+           buffer, see transfer_sizing.h
+        */
+        uint32_t readSize = transferSize(TRANSFER_PROGRAM);
+
+        arm_uc_buffer_t buffer = {
+            .size_max = readSize,
+            .size     = 0,
+            .ptr      = buffer_array
+        };
+
+        int retval = 0;
+        uint32_t offset = 0;
+
+#if MAPPED_STORAGE
+        /* read the slot straight from the internal flash once its content
+           was confirmed in place, and program from it directly when the
+           slot and the active region are in different banks */
+        const uint8_t *mapped = NULL;
+        bool mappedDirect = false;
+
+        if ((index < MAX_FIRMWARE_LOCATIONS) && mappedConfirmed[index]) {
+            mapped = mappedStoredFirmware(index, details->size);
+        }
+
+        if (mapped) {
+            mappedDirect = flashBanksDiffer((uint32_t)(uintptr_t) mapped,
+                                            details->size,
+                                            app_start_addr,
+                                            details->size);
+        }
+#endif
+
+#if defined(VERIFY_DURING_COPY) && (VERIFY_DURING_COPY == 1)
+        /* hash the image as it is programmed */
+        mbedtls_sha256_context mbedtls_ctx;
+        mbedtls_sha256_init(&mbedtls_ctx);
+        mbedtls_sha256_starts(&mbedtls_ctx, 0);
+#endif
+
+        /* write firmware */
+        while ((offset < details->size) &&
+                (retval == 0)) {
+            /* set the number of bytes expected */
+            buffer.size = (details->size - offset) > buffer.size_max ?
+                          buffer.size_max : (details->size - offset);
+
+            const uint8_t *data = buffer.ptr;
+            bool filled = false;
+
+#if MAPPED_STORAGE
+            /* whole pages need no copy, a partial last page is padded in
+               the buffer */
+            if (mappedDirect && (buffer.size >= pageSize)) {
+                buffer.size -= buffer.size % pageSize;
+                data = &mapped[offset];
+                filled = true;
+            } else if (mapped) {
+                memcpy(buffer.ptr, &mapped[offset], buffer.size);
+                filled = true;
+            } else
+#endif
+            {
+                /* fill buffer using UCP and wait for the result */
+                ucp_request_t request;
+                ucpRequestRead(&request, index, offset, &buffer);
+
+                filled = ucpRun(&request);
+            }
+
+            /* check status and actual read size */
+            if (filled &&
+                    (buffer.size > 0)) {
+#if defined(VERIFY_DURING_COPY) && (VERIFY_DURING_COPY == 1)
+                mbedtls_sha256_update(&mbedtls_ctx, data, buffer.size);
+#endif
+
+                /* the last page, in the last buffer might not be completely
+                   filled, round up the program size to include the last page
+                   and pad it with the erased value
+                */
+                uint32_t programSize = (buffer.size + pageSize - 1)
+                                       / pageSize * pageSize;
+
+                memset(&buffer.ptr[buffer.size], flashEraseValue(), programSize - buffer.size);
+
+                /* write the whole buffer, split at sector boundaries */
+                retval = programActiveFlash(data,
+                                            app_start_addr + offset,
+                                            programSize);
+
+#if defined(SHOW_PROGRESS_BAR) && SHOW_PROGRESS_BAR == 1
+                printProgress(offset + programSize, details->size);
+#endif
+
+                tr_debug("\r\n%" PRIu32 "/%" PRIu32 " writing %" PRIu32 " bytes to 0x%08" PRIX32,
+                         offset, (uint32_t) details->size, programSize, app_start_addr + offset);
+
+                offset += programSize;
+            } else {
+                tr_error("ARM_UCP_Read returned 0 bytes");
+
+                /* set error and break out of loop */
+                retval = -1;
+                break;
+            }
+        }
+
+        tr_debug("Copied %" PRIu32 " bytes", offset);
+
+#if defined(VERIFY_DURING_COPY) && (VERIFY_DURING_COPY == 1)
+        /* compare the hash of the programmed image with the header */
+        uint8_t SHA[SIZEOF_SHA256] = { 0 };
+        mbedtls_sha256_finish(&mbedtls_ctx, SHA);
+        mbedtls_sha256_free(&mbedtls_ctx);
+
+        if ((retval == 0) &&
+                (memcmp(details->hash, SHA, SIZEOF_SHA256) != 0)) {
+            printSHA256(details->hash);
+            printSHA256(SHA);
+            copyMismatch = true;
+            retval = -1;
+        }
+#endif
+
+        result = (retval == 0);
+    }
+
+    return result;
+}
+
+#if (defined(DELTA_UPDATE) && (DELTA_UPDATE == 1)) || \
+    (defined(COMPRESSED_IMAGES) && (COMPRESSED_IMAGES == 1))
+/**
+ * Read part of a stored firmware and wait for the read to complete
+ * @return true if all requested bytes were read.
+ */
+static bool readStoredFirmware(uint32_t index,
+                               uint32_t offset,
+                               uint8_t *data,
+                               uint32_t size)
+{
+    arm_uc_buffer_t buffer = {
+        .size_max = size,
+        .size     = size,
+        .ptr      = data
+    };
+
+    ucp_request_t request;
+    ucpRequestRead(&request, index, offset, &buffer);
+
+    return ucpRun(&request) &&
+           (buffer.size == size);
+}
+#endif
+
+#if defined(DELTA_UPDATE) && (DELTA_UPDATE == 1)
+/* buffered reader for the operations of a stored delta patch */
+typedef struct {
+    uint32_t index;
+    uint32_t offset;
+    uint32_t size;
+    uint32_t position;
+    uint32_t length;
+    uint8_t  buffer[DELTA_PATCH_BUFFER_SIZE];
+} delta_patch_reader_t;
+
+static delta_patch_reader_t deltaReader;
+
+/**
+ * Read the header of a stored delta patch
+ * @return true if the stored firmware is a delta patch.
+ */
+static bool readStoredDeltaPatchHeader(uint32_t index,
+                                       uint32_t size,
+                                       delta_patch_header_t *header)
+{
+    uint8_t buffer[DELTA_PATCH_HEADER_SIZE];
+
+    return (size > DELTA_PATCH_HEADER_SIZE) &&
+           readStoredFirmware(index, 0, buffer, DELTA_PATCH_HEADER_SIZE) &&
+           deltaPatchParseHeader(buffer, header);
+}
+
+/**
+ * Check that a delta patch was made for the active firmware and this flash
+ * @detail The windows of the patch must match the flash sectors, and every
+ *         sector must fit in the staging buffer.
+ */
+static bool deltaPatchApplies(const delta_patch_header_t *header)
+{
+    arm_uc_firmware_details_t active;
+
+    bool result = readActiveFirmwareHeader(&active) &&
+                  (active.size == header->source_size) &&
+                  (memcmp(active.hash, header->source_hash,
+                          SIZEOF_SHA256) == 0);
+
+    if (result) {
+        const uint32_t appStart = ACTIVE_APPLICATION_START_ADDRESS;
+        const uint32_t sectorSize = header->sector_size;
+        const uint32_t before = sectorSize - header->first_window;
+
+        /* the bytes before the application in the first sector are erased,
+           they may only hold the active header */
+        result = (sectorSize <= BUFFER_SIZE) &&
+                 ((sectorSize % flashPageSize()) == 0) &&
+                 (header->target_size <= MBED_CONF_APP_MAX_APPLICATION_SIZE) &&
+                 ((before == 0) ||
+                  (appStart - before >= ACTIVE_HEADER_ADDRESS)) &&
+                 (sectorOffset(appStart - before) == 0);
+
+        for (uint32_t address = appStart - before;
+                result && (address < appStart + header->target_size);
+                address += sectorSize) {
+            result = (flashSectorSize(address) == sectorSize);
+        }
+
+        if (!result) {
+            tr_error("Delta patch does not match the flash layout");
+        }
+    }
+
+    return result;
+}
+
+bool checkStoredDeltaPatch(uint32_t index,
+                           const arm_uc_firmware_details_t *details,
+                           bool activeFirmwareValid,
+                           bool *patch)
+{
+    bool result = true;
+    delta_patch_header_t header;
+
+    *patch = readStoredDeltaPatchHeader(index, details->size, &header);
+
+    if (*patch) {
+        result = activeFirmwareValid && deltaPatchApplies(&header);
+    }
+
+    return result;
+}
+
+/**
+ * Copy the next bytes of the delta patch operations
+ * @return true if all requested bytes were available.
+ */
+static bool deltaPatchRead(delta_patch_reader_t *reader,
+                           uint8_t *data,
+                           uint32_t size)
+{
+    bool result = true;
+
+    while ((size > 0) && result) {
+        /* refill buffer */
+        if (reader->position == reader->length) {
+            uint32_t length = reader->size - reader->offset;
+
+            if (length > DELTA_PATCH_BUFFER_SIZE) {
+                length = DELTA_PATCH_BUFFER_SIZE;
+            }
+
+            result = (length > 0) &&
+                     readStoredFirmware(reader->index,
+                                        reader->offset,
+                                        reader->buffer,
+                                        length);
+
+            reader->offset += length;
+            reader->position = 0;
+            reader->length = length;
+        }
+
+        if (result) {
+            uint32_t length = reader->length - reader->position;
+
+            if (length > size) {
+                length = size;
+            }
+
+            memcpy(data, &reader->buffer[reader->position], length);
+
+            reader->position += length;
+            data += length;
+            size -= length;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Read a little endian 32-bit value from the delta patch
+ */
+static bool deltaPatchReadUint32(delta_patch_reader_t *reader, uint32_t *value)
+{
+    uint8_t buffer[4];
+
+    bool result = deltaPatchRead(reader, buffer, sizeof(buffer));
+
+    *value = ((uint32_t) buffer[0])       | ((uint32_t) buffer[1] << 8) |
+             ((uint32_t) buffer[2] << 16) | ((uint32_t) buffer[3] << 24);
+
+    return result;
+}
+
+/**
+ * Build one window of the target in the staging buffer
+ * @param  staging  Staging buffer, offset 0 is the window start.
+ * @return true if the operations fill the window exactly.
+ */
+static bool deltaPatchBuildWindow(const delta_patch_header_t *header,
+                                  uint32_t start,
+                                  uint32_t end,
+                                  uint8_t *staging)
+{
+    const bool backward = (header->flags & DELTA_PATCH_FLAG_BACKWARD);
+
+    bool result = true;
+    uint32_t position = start;
+
+    while ((position < end) && result) {
+        uint8_t operation = 0;
+        uint32_t length = 0;
+
+        result = deltaPatchRead(&deltaReader, &operation, 1) &&
+                 deltaPatchReadUint32(&deltaReader, &length) &&
+                 (length > 0) &&
+                 (length <= end - position);
+
+        if (result && (operation == DELTA_PATCH_OP_COPY)) {
+            uint32_t source = 0;
+
+            /* only copy source bytes that have not been overwritten */
+            result = deltaPatchReadUint32(&deltaReader, &source) &&
+                     (source <= header->source_size) &&
+                     (length <= header->source_size - source) &&
+                     (backward ? (source + length <= end) :
+                                 (source >= start));
+
+            if (result) {
+                result = (flash.read(&staging[position - start],
+                                     ACTIVE_APPLICATION_START_ADDRESS +
+                                     source,
+                                     length) == 0);
+            }
+        } else if (result && (operation == DELTA_PATCH_OP_DATA)) {
+            result = deltaPatchRead(&deltaReader,
+                                    &staging[position - start],
+                                    length);
+        } else {
+            result = false;
+        }
+
+        position += length;
+    }
+
+    if (!result) {
+        tr_error("Invalid delta patch operation at 0x%08" PRIX32, position);
+    }
+
+    return result;
+}
+
+/**
+ * Rebuild the active application from a stored delta patch
+ * @detail Each window is staged in RAM before its sector is erased, so no
+ *         byte is programmed twice. The source is overwritten while the
+ *         patch is applied, an interrupted install can only be recovered
+ *         with a full image, which the caller makes sure another slot
+ *         holds.
+ * @param  index    Index of the firmware location holding the patch.
+ * @param  details  Header of the stored patch. The size and hash are
+ *                  replaced with those of the rebuilt application, which
+ *                  the caller must verify.
+ * @return true if the patch was applied.
+ */
+static bool installDeltaPatch(uint32_t index,
+                              arm_uc_firmware_details_t *details,
+                              const delta_patch_header_t *header)
+{
+    tr_info("Apply delta patch from slot %" PRIu32, index);
+
+    const uint32_t appStart = ACTIVE_APPLICATION_START_ADDRESS;
+    const uint32_t pageSize = flashPageSize();
+    const uint32_t before = header->sector_size - header->first_window;
+
+    bool result = deltaPatchApplies(header);
+
+    /*************************************************************************/
+    /* Step 1. Invalidate the active application                             */
+    /*************************************************************************/
+
+#if defined(VERIFIED_IMAGE_CACHE) && (VERIFIED_IMAGE_CACHE == 1)
+    /* the active application must be hashed in full until the new header
+       has been written */
+    if (result) {
+        result = nvstoreRecordRemove(NVSTORE_KEY_VERIFIED_IMAGE);
+    }
+#endif
+
+    /* a header in its own sector is erased first, a header that shares the
+       first sector with the application is erased with window 0 */
+    if (result && (ACTIVE_HEADER_ADDRESS < appStart - before)) {
+        result = (eraseSectorBySector(ACTIVE_HEADER_ADDRESS,
+                                      getSectorAlignedSize(ACTIVE_HEADER_ADDRESS,
+                                                           ARM_UC_INTERNAL_HEADER_SIZE_V2)) == 0);
+    }
+
+    /*************************************************************************/
+    /* Step 2. Rebuild the application one sector at a time                  */
+    /*************************************************************************/
+
+    deltaReader.index = index;
+    deltaReader.offset = DELTA_PATCH_HEADER_SIZE;
+    deltaReader.size = details->size;
+    deltaReader.position = 0;
+    deltaReader.length = 0;
+
+    const uint32_t windows = deltaPatchWindowCount(header);
+    const bool backward = (header->flags & DELTA_PATCH_FLAG_BACKWARD);
+
+    for (uint32_t count = 0; (count < windows) && result; count++) {
+        uint32_t window = backward ? windows - 1 - count : count;
+        uint32_t start = 0;
+        uint32_t end = 0;
+
+        deltaPatchWindow(header, window, &start, &end);
+
+        /* window 0 starts after the bytes that precede the application */
+        uint32_t skip = (window == 0) ? before : 0;
+
+        memset(buffer_array, flashEraseValue(), header->sector_size);
+
+        result = deltaPatchBuildWindow(header, start, end, &buffer_array[skip]);
+
+        if (result) {
+            uint32_t programSize = (end - start + pageSize - 1)
+                                   / pageSize * pageSize;
+
+            result = (eraseSectorBySector(appStart + start - skip,
+                                          header->sector_size) == 0) &&
+                     (programActiveFlash(&buffer_array[skip],
+                                         appStart + start,
+                                         programSize) == 0);
+        }
+
+#if defined(SHOW_PROGRESS_BAR) && SHOW_PROGRESS_BAR == 1
+        printProgress(count + 1, windows);
+#endif
+    }
+
+    /* the application must now be verified against the target hash */
+    details->size = header->target_size;
+    memcpy(details->hash, header->target_hash, SIZEOF_SHA256);
+
+    return result;
+}
+#endif
+
+#if defined(COMPRESSED_IMAGES) && (COMPRESSED_IMAGES == 1)
+/**
+ * Read the header of a stored compressed image
+ * @param  imageSize  Set to the size of the uncompressed image.
+ * @return true if the stored firmware is compressed.
+ */
+static bool readStoredCompressedHeader(uint32_t index,
+                                       uint32_t size,
+                                       uint32_t *imageSize)
+{
+    uint8_t buffer[COMPRESSED_IMAGE_HEADER_SIZE];
+
+    return (size > COMPRESSED_IMAGE_HEADER_SIZE) &&
+           readStoredFirmware(index, 0, buffer, COMPRESSED_IMAGE_HEADER_SIZE) &&
+           compressedImageParseHeader(buffer, imageSize);
+}
+
+/**
+ * Decompress a stored image into the ACTIVE app region
+ * @detail The first half of the buffer holds compressed data read from
+ *         storage, the second half collects decompressed pages until they
+ *         are programmed.
+ * @param  index       Index of the firmware location.
+ * @param  details     Header of the image, size is the uncompressed size.
+ * @param  storedSize  Size of the compressed payload.
+ * @return true if the image was decompressed and programmed.
+ */
+static bool writeCompressedActiveFirmware(uint32_t index,
+                                          arm_uc_firmware_details_t *details,
+                                          uint32_t storedSize)
+{
+    tr_debug("writeCompressedActiveFirmware");
+
+    const uint32_t appStart = ACTIVE_APPLICATION_START_ADDRESS;
+    const uint32_t pageSize = flashPageSize();
+    const uint32_t imageSize = details->size;
+
+    uint8_t *input = buffer_array;
+    const uint32_t inputSize = BUFFER_SIZE / 2;
+    uint8_t *output = &buffer_array[inputSize];
+    const uint32_t outputSize = (BUFFER_SIZE - inputSize) / pageSize * pageSize;
+
+    const uint8_t *next = input;
+    uint32_t available = 0;
+    uint32_t readOffset = COMPRESSED_IMAGE_HEADER_SIZE;
+    uint32_t programmed = 0;
+    uint32_t filled = 0;
+
+    compressedImageInit(&compressed_image_stream, imageSize);
+
+#if defined(VERIFY_DURING_COPY) && (VERIFY_DURING_COPY == 1)
+    /* hash the image as it is programmed */
+    mbedtls_sha256_context mbedtls_ctx;
+    mbedtls_sha256_init(&mbedtls_ctx);
+    mbedtls_sha256_starts(&mbedtls_ctx, 0);
+#endif
+
+    bool result = (outputSize > 0);
+
+    while (result && (programmed < imageSize)) {
+        /* refill input */
+        if ((available == 0) && (readOffset < storedSize)) {
+            uint32_t length = (storedSize - readOffset) > inputSize ?
+                              inputSize : (storedSize - readOffset);
+
+            result = readStoredFirmware(index, readOffset, input, length);
+
+            readOffset += length;
+            next = input;
+            available = length;
+        }
+
+        uint32_t length = outputSize - filled;
+
+        result = result &&
+                 compressedImageDecode(&compressed_image_stream,
+                                       &next,
+                                       &available,
+                                       &output[filled],
+                                       &length);
+
+        filled += length;
+
+        /* program full buffers and the last partial one */
+        if (result && ((filled == outputSize) ||
+                       (programmed + filled == imageSize))) {
+            uint32_t programSize = (filled + pageSize - 1)
+                                   / pageSize * pageSize;
+
+            memset(&output[filled], flashEraseValue(), programSize - filled);
+
+#if defined(VERIFY_DURING_COPY) && (VERIFY_DURING_COPY == 1)
+            mbedtls_sha256_update(&mbedtls_ctx, output, filled);
+#endif
+
+            result = (programActiveFlash(output,
+                                         appStart + programmed,
+                                         programSize) == 0);
+
+            programmed += filled;
+            filled = 0;
+
+#if defined(SHOW_PROGRESS_BAR) && SHOW_PROGRESS_BAR == 1
+            printProgress(programmed, imageSize);
+#endif
+        } else if ((length == 0) && (available == 0) &&
+                   (readOffset >= storedSize)) {
+            tr_error("Compressed image ends early");
+            result = false;
+        }
+    }
+
+    if (result && !compressedImageDone(&compressed_image_stream)) {
+        tr_error("Compressed image does not match its size");
+        result = false;
+    }
+
+#if defined(VERIFY_DURING_COPY) && (VERIFY_DURING_COPY == 1)
+    /* compare the hash of the programmed image with the header */
+    uint8_t SHA[SIZEOF_SHA256] = { 0 };
+    mbedtls_sha256_finish(&mbedtls_ctx, SHA);
+    mbedtls_sha256_free(&mbedtls_ctx);
+
+    if (result && (memcmp(details->hash, SHA, SIZEOF_SHA256) != 0)) {
+        printSHA256(details->hash);
+        printSHA256(SHA);
+        copyMismatch = true;
+        result = false;
+    }
+#endif
+
+    return result;
+}
+#endif
+
+#if (defined(INCREMENTAL_INSTALL) && (INCREMENTAL_INSTALL == 1)) || \
+    (defined(LAZY_ERASE) && (LAZY_ERASE == 1)) || \
+    (defined(RESUMABLE_INSTALL) && (RESUMABLE_INSTALL == 1))
+/* part of the application that is read and programmed in one go */
+typedef struct {
+    uint32_t address;
+    uint32_t length;
+    uint32_t sectorStart;
+    uint32_t sectorEnd;
+} install_chunk_t;
+
+/**
+ * Find the chunk that starts at an address
+ * @detail Chunks never cross a sector boundary or the end of the image.
+ */
+static void installChunkAt(install_chunk_t *chunk,
+                           uint32_t address,
+                           uint32_t appEnd,
+                           uint32_t readSize)
+{
+    chunk->address = address;
+
+    /* move on to the next sector */
+    if (address >= chunk->sectorEnd) {
+        chunk->sectorStart = chunk->sectorEnd;
+        chunk->sectorEnd += flashSectorSize(chunk->sectorStart);
+    }
+
+    uint32_t end = (chunk->sectorEnd < appEnd) ? chunk->sectorEnd : appEnd;
+
+    chunk->length = (end - address) > readSize ? readSize : (end - address);
+}
+
+/**
+ * Issue the read of a chunk from storage
+ * @return true if the read was queued and will complete.
+ */
+static bool startChunkRead(uint32_t index,
+                           const install_chunk_t *chunk,
+                           arm_uc_buffer_t *buffer,
+                           ucp_request_t *request)
+{
+    /* the PAL reads size_max bytes */
+    buffer->size_max = chunk->length;
+    buffer->size = 0;
+
+    ucpRequestRead(request,
+                   index,
+                   chunk->address - ACTIVE_APPLICATION_START_ADDRESS,
+                   buffer);
+
+    return ucpSubmit(request);
+}
+
+/**
+ * Wait for a chunk read to complete
+ * @return true if the full chunk was read.
+ */
+static bool finishChunkRead(bool started,
+                            const install_chunk_t *chunk,
+                            const arm_uc_buffer_t *buffer,
+                            ucp_request_t *request)
+{
+    return started &&
+           ucpWait(request) &&
+           (buffer->size == chunk->length);
+}
+
+#if defined(RESUMABLE_INSTALL) && (RESUMABLE_INSTALL == 1)
+/**
+ * Read the install journal for a stored firmware
+ * @param  index    Index of the firmware location.
+ * @param  details  Header of the stored firmware.
+ * @param  record   Caller-allocated record.
+ * @return true if the journal describes an install of this firmware.
+ */
+static bool installJournalRead(uint32_t index,
+                               const arm_uc_firmware_details_t *details,
+                               install_journal_record_t *record)
+{
+    return nvstoreRecordRead(NVSTORE_KEY_INSTALL_JOURNAL,
+                             record,
+                             sizeof(install_journal_record_t)) &&
+           (record->slot == index) &&
+           (record->version == details->version) &&
+           (record->size == details->size) &&
+           (memcmp(record->hash, details->hash, SIZEOF_SHA256) == 0) &&
+           (memcmp(record->campaign, details->campaign,
+                   ARM_UC_GUID_SIZE) == 0) &&
+           (record->completed <= MBED_CONF_APP_MAX_APPLICATION_SIZE);
+}
+
+bool installJournalMatches(uint32_t index,
+                           const arm_uc_firmware_details_t *details)
+{
+    install_journal_record_t record;
+
+    return details && installJournalRead(index, details, &record);
+}
+
+/**
+ * Record how much of the application has been installed
+ * @param  index      Index of the firmware location.
+ * @param  details    Header of the stored firmware.
+ * @param  completed  Bytes from the application start that are programmed
+ *                    and verified, always ending on a sector boundary.
+ */
+static void installJournalWrite(uint32_t index,
+                                const arm_uc_firmware_details_t *details,
+                                uint32_t completed)
+{
+    install_journal_record_t record;
+    memset(&record, 0, sizeof(record));
+
+    record.version = details->version;
+    record.size = details->size;
+    memcpy(record.hash, details->hash, SIZEOF_SHA256);
+    memcpy(record.campaign, details->campaign, ARM_UC_GUID_SIZE);
+    record.slot = index;
+    record.completed = completed;
+
+    if (!nvstoreRecordWrite(NVSTORE_KEY_INSTALL_JOURNAL, &record, sizeof(record))) {
+        tr_warning("Failed to store install journal");
+    }
+}
+
+/**
+ * Forget the install in progress
+ */
+static void installJournalRemove(void)
 {
-    tr_debug("checkActiveApplication");
+    if (!nvstoreRecordRemove(NVSTORE_KEY_INSTALL_JOURNAL)) {
+        tr_warning("Failed to remove install journal");
+    }
+}
+#endif
 
-    int result = RESULT_ERROR;
+/**
+ * Copy the application sector by sector
+ * @detail Each sector is erased just before its first page is programmed,
+ *         and the next chunk is read from storage while the current one is
+ *         erased and programmed. With INCREMENTAL_INSTALL each sector is
+ *         compared with the incoming data first and left alone if it is
+ *         unchanged. A sector that still holds the active header is always
+ *         rewritten, and a header in its own sector is erased before
+ *         anything else, so the old application is invalidated before the
+ *         first sector changes.
+ * @param  index    Index of the firmware location.
+ * @param  details  Header of the stored firmware.
+ * @return true if the active region now holds the stored firmware.
+ */
+static bool writeActiveFirmwareBySector(uint32_t index,
+                                        arm_uc_firmware_details_t *details)
+{
+    tr_debug("writeActiveFirmwareBySector");
+
+    const uint32_t appStart = ACTIVE_APPLICATION_START_ADDRESS;
+    const uint32_t appEnd = appStart + details->size;
+    const uint32_t pageSize = flashPageSize();
+    const uint32_t readSize = (BUFFER_SIZE / 2 / pageSize) * pageSize;
+    const uint32_t headerSize = getSectorAlignedSize(ACTIVE_HEADER_ADDRESS,
+                                                     ARM_UC_INTERNAL_HEADER_SIZE_V2);
+
+    /* the header is erased on its own unless it shares a sector with the
+       start of the application, including when its sectors end right
+       where the application starts */
+    bool separateHeader =
+        ((ACTIVE_HEADER_ADDRESS + headerSize) <= appStart) ||
+        (ACTIVE_HEADER_ADDRESS > appStart);
+    uint32_t regionStart = separateHeader ?
+                           appStart : ACTIVE_HEADER_ADDRESS;
+
+    bool result = (readSize > 0) &&
+                  (regionStart + getSectorAlignedSize(regionStart,
+                                                      appEnd - regionStart) <=
+                   appStart + MBED_CONF_APP_MAX_APPLICATION_SIZE);
+
+    if (!result) {
+        tr_error("Firmware size 0x%" PRIX32 " rounded up to the nearest "
+                 "sector boundary is larger than the maximum application "
+                 "size 0x%" PRIX32, (uint32_t) details->size,
+                 MBED_CONF_APP_MAX_APPLICATION_SIZE);
+    }
 
-    if (details) {
-        /* Read header and verify that it is valid */
-        bool headerValid = readActiveFirmwareHeader(details);
+#if defined(BOOTLOADER_POWER_CUT_TEST) && (BOOTLOADER_POWER_CUT_TEST == 1)
+    power_cut_test_assert_state(POWER_CUT_TEST_STATE_ERASE);
+#endif
 
-        /* calculate hash if header is valid and slot is not empty */
-        if ((headerValid) && (details->size > 0)) {
-            uint32_t appStart = MBED_CONF_APP_APPLICATION_START_ADDRESS;
+    if (result && separateHeader) {
+        result = (eraseSectorBySector(ACTIVE_HEADER_ADDRESS,
+                                      headerSize) == 0);
+    }
 
-            tr_debug("header start: 0x%08" PRIX32,
-                     (uint32_t) FIRMWARE_METADATA_HEADER_ADDRESS);
-            tr_debug("app start: 0x%08" PRIX32, appStart);
-            tr_debug("app size: %" PRIu64, details->size);
+    /* address to start copying from, later when resuming an install */
+    uint32_t resume = appStart;
 
-            /* initialize hashing facility */
-            mbedtls_sha256_context mbedtls_ctx;
-            mbedtls_sha256_init(&mbedtls_ctx);
-            mbedtls_sha256_starts(&mbedtls_ctx, 0);
+#if defined(RESUMABLE_INSTALL) && (RESUMABLE_INSTALL == 1)
+    install_journal_record_t journal;
+    bool interrupted = result && installJournalRead(index, details, &journal);
 
-            uint8_t SHA[SIZEOF_SHA256] = { 0 };
-            uint32_t remaining = details->size;
-            int32_t status = 0;
+    if (interrupted && (journal.completed > 0) &&
+            (sectorOffset(appStart + journal.completed) == 0)) {
+        resume = appStart + journal.completed;
 
-            /* read full image */
-            while ((remaining > 0) && (status == 0)) {
-                /* read full buffer or what is remaining */
-                uint32_t readSize = (remaining > BUFFER_SIZE) ?
-                                    BUFFER_SIZE : remaining;
+        tr_info("Resuming install at offset 0x%08" PRIX32, journal.completed);
+    } else if (result && !interrupted) {
+        installJournalWrite(index, details, 0);
+    }
 
-                /* read buffer using FlashIAP API for portability */
-                status = flash.read(buffer_array,
-                                    appStart + (details->size - remaining),
-                                    readSize);
+    uint32_t journaled = resume;
+#endif
 
-                /* update hash */
-                mbedtls_sha256_update(&mbedtls_ctx, buffer_array, readSize);
+    /* one half of the buffer is read while the other is programmed */
+    arm_uc_buffer_t buffer[2];
+    ucp_request_t request[2];
 
-                /* update remaining bytes */
-                remaining -= readSize;
+    for (uint32_t half = 0; half < 2; half++) {
+        buffer[half].size_max = 0;
+        buffer[half].size     = 0;
+        buffer[half].ptr      = &buffer_array[half * readSize];
+    }
 
-#if defined(SHOW_PROGRESS_BAR) && SHOW_PROGRESS_BAR == 1
-                printProgress(details->size - remaining,
-                              details->size);
+#if defined(VERIFY_DURING_COPY) && (VERIFY_DURING_COPY == 1)
+    /* hash the image as it is read, unchanged sectors were compared */
+    mbedtls_sha256_context mbedtls_ctx;
+    mbedtls_sha256_init(&mbedtls_ctx);
+    mbedtls_sha256_starts(&mbedtls_ctx, 0);
 #endif
-            }
 
-            /* finalize hash */
-            mbedtls_sha256_finish(&mbedtls_ctx, SHA);
-            mbedtls_sha256_free(&mbedtls_ctx);
+    uint32_t hashed = appStart;
+    uint32_t rewritten = 0;
+    uint32_t skipped = 0;
 
-            /* compare calculated hash with hash from header */
-            int diff = memcmp(details->hash, SHA, SIZEOF_SHA256);
+#if defined(VERIFY_DURING_COPY) && (VERIFY_DURING_COPY == 1)
+    /* the part installed before the interruption is hashed from flash */
+    while (result && (hashed < resume) && (hashed < appEnd)) {
+        uint32_t end = (resume < appEnd) ? resume : appEnd;
+        uint32_t length = (end - hashed) > transferSize(TRANSFER_FLASH_READ) ?
+                          transferSize(TRANSFER_FLASH_READ) : (end - hashed);
 
-            if (diff == 0) {
-                result = RESULT_SUCCESS;
-            } else {
-                printSHA256(details->hash);
-                printSHA256(SHA);
-            }
-        } else if ((headerValid) && (details->size == 0)) {
-            /* header is valid but application size is 0 */
-            result = RESULT_EMPTY;
+        const uint8_t *installed = readActiveFlash(buffer_array, hashed, length);
+        result = (installed != NULL);
+
+        if (result) {
+            mbedtls_sha256_update(&mbedtls_ctx, installed, length);
+            hashed += length;
         }
     }
+#endif
 
-    return result;
-}
+    install_chunk_t chunk;
+    chunk.address = resume;
+    chunk.length = 0;
+    chunk.sectorStart = (resume > appStart) ? resume : regionStart;
+    chunk.sectorEnd = chunk.sectorStart + flashSectorSize(chunk.sectorStart);
 
-int eraseSectorBySector(uint32_t addr, uint32_t size)
-{
-    tr_debug("Erasing from 0x%08" PRIX32 " to 0x%08" PRIX32,
-             (uint32_t) addr, (uint32_t) addr + size);
+    if (resume < appEnd) {
+        installChunkAt(&chunk, resume, appEnd, readSize);
+    }
 
-    int result = -1;
-    uint32_t erase_address = addr;
+    /* the sector holding the header must be erased */
+    bool erased = false;
+    bool rewrite = (chunk.sectorStart < appStart);
 
-    /* Erase flash to make place for new application. Erasing sector by sector as some
-       platforms have varible sector sizes and mbed-os cannot deal with erasing multiple
-       sectors successfully in that case. https://github.com/ARMmbed/mbed-os/issues/6077 */
-    while (erase_address < (addr + size)) {
-        uint32_t sector_size = flash.get_sector_size(erase_address);
-        result = flash.erase(erase_address,
-                             sector_size);
-        if (result != 0) {
-            tr_debug("Erasing from 0x%08" PRIX32 " to 0x%08" PRIX32 " failed with retval %i",
-                     erase_address, erase_address + sector_size, result);
-            break;
-        } else {
-            erase_address += sector_size;
-        }
-    }
+#if defined(BOOTLOADER_POWER_CUT_TEST) && (BOOTLOADER_POWER_CUT_TEST == 1)
+    power_cut_test_assert_state(POWER_CUT_TEST_STATE_COPY_FIRMWARE);
+#endif
 
-    return result;
-}
+    uint32_t current = 0;
+    bool readPending = result && (chunk.address < appEnd) &&
+                       startChunkRead(index, &chunk, &buffer[current], &request[current]);
 
-uint32_t getSectorAlignedSize(uint32_t addr, uint32_t size)
-{
-    tr_debug("getSectorAlignedSize at 0x%08" PRIX32 " of size 0x%08" PRIX32,
-             (uint32_t) addr, (uint32_t) size);
+    while (result && (chunk.address < appEnd)) {
+        result = finishChunkRead(readPending, &chunk, &buffer[current], &request[current]);
+        readPending = false;
 
-    /* Find the exact end sector boundary. Some platforms have different sector
-       sizes from sector to sector. Hence we count the sizes 1 sector at a time here */
-    uint32_t erase_address = addr;
-    while (erase_address < (addr + size)) {
-        erase_address += flash.get_sector_size(erase_address);
-    }
+        if (!result) {
+            tr_error("ARM_UCP_Read failed at 0x%08" PRIX32, chunk.address);
+            break;
+        }
 
-    return erase_address - addr;
-}
+        uint8_t *data = buffer[current].ptr;
 
-/**
- * Wipe the ACTIVE firmware region in the flash
- */
-bool eraseActiveFirmware(uint32_t firmwareSize)
-{
-    tr_debug("eraseActiveFirmware");
+#if defined(VERIFY_DURING_COPY) && (VERIFY_DURING_COPY == 1)
+        /* sector data is read again after a late difference */
+        if (chunk.address >= hashed) {
+            mbedtls_sha256_update(&mbedtls_ctx, data, chunk.length);
+            hashed = chunk.address + chunk.length;
+        }
+#endif
 
-    uint32_t fw_metadata_hdr_size = getSectorAlignedSize(FIRMWARE_METADATA_HEADER_ADDRESS,
-                                                         ARM_UC_INTERNAL_HEADER_SIZE_V2);
-    uint32_t size_needed = 0;
-    uint32_t erase_start_addr = 0;
-    int result = 0;
+        /* read the next chunk while this one is erased and programmed */
+        install_chunk_t next = chunk;
+        installChunkAt(&next, chunk.address + chunk.length, appEnd, readSize);
 
-    if (((FIRMWARE_METADATA_HEADER_ADDRESS + fw_metadata_hdr_size) < \
-            (MBED_CONF_APP_APPLICATION_START_ADDRESS)) || \
-            (FIRMWARE_METADATA_HEADER_ADDRESS > MBED_CONF_APP_APPLICATION_START_ADDRESS)) {
-        /* header separate from app */
-        tr_debug("Erasing header separately from active application");
+        uint32_t other = current ^ 1;
 
-        /* erase header section first */
-        result = eraseSectorBySector(FIRMWARE_METADATA_HEADER_ADDRESS, fw_metadata_hdr_size);
+        if (next.address < appEnd) {
+            readPending = startChunkRead(index, &next, &buffer[other], &request[other]);
+        }
 
-        /* setup erase of the application region */
-        size_needed = firmwareSize;
-        erase_start_addr = MBED_CONF_APP_APPLICATION_START_ADDRESS;
-    } else { /* header contiguous with app */
-        /* setup erase of the header + application region */
-        size_needed = (MBED_CONF_APP_APPLICATION_START_ADDRESS - FIRMWARE_METADATA_HEADER_ADDRESS) + firmwareSize;
-        erase_start_addr = FIRMWARE_METADATA_HEADER_ADDRESS;
-    }
+#if defined(INCREMENTAL_INSTALL) && (INCREMENTAL_INSTALL == 1)
+        if (!erased && !rewrite) {
+            uint32_t mismatch = 0;
+            int compare = compareActiveFlash(data,
+                                             chunk.address,
+                                             chunk.length,
+                                             &mismatch);
+
+            if (compare == 1) {
+                tr_debug("Sector 0x%08" PRIX32 " differs at 0x%08" PRIX32,
+                         chunk.sectorStart, mismatch);
+                rewrite = true;
+
+                /* program the part of the sector compared so far */
+                uint32_t sectorData = (chunk.sectorStart > appStart) ?
+                                      chunk.sectorStart : appStart;
+
+                if (chunk.address > sectorData) {
+                    finishChunkRead(readPending, &next, &buffer[other], &request[other]);
+
+                    result = (eraseSectorBySector(chunk.sectorStart,
+                                                  chunk.sectorEnd - chunk.sectorStart) == 0);
+                    erased = true;
+
+                    installChunkAt(&chunk, sectorData, appEnd, readSize);
+                    readPending = result &&
+                                  startChunkRead(index, &chunk, &buffer[current], &request[current]);
+                    continue;
+                }
+            } else {
+                result = (compare == 0);
+            }
+        }
+#else
+        rewrite = true;
+#endif
 
-    if (result == 0) {
-        uint32_t erase_end_addr = erase_start_addr + \
-                                  getSectorAlignedSize(erase_start_addr,
-                                                       size_needed);
-        uint32_t max_end_addr = MBED_CONF_APP_MAX_APPLICATION_SIZE + \
-                                MBED_CONF_APP_APPLICATION_START_ADDRESS;
-        /* check that the erase will not exceed MBED_CONF_APP_MAX_APPLICATION_SIZE */
-        if (erase_end_addr <= max_end_addr) {
-            result = eraseSectorBySector(erase_start_addr, size_needed);
-        } else {
-            result = -1;
-            tr_error("Firmware size 0x%" PRIX32 " rounded up to the nearest sector boundary 0x%" \
-                     PRIX32 " is larger than the maximum application size 0x%" PRIX32,
-                     firmwareSize, erase_end_addr - MBED_CONF_APP_APPLICATION_START_ADDRESS,
-                     MBED_CONF_APP_MAX_APPLICATION_SIZE);
+        /* erase the sector just before its first page is programmed */
+        if (result && rewrite && !erased) {
+            result = (eraseSectorBySector(chunk.sectorStart,
+                                          chunk.sectorEnd - chunk.sectorStart) == 0);
+            erased = true;
         }
-    }
 
-    return (result == 0);
-}
+        if (result && rewrite) {
+            uint32_t programSize = (chunk.length + pageSize - 1)
+                                   / pageSize * pageSize;
 
-bool writeActiveFirmwareHeader(arm_uc_firmware_details_t *details)
-{
-    tr_debug("writeActiveFirmwareHeader");
+            memset(&data[chunk.length], flashEraseValue(), programSize - chunk.length);
 
-    bool result = false;
+            result = (programActiveFlash(data,
+                                         chunk.address,
+                                         programSize) == 0);
+        }
 
-    if (details) {
-        /* round up program size to nearest page size */
-        const uint32_t pageSize = flash.get_page_size();
-        const uint32_t programSize = (ARM_UC_INTERNAL_HEADER_SIZE_V2 + pageSize - 1)
-                                     / pageSize * pageSize;
-        const uint32_t fw_metadata_hdr_size = \
-                                              getSectorAlignedSize(FIRMWARE_METADATA_HEADER_ADDRESS,
-                                                                   ARM_UC_INTERNAL_HEADER_SIZE_V2);
+#if defined(SHOW_PROGRESS_BAR) && SHOW_PROGRESS_BAR == 1
+        printProgress(chunk.address + chunk.length - appStart, details->size);
+#endif
 
-        /* coverity[no_escape] */
-        MBED_BOOTLOADER_ASSERT((programSize <= BUFFER_SIZE),
-                               "Header program size %" PRIu32 " bigger than buffer %d\r\n",
-                               programSize, BUFFER_SIZE);
+        /* count the sector once it is done */
+        if (next.sectorStart != chunk.sectorStart) {
+            if (rewrite) {
+                rewritten++;
+            } else {
+                skipped++;
+            }
 
-        /* coverity[no_escape] */
-        MBED_BOOTLOADER_ASSERT((programSize <= fw_metadata_hdr_size),
-                               "Header program size %" PRIu32 " bigger than expected header %d\r\n",
-                               programSize, fw_metadata_hdr_size);
+            erased = false;
+            rewrite = false;
 
-        /* pad buffer to 0xFF */
-        memset(buffer_array, 0xFF, programSize);
+#if defined(RESUMABLE_INSTALL) && (RESUMABLE_INSTALL == 1)
+            /* the sector is programmed and verified, record it now and then */
+            if (result && (next.address < appEnd) &&
+                    ((chunk.sectorEnd - journaled) >= INSTALL_JOURNAL_INTERVAL)) {
+                installJournalWrite(index, details, chunk.sectorEnd - appStart);
+                journaled = chunk.sectorEnd;
+            }
+#endif
+        }
 
-        /* create internal header in temporary buffer */
-        arm_uc_buffer_t output_buffer = {
-            .size_max = BUFFER_SIZE,
-            .size     = 0,
-            .ptr      = buffer_array
-        };
+        chunk = next;
+        current = other;
+    }
 
-        arm_uc_error_t status = arm_uc_create_internal_header_v2(details,
-                                                                 &output_buffer);
+    /* do not leave a read in flight */
+    if (readPending) {
+        finishChunkRead(readPending, &chunk, &buffer[current], &request[current]);
+    }
 
-        if ((status.error == ERR_NONE) &&
-                (output_buffer.size == ARM_UC_INTERNAL_HEADER_SIZE_V2)) {
-            /* write header using FlashIAP API */
-            int ret = flash.program(buffer_array,
-                                    FIRMWARE_METADATA_HEADER_ADDRESS,
-                                    programSize);
+#if defined(INCREMENTAL_INSTALL) && (INCREMENTAL_INSTALL == 1)
+    tr_info("Sectors rewritten: %" PRIu32 ", unchanged: %" PRIu32,
+            rewritten, skipped);
+#else
+    (void) skipped;
+    tr_debug("Sectors written: %" PRIu32, rewritten);
+#endif
 
-            result = (ret == 0);
-        }
+#if defined(VERIFY_DURING_COPY) && (VERIFY_DURING_COPY == 1)
+    /* compare the hash of the image with the header */
+    uint8_t SHA[SIZEOF_SHA256] = { 0 };
+    mbedtls_sha256_finish(&mbedtls_ctx, SHA);
+    mbedtls_sha256_free(&mbedtls_ctx);
+
+    if (result && (memcmp(details->hash, SHA, SIZEOF_SHA256) != 0)) {
+        printSHA256(details->hash);
+        printSHA256(SHA);
+        copyMismatch = true;
+        result = false;
+
+#if defined(RESUMABLE_INSTALL) && (RESUMABLE_INSTALL == 1)
+        /* the installed part can not be trusted, start over next time */
+        installJournalRemove();
+#endif
     }
+#else
+    (void) hashed;
+#endif
 
     return result;
 }
+#endif
 
-bool writeActiveFirmware(uint32_t index, arm_uc_firmware_details_t *details)
+#if defined(CHUNK_MANIFEST) && (CHUNK_MANIFEST == 1)
+/**
+ * Copy the chunks that failed the last check of the application again
+ * @detail Only the sectors that hold a failed chunk are erased and
+ *         programmed again, from the stored firmware. The stored payload
+ *         must be the application itself, not a patch or compressed image.
+ * @param  index    Index of the firmware location.
+ * @param  details  Header of the stored firmware.
+ * @return true if every failed chunk was copied again.
+ */
+static bool repairActiveChunks(uint32_t index,
+                               const arm_uc_firmware_details_t *details)
 {
-    tr_debug("writeActiveFirmware");
+    const chunk_manifest_t *manifest = activeChunkCheck.manifest;
+    const uint32_t appStart = ACTIVE_APPLICATION_START_ADDRESS;
+    const uint32_t appEnd = appStart + details->size;
+    const uint32_t pageSize = flashPageSize();
+    const uint32_t readSize = transferSize(TRANSFER_PROGRAM);
+
+    /* a sector before the application may only hold the header, which
+       is not written yet */
+    const uint32_t lowest = (ACTIVE_HEADER_ADDRESS < appStart) ?
+                            ACTIVE_HEADER_ADDRESS : appStart;
+
+    /* without failed chunks the difference is in the manifest itself */
+    bool result = manifest && (activeChunkCheck.failed_count > 0);
+
+    /* end of the sectors copied again so far */
+    uint32_t repaired = lowest;
+
+    for (uint32_t chunk = 0;
+            result && manifest && (chunk < manifest->chunk_count); chunk++) {
+        if (!chunkCheckFailed(&activeChunkCheck, chunk)) {
+            continue;
+        }
 
-    bool result = false;
+        tr_info("Copy chunk %" PRIu32 " again", chunk);
 
-    if (details) {
-        const uint32_t pageSize = flash.get_page_size();
+        uint32_t chunkStart = appStart + chunk * manifest->chunk_size;
+        uint32_t chunkEnd = chunkStart + manifest->chunk_size;
 
-        /* we require app_start_addr fall on a page size boundary */
-        uint32_t app_start_addr = MBED_CONF_APP_APPLICATION_START_ADDRESS;
+        if (chunkEnd > appStart + manifest->image_size) {
+            chunkEnd = appStart + manifest->image_size;
+        }
 
-        /* coverity[no_escape] */
-        MBED_BOOTLOADER_ASSERT((app_start_addr % pageSize) == 0,
-                               "Application (0x%" PRIX32 ") does not start on a "
-                               "page size (0x%" PRIX32 ") aligned address\r\n",
-                               app_start_addr,
-                               pageSize);
+        uint32_t sector = chunkStart - sectorOffset(chunkStart);
 
-        /* round down the read size to a multiple of the page size
-           that still fits inside the main buffer.
-        */
-        uint32_t readSize = (BUFFER_SIZE / pageSize) * pageSize;
+        result = (sector >= lowest);
 
-        arm_uc_buffer_t buffer = {
-            .size_max = readSize,
-            .size     = 0,
-            .ptr      = buffer_array
-        };
+        /* a sector shared with the previous chunk is done already */
+        if (sector < repaired) {
+            sector = repaired;
+        }
 
-        int retval = 0;
-        uint32_t offset = 0;
+        while (result && (sector < chunkEnd)) {
+            uint32_t sectorEnd = sector + flashSectorSize(sector);
 
-        /* write firmware */
-        while ((offset < details->size) &&
-                (retval == 0)) {
-            /* clear most recent UCP event */
-            event_callback = CLEAR_EVENT;
+            result = (eraseSectorBySector(sector, sectorEnd - sector) == 0);
 
-            /* set the number of bytes expected */
-            buffer.size = (details->size - offset) > buffer.size_max ?
-                          buffer.size_max : (details->size - offset);
+            /* the application data in the sector */
+            uint32_t address = (sector > appStart) ? sector : appStart;
+            uint32_t end = (sectorEnd < appEnd) ? sectorEnd : appEnd;
 
-            /* fill buffer using UCP */
-            arm_uc_error_t ucp_status = ARM_UCP_Read(index, offset, &buffer);
+            while (result && (address < end)) {
+                arm_uc_buffer_t buffer = {
+                    .size_max = (end - address) > readSize ?
+                                readSize : (end - address),
+                    .size     = 0,
+                    .ptr      = buffer_array
+                };
 
-            /* wait for event if the call is accepted */
-            if (ucp_status.error == ERR_NONE) {
-                while (event_callback == CLEAR_EVENT) {
-                    __WFI();
-                }
-            }
+                ucp_request_t request;
+                ucpRequestRead(&request, index, address - appStart, &buffer);
 
-            /* check status and actual read size */
-            if ((event_callback == ARM_UC_PAAL_EVENT_READ_DONE) &&
-                    (buffer.size > 0)) {
-                /* the last page, in the last buffer might not be completely
-                   filled, round up the program size to include the last page
-                */
-                uint32_t programOffset = 0;
-                uint32_t programSize = (buffer.size + pageSize - 1)
-                                       / pageSize * pageSize;
+                result = ucpRun(&request) && (buffer.size == buffer.size_max);
 
-                /* write one page at a time */
-                while ((programOffset < programSize) &&
-                        (retval == 0)) {
-                    retval = flash.program(&(buffer.ptr[programOffset]),
-                                           app_start_addr + offset + programOffset,
-                                           pageSize);
+                if (result) {
+                    uint32_t programSize = (buffer.size + pageSize - 1)
+                                           / pageSize * pageSize;
 
-                    programOffset += pageSize;
+                    memset(&buffer.ptr[buffer.size], flashEraseValue(),
+                           programSize - buffer.size);
 
-#if defined(SHOW_PROGRESS_BAR) && SHOW_PROGRESS_BAR == 1
-                    printProgress(offset + programOffset, details->size);
-#endif
+                    result = (programActiveFlash(buffer.ptr,
+                                                 address,
+                                                 programSize) == 0);
+                    address += buffer.size;
                 }
-
-                tr_debug("\r\n%" PRIu32 "/%" PRIu32 " writing %" PRIu32 " bytes to 0x%08" PRIX32,
-                         offset, (uint32_t) details->size, programSize, app_start_addr + offset);
-
-                offset += programSize;
-            } else {
-                tr_error("ARM_UCP_Read returned 0 bytes");
-
-                /* set error and break out of loop */
-                retval = -1;
-                break;
             }
-        }
 
-        result = (retval == 0);
+            sector = sectorEnd;
+            repaired = sectorEnd;
+        }
     }
 
     return result;
 }
+#endif
 
 /*
  * Copy loop to update the application
+ * @detail The header is erased first and only written once the new
+ *         application has been verified, so an interrupted or failed copy
+ *         leaves the active region without a valid header.
  */
 bool copyStoredApplication(uint32_t index,
-                           arm_uc_firmware_details_t *details)
+                           arm_uc_firmware_details_t *details,
+                           bool *mismatch)
 {
     tr_debug("copyStoredApplication");
 
     bool result = false;
 
-    /*************************************************************************/
-    /* Step 1. Erase active application                                      */
-    /*************************************************************************/
+#if defined(VERIFY_DURING_COPY) && (VERIFY_DURING_COPY == 1)
+    copyMismatch = false;
+#endif
 
-    result = eraseActiveFirmware(details->size);
+    /* set if the application was verified while it was written */
+    bool verified = false;
 
-    /*************************************************************************/
-    /* Step 2. Write header                                                  */
-    /*************************************************************************/
+#if defined(CHUNK_MANIFEST) && (CHUNK_MANIFEST == 1)
+    /* set if the application is a copy of the stored payload */
+    bool copiedUnchanged = false;
+#endif
 
-    if (result) {
-        result = writeActiveFirmwareHeader(details);
+#if (defined(DELTA_UPDATE) && (DELTA_UPDATE == 1)) || \
+    (defined(COMPRESSED_IMAGES) && (COMPRESSED_IMAGES == 1))
+    /* the header written in Step 4 describes the installed application,
+       not the stored payload */
+    arm_uc_firmware_details_t installed = *details;
+    details = &installed;
+#endif
+
+#if defined(COMPRESSED_IMAGES) && (COMPRESSED_IMAGES == 1)
+    const uint32_t storedSize = details->size;
+    uint32_t imageSize = 0;
+#endif
+
+#if defined(DELTA_UPDATE) && (DELTA_UPDATE == 1)
+    delta_patch_header_t patch;
+
+    if (readStoredDeltaPatchHeader(index, details->size, &patch)) {
+        result = installDeltaPatch(index, details, &patch);
+    } else
+#endif
+#if defined(COMPRESSED_IMAGES) && (COMPRESSED_IMAGES == 1)
+    if (readStoredCompressedHeader(index, storedSize, &imageSize)) {
+        details->size = imageSize;
+
+        /* check the size before anything is erased */
+        if (details->size <= MBED_CONF_APP_MAX_APPLICATION_SIZE) {
+            result = eraseActiveFirmware(details->size) &&
+                     writeCompressedActiveFirmware(index, details, storedSize);
+            verified = (VERIFY_DURING_COPY == 1);
+        } else {
+            tr_error("Uncompressed firmware size too large %" PRIu32,
+                     (uint32_t) details->size);
+        }
+    } else
+#endif
+    {
+#if defined(CHUNK_MANIFEST) && (CHUNK_MANIFEST == 1)
+        copiedUnchanged = true;
+#endif
+
+#if (defined(INCREMENTAL_INSTALL) && (INCREMENTAL_INSTALL == 1)) || \
+    (defined(LAZY_ERASE) && (LAZY_ERASE == 1)) || \
+    (defined(RESUMABLE_INSTALL) && (RESUMABLE_INSTALL == 1))
+        /*********************************************************************/
+        /* Step 1+2. Erase and copy one sector at a time                     */
+        /*********************************************************************/
+
+        result = writeActiveFirmwareBySector(index, details);
+        verified = (VERIFY_DURING_COPY == 1);
+#else
+        /*********************************************************************/
+        /* Step 1. Erase active application                                  */
+        /*********************************************************************/
+
+#if defined(BOOTLOADER_POWER_CUT_TEST) && (BOOTLOADER_POWER_CUT_TEST == 1)
+        power_cut_test_assert_state(POWER_CUT_TEST_STATE_ERASE);
+#endif
+
+        result = eraseActiveFirmware(details->size);
+
+        /*********************************************************************/
+        /* Step 2. Copy application                                          */
+        /*********************************************************************/
+
+#if defined(BOOTLOADER_POWER_CUT_TEST) && (BOOTLOADER_POWER_CUT_TEST == 1)
+        power_cut_test_assert_state(POWER_CUT_TEST_STATE_COPY_FIRMWARE);
+#endif
+
+        if (result) {
+            result = writeActiveFirmware(index, details);
+            verified = (VERIFY_DURING_COPY == 1);
+        }
+#endif
     }
 
     /*************************************************************************/
-    /* Step 3. Copy application                                              */
+    /* Step 3. Verify application                                            */
     /*************************************************************************/
 
-    if (result) {
-        result = writeActiveFirmware(index, details);
+    /* with VERIFY_DURING_COPY the application was hashed and each page
+       compared with its source while being written in Step 2 */
+    if (result && !verified) {
+        tr_info("Verify new active firmware:");
+
+        uint8_t SHA[SIZEOF_SHA256] = { 0 };
+        uint32_t startTime = us_ticker_read();
+
+        result = hashActiveFirmware(details->size, SHA, false) &&
+                 (memcmp(details->hash, SHA, SIZEOF_SHA256) == 0);
+
+#if defined(CHUNK_MANIFEST) && (CHUNK_MANIFEST == 1)
+        /* an application copied unchanged from storage can have just the
+           chunks that failed copied again */
+        if (!result && copiedUnchanged &&
+                repairActiveChunks(index, details)) {
+            result = hashActiveFirmware(details->size, SHA, false) &&
+                     (memcmp(details->hash, SHA, SIZEOF_SHA256) == 0);
+        }
+#endif
+
+        bootTimingVerify(us_ticker_read() - startTime);
+
+        if (!result) {
+            printSHA256(details->hash);
+            printSHA256(SHA);
+        }
     }
 
     /*************************************************************************/
-    /* Step 4. Verify application                                            */
+    /* Step 4. Write header                                                  */
     /*************************************************************************/
 
     if (result) {
-        tr_info("Verify new active firmware:");
+        result = writeActiveFirmwareHeader(details);
+    }
 
-        int recheck = checkActiveApplication(details);
+#if defined(RESUMABLE_INSTALL) && (RESUMABLE_INSTALL == 1)
+    /* the install is complete */
+    if (result) {
+        installJournalRemove();
+    }
+#endif
+
+#if defined(VERIFIED_IMAGE_CACHE) && (VERIFIED_IMAGE_CACHE == 1)
+    /* the new application was verified while it was installed */
+    if (result) {
+        verifiedImageCacheStore(details);
+    }
+#endif
 
-        result = (recheck == RESULT_SUCCESS);
+    if (mismatch) {
+#if defined(VERIFY_DURING_COPY) && (VERIFY_DURING_COPY == 1)
+        *mismatch = !result && copyMismatch;
+#else
+        *mismatch = false;
+#endif
     }
 
     return result;
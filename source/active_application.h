@@ -20,6 +20,16 @@
 
 #include <stdint.h>
 
+/* Hash the image while it is being programmed and compare every programmed
+   page with its source instead of reading the new image back in full. */
+#ifndef VERIFY_DURING_COPY
+#define VERIFY_DURING_COPY 1
+#endif
+
+#if defined(VERIFIED_IMAGE_CACHE) && (VERIFIED_IMAGE_CACHE == 1)
+extern uint32_t *verifiedImageSkips;
+#endif
+
 bool activeStorageInit(void);
 void activeStorageDeinit(void);
 
@@ -31,6 +41,33 @@ void activeStorageDeinit(void);
  */
 bool readActiveFirmwareHeader(arm_uc_firmware_details_t *details);
 
+#if defined(XIP_AB_BOOT) && (XIP_AB_BOOT == 1)
+/**
+ * Select the application region used by the functions in this file
+ * @detail Reading, checking and installing the active firmware all act on
+ *         the selected region. Region 0 is the application region, region
+ *         1 the second region configured by application-b-*-address.
+ * @param  region  Index of the application region.
+ */
+void activeRegionSelect(uint32_t region);
+
+/**
+ * @return index of the selected application region.
+ */
+uint32_t activeRegionSelected(void);
+#endif
+
+/**
+ * @return start address of the selected application region.
+ */
+uint32_t activeApplicationStartAddress(void);
+
+/**
+ * @return address of the vector table of the application in the selected
+ *         application region.
+ */
+uint32_t activeApplicationJumpAddress(void);
+
 /**
  * Verify the integrity of the Active application
  * @detail Read the firmware in the ACTIVE app region and compute its hash.
@@ -45,4 +82,70 @@ bool readActiveFirmwareHeader(arm_uc_firmware_details_t *details);
  */
 int checkActiveApplication(arm_uc_firmware_details_t *details);
 
-bool copyStoredApplication(uint32_t index, arm_uc_firmware_details_t *details);
+/**
+ * Install a stored firmware into the ACTIVE app region
+ * @param  index     Index of the firmware location.
+ * @param  details   Header of the stored firmware.
+ * @param  mismatch  Optional. Set to true if the install failed because the
+ *                   firmware hashed while it was copied does not match its
+ *                   header, so copying it again can not succeed.
+ * @return true if the firmware was installed and verified.
+ */
+bool copyStoredApplication(uint32_t index,
+                           arm_uc_firmware_details_t *details,
+                           bool *mismatch);
+
+#if defined(MAPPED_STORAGE) && (MAPPED_STORAGE == 1)
+/**
+ * Find a stored firmware in memory mapped internal flash
+ * @detail The address follows from the slot layout of the internal flash
+ *         PAAL and the update-client storage configuration it uses. It is
+ *         only trusted once the firmware found there hashed to its header,
+ *         see mappedStoredFirmwareConfirm().
+ * @param  index  Index of the firmware location.
+ * @param  size   Size of the stored firmware.
+ * @return the firmware in internal flash, or NULL if the slot does not fit
+ *         the internal flash.
+ */
+const uint8_t *mappedStoredFirmware(uint32_t index, uint32_t size);
+
+/**
+ * Record that a stored firmware hashed in place matched its header
+ * @detail Installs of a confirmed slot read it from its mapped address,
+ *         others read it through the storage driver.
+ * @param  index  Index of the firmware location.
+ */
+void mappedStoredFirmwareConfirm(uint32_t index);
+#endif
+
+#if defined(RESUMABLE_INSTALL) && (RESUMABLE_INSTALL == 1)
+/**
+ * Check if an install of a stored firmware was interrupted
+ * @detail The firmware was accepted before the interrupted install started
+ *         and is hashed again while the install is completed, so it does
+ *         not have to be checked in full first.
+ * @param  index    Index of the firmware location.
+ * @param  details  Header of the stored firmware.
+ * @return true if the install journal matches the stored firmware.
+ */
+bool installJournalMatches(uint32_t index,
+                           const arm_uc_firmware_details_t *details);
+#endif
+
+#if defined(DELTA_UPDATE) && (DELTA_UPDATE == 1)
+/**
+ * Check if a stored firmware can be installed over the active firmware
+ * @detail A full image always can. A delta patch only applies to the valid
+ *         active firmware it was created from.
+ * @param  index    Index of the firmware location.
+ * @param  details  Header of the stored firmware.
+ * @param  activeFirmwareValid
+ *                  Whether the active firmware passed its integrity check.
+ * @param  patch    Set to true if the stored firmware is a delta patch.
+ * @return true if the stored firmware can be installed.
+ */
+bool checkStoredDeltaPatch(uint32_t index,
+                           const arm_uc_firmware_details_t *details,
+                           bool activeFirmwareValid,
+                           bool *patch);
+#endif
@@ -0,0 +1,82 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef BOOT_PHASE_H
+#define BOOT_PHASE_H
+
+/* Phases of a boot.
+
+   main() and upgradeApplicationFromStorage() announce each phase as it
+   starts with bootPhaseEnter(). With BOOT_TIMING_RECORD the phase times go
+   into the record handed to the application, see boot_timing.h. With
+   BOOT_PHASE_HOOK the announcements also go to bootPhaseHook(), which is
+   provided outside the bootloader core, for instance by the host build to
+   split its simulated boot time by phase. Otherwise they compile to
+   nothing.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* report every phase to bootPhaseHook() */
+#ifndef BOOT_PHASE_HOOK
+#define BOOT_PHASE_HOOK                    0
+#endif
+
+/* time every phase for the application, see boot_timing.h */
+#ifndef BOOT_TIMING_RECORD
+#define BOOT_TIMING_RECORD                 0
+#endif
+
+typedef enum {
+    BOOT_PHASE_INIT,          /* storage and UCP initialisation */
+    BOOT_PHASE_ACTIVE_CHECK,  /* integrity check of the active firmware */
+    BOOT_PHASE_SLOT_SCAN,     /* header reads and checks of stored firmware */
+    BOOT_PHASE_INSTALL,       /* erase, program and verify of a firmware */
+    BOOT_PHASE_JUMP,          /* start of the application */
+    BOOT_PHASES
+} boot_phase_t;
+
+#if defined(BOOT_PHASE_HOOK) && (BOOT_PHASE_HOOK == 1)
+/**
+ * Called at the start of every phase
+ * @param  phase  Phase that starts, the previous one ends.
+ */
+void bootPhaseHook(boot_phase_t phase);
+#else
+#define bootPhaseHook(phase)
+#endif
+
+#if defined(BOOT_TIMING_RECORD) && (BOOT_TIMING_RECORD == 1)
+void bootTimingPhase(boot_phase_t phase);
+#else
+#define bootTimingPhase(phase)
+#endif
+
+#define bootPhaseEnter(phase) \
+    do { \
+        bootTimingPhase(phase); \
+        bootPhaseHook(phase); \
+    } while (0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BOOT_PHASE_H
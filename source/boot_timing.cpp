@@ -0,0 +1,137 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#include "boot_timing.h"
+
+#include "mbed.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/* CRC-32 as in zlib, bit by bit to keep the bootloader small */
+static uint32_t crc32(const uint8_t *data, uint32_t size)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (uint32_t index = 0; index < size; index++) {
+        crc ^= data[index];
+
+        for (uint32_t bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+
+    return ~crc;
+}
+
+bool bootTimingRecordValid(const boot_timing_record_t *record)
+{
+    return record &&
+           (record->magic == BOOT_TIMING_MAGIC) &&
+           (record->version == BOOT_TIMING_VERSION) &&
+           (record->size == sizeof(boot_timing_record_t)) &&
+           (record->crc == crc32((const uint8_t *) record,
+                                 offsetof(boot_timing_record_t, crc)));
+}
+
+#if defined(BOOT_TIMING_RECORD) && (BOOT_TIMING_RECORD == 1)
+/* the record is built here and only copied out before the jump, the RAM at
+   BOOT_TIMING_RECORD_ADDRESS may be in use by the bootloader until then */
+static boot_timing_record_t record;
+
+static boot_phase_t currentPhase = BOOT_PHASE_INIT;
+static uint32_t phaseStart = 0;
+
+void bootTimingPhase(boot_phase_t phase)
+{
+    uint32_t now = us_ticker_read();
+
+    /* main() starts a new record */
+    if (phase == BOOT_PHASE_INIT) {
+        memset(&record, 0, sizeof(record));
+    } else if ((uint32_t) currentPhase < BOOT_PHASES) {
+        record.phase_us[currentPhase] += now - phaseStart;
+    }
+
+    currentPhase = phase;
+    phaseStart = now;
+}
+
+void bootTimingSlotHeader(uint32_t index, uint32_t elapsed)
+{
+    if (index < BOOT_TIMING_SLOTS) {
+        record.slot_header_us[index] += elapsed;
+    }
+}
+
+void bootTimingSlotHash(uint32_t index, uint32_t elapsed)
+{
+    if (index < BOOT_TIMING_SLOTS) {
+        record.slot_hash_us[index] += elapsed;
+    }
+}
+
+void bootTimingErase(uint32_t elapsed, uint32_t size)
+{
+    record.erase_us += elapsed;
+    record.erase_bytes += size;
+}
+
+void bootTimingVerify(uint32_t elapsed)
+{
+    record.verify_us += elapsed;
+}
+
+void bootTimingProgram(uint32_t size)
+{
+    record.program_bytes += size;
+}
+
+void bootTimingFlashRead(uint32_t size)
+{
+    record.flash_read_bytes += size;
+}
+
+void bootTimingStorageRead(uint32_t size)
+{
+    record.storage_read_bytes += size;
+}
+
+void bootTimingFinish(void)
+{
+    bootTimingPhase(currentPhase);
+
+    /* whatever the install did apart from erasing and verifying */
+    uint32_t install = record.phase_us[BOOT_PHASE_INSTALL];
+    uint32_t other = record.erase_us + record.verify_us;
+
+    record.program_us = (install > other) ? install - other : 0;
+
+    for (uint32_t phase = 0; phase < BOOT_PHASES; phase++) {
+        record.total_us += record.phase_us[phase];
+    }
+
+    record.magic = BOOT_TIMING_MAGIC;
+    record.version = BOOT_TIMING_VERSION;
+    record.size = sizeof(boot_timing_record_t);
+    record.crc = crc32((const uint8_t *) &record,
+                       offsetof(boot_timing_record_t, crc));
+
+    memcpy((void *)(BOOT_TIMING_RECORD_ADDRESS), &record, sizeof(record));
+}
+#endif
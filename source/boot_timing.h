@@ -0,0 +1,121 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef BOOT_TIMING_H
+#define BOOT_TIMING_H
+
+/* Boot timing record handed to the application.
+
+   With BOOT_TIMING_RECORD the bootloader times every boot phase, the slot
+   header reads and hashes and the erase and verify parts of an install
+   with the microsecond ticker, and counts the bytes it reads and programs.
+   Just before it jumps to the application the record is completed, sealed
+   with a CRC-32 and copied to BOOT_TIMING_RECORD_ADDRESS. The address must
+   be RAM that neither the bootloader nor the application initialises, so
+   the application can check and report the record after it has started.
+
+   The application includes this header and passes the record to
+   bootTimingRecordValid() from boot_timing.cpp, which is compiled without
+   the recording part when BOOT_TIMING_RECORD is 0. The CRC is the CRC-32
+   of zlib and MbedCRC<POLY_32BIT_ANSI, 32>, so it can also be checked with
+   either of those.
+*/
+
+#include "boot_phase.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BOOT_TIMING_MAGIC                  0x544D4954 /* "TIMT" */
+#define BOOT_TIMING_VERSION                1
+
+/* slots with their own header and hash time, later slots are not timed */
+#define BOOT_TIMING_SLOTS                  4
+
+typedef struct {
+    uint32_t magic;                            /* BOOT_TIMING_MAGIC */
+    uint16_t version;                          /* BOOT_TIMING_VERSION */
+    uint16_t size;                             /* size of the record */
+    uint32_t phase_us[BOOT_PHASES];            /* time spent in each phase */
+    uint32_t erase_us;                         /* install: erasing */
+    uint32_t program_us;                       /* install: reading the slot
+                                                  and programming */
+    uint32_t verify_us;                        /* install: checking the
+                                                  programmed firmware */
+    uint32_t total_us;                         /* from main() to the jump */
+    uint32_t slot_header_us[BOOT_TIMING_SLOTS]; /* reading each slot header */
+    uint32_t slot_hash_us[BOOT_TIMING_SLOTS];  /* hashing each slot */
+    uint32_t flash_read_bytes;                 /* internal flash hashed */
+    uint32_t storage_read_bytes;               /* read through the PAAL */
+    uint32_t program_bytes;                    /* internal flash programmed */
+    uint32_t erase_bytes;                      /* internal flash erased */
+    uint32_t crc;                              /* CRC-32 of the fields above */
+} boot_timing_record_t;
+
+/**
+ * Check the record left by the bootloader
+ * @return true if the magic, version, size and CRC match.
+ */
+bool bootTimingRecordValid(const boot_timing_record_t *record);
+
+#if defined(BOOT_TIMING_RECORD) && (BOOT_TIMING_RECORD == 1)
+#ifndef BOOT_TIMING_RECORD_ADDRESS
+#error "BOOT_TIMING_RECORD requires BOOT_TIMING_RECORD_ADDRESS"
+#endif
+
+/**
+ * Add the time and bytes of a part of the boot to the record
+ * @param  index    Slot index.
+ * @param  elapsed  Time taken in microseconds.
+ * @param  size     Number of bytes.
+ */
+void bootTimingSlotHeader(uint32_t index, uint32_t elapsed);
+void bootTimingSlotHash(uint32_t index, uint32_t elapsed);
+void bootTimingErase(uint32_t elapsed, uint32_t size);
+void bootTimingVerify(uint32_t elapsed);
+void bootTimingProgram(uint32_t size);
+void bootTimingFlashRead(uint32_t size);
+void bootTimingStorageRead(uint32_t size);
+
+/**
+ * End the last phase and copy the sealed record to
+ * BOOT_TIMING_RECORD_ADDRESS, just before the jump to the application
+ */
+void bootTimingFinish(void);
+#else
+/* the arguments are referenced but not evaluated, so variables that are
+   only kept for the record do not need to be marked unused */
+#define bootTimingSlotHeader(index, elapsed) ((void) sizeof(elapsed))
+#define bootTimingSlotHash(index, elapsed)   ((void) sizeof(elapsed))
+#define bootTimingErase(elapsed, size)       ((void) sizeof((elapsed) + (size)))
+#define bootTimingVerify(elapsed)            ((void) sizeof(elapsed))
+#define bootTimingProgram(size)              ((void) sizeof(size))
+#define bootTimingFlashRead(size)            ((void) sizeof(size))
+#define bootTimingStorageRead(size)          ((void) sizeof(size))
+#define bootTimingFinish()
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BOOT_TIMING_H
@@ -17,13 +17,11 @@
 // ----------------------------------------------------------------------------
 
 #include "bootloader_common.h"
+#include "ucp_request.h"
 
 /* buffer used in storage operations */
 uint8_t buffer_array[BUFFER_SIZE];
 
-/* variable for exposing the most recent event */
-uint32_t event_callback = CLEAR_EVENT;
-
 /* lookup table for printing hexadecimal values */
 const char hexTable[16] = {'0', '1', '2', '3', '4', '5', '6', '7',
                            '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'
@@ -38,7 +36,7 @@ void arm_ucp_event_handler(uint32_t event)
 {
     tr_debug("event: %" PRIx32, event);
 
-    event_callback = event;
+    ucpRequestEvent(event);
 }
 
 /**
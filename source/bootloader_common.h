@@ -42,7 +42,6 @@ enum {
 
 extern uint8_t buffer_array[BUFFER_SIZE];
 
-extern uint32_t event_callback;
 extern const char hexTable[16];
 
 void arm_ucp_event_handler(uint32_t event);
@@ -40,4 +40,91 @@
 "To use pre configured profiles: mbed compile --app-config configs/<config>.json"
 #endif
 
+/* If jump address is not set then default to start address. */
+#if defined(MBED_CONF_APP_APPLICATION_START_ADDRESS) && \
+    !defined(MBED_CONF_APP_APPLICATION_JUMP_ADDRESS)
+#define MBED_CONF_APP_APPLICATION_JUMP_ADDRESS MBED_CONF_APP_APPLICATION_START_ADDRESS
+#endif
+
+/* APPLICATION_B_HEADER_ADDRESS, APPLICATION_B_START_ADDRESS and
+   APPLICATION_B_JUMP_ADDRESS
+   Second application region of the A/B execute in place boot mode.
+*/
+#if defined(XIP_AB_BOOT) && (XIP_AB_BOOT == 1)
+#define APPLICATION_REGION_COUNT 2
+
+#if !defined(MBED_CONF_APP_APPLICATION_B_HEADER_ADDRESS) || \
+    !defined(MBED_CONF_APP_APPLICATION_B_START_ADDRESS)
+#error "configure application-b-header-address and application-b-start-address in mbed_app.json to use XIP_AB_BOOT"
+#endif
+
+#define APPLICATION_B_HEADER_ADDRESS MBED_CONF_APP_APPLICATION_B_HEADER_ADDRESS
+#define APPLICATION_B_START_ADDRESS  MBED_CONF_APP_APPLICATION_B_START_ADDRESS
+
+#if defined(MBED_CONF_APP_APPLICATION_B_JUMP_ADDRESS)
+#define APPLICATION_B_JUMP_ADDRESS MBED_CONF_APP_APPLICATION_B_JUMP_ADDRESS
+#else
+#define APPLICATION_B_JUMP_ADDRESS APPLICATION_B_START_ADDRESS
+#endif
+
+#if defined(MBED_CONF_APP_APPLICATION_START_ADDRESS) && \
+    defined(MBED_CONF_APP_MAX_APPLICATION_SIZE) && \
+    ((APPLICATION_B_HEADER_ADDRESS < \
+      MBED_CONF_APP_APPLICATION_START_ADDRESS + MBED_CONF_APP_MAX_APPLICATION_SIZE) && \
+     (APPLICATION_B_START_ADDRESS + MBED_CONF_APP_MAX_APPLICATION_SIZE > \
+      FIRMWARE_METADATA_HEADER_ADDRESS))
+#error "the application-b region overlaps the application region, reduce max-application-size"
+#endif
+#else
+#define APPLICATION_REGION_COUNT 1
+#endif
+
+/* FLASH_SECTOR_SIZE, FLASH_PAGE_SIZE and FLASH_ERASE_VALUE
+   Targets with uniform sectors can declare the internal flash geometry so it
+   is fixed at compile time instead of queried from the flash driver.
+*/
+#if defined(MBED_CONF_APP_FLASH_SECTOR_SIZE) && \
+    defined(MBED_CONF_APP_FLASH_PAGE_SIZE)
+#define FLASH_SECTOR_SIZE MBED_CONF_APP_FLASH_SECTOR_SIZE
+#define FLASH_PAGE_SIZE   MBED_CONF_APP_FLASH_PAGE_SIZE
+
+#if defined(MBED_CONF_APP_FLASH_ERASE_VALUE)
+#define FLASH_ERASE_VALUE MBED_CONF_APP_FLASH_ERASE_VALUE
+#else
+#define FLASH_ERASE_VALUE 0xFF
+#endif
+
+#if (FLASH_SECTOR_SIZE <= 0) || ((FLASH_SECTOR_SIZE & (FLASH_SECTOR_SIZE - 1)) != 0) || \
+    (FLASH_PAGE_SIZE <= 0) || ((FLASH_PAGE_SIZE & (FLASH_PAGE_SIZE - 1)) != 0)
+#error "flash-sector-size and flash-page-size must be powers of two"
+#endif
+
+#if FLASH_PAGE_SIZE > FLASH_SECTOR_SIZE
+#error "flash-page-size is larger than flash-sector-size"
+#endif
+
+#if (FIRMWARE_METADATA_HEADER_ADDRESS % FLASH_SECTOR_SIZE) != 0
+#error "update-client.application-details is not aligned to flash-sector-size"
+#endif
+
+#if defined(MBED_CONF_APP_APPLICATION_START_ADDRESS) && \
+    ((MBED_CONF_APP_APPLICATION_START_ADDRESS % FLASH_PAGE_SIZE) != 0)
+#error "application-start-address is not aligned to flash-page-size"
+#endif
+
+#if defined(XIP_AB_BOOT) && (XIP_AB_BOOT == 1) && \
+    (((APPLICATION_B_HEADER_ADDRESS % FLASH_SECTOR_SIZE) != 0) || \
+     ((APPLICATION_B_START_ADDRESS % FLASH_PAGE_SIZE) != 0))
+#error "application-b-header-address or application-b-start-address is not aligned to the flash geometry"
+#endif
+#endif
+
+/* FLASH_BANK_SIZE
+   Size of each bank of the internal flash, on targets where one bank can be
+   read while another one is programmed.
+*/
+#if defined(MBED_CONF_APP_FLASH_BANK_SIZE)
+#define FLASH_BANK_SIZE MBED_CONF_APP_FLASH_BANK_SIZE
+#endif
+
 #endif // BOOTLOADER_CONFIG_H
@@ -0,0 +1,149 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#include "chunk_manifest.h"
+
+#include <string.h>
+
+static uint32_t readUint32(const uint8_t *buffer)
+{
+    return ((uint32_t) buffer[0])       | ((uint32_t) buffer[1] << 8) |
+           ((uint32_t) buffer[2] << 16) | ((uint32_t) buffer[3] << 24);
+}
+
+bool chunkManifestParse(const uint8_t footer[CHUNK_MANIFEST_FOOTER_SIZE],
+                        uint32_t payload_size,
+                        chunk_manifest_t *manifest)
+{
+    bool result = false;
+
+    if (footer && manifest &&
+            (readUint32(&footer[0]) == CHUNK_MANIFEST_MAGIC)) {
+        uint32_t chunk_size = readUint32(&footer[4]);
+        uint32_t chunk_count = readUint32(&footer[8]);
+        uint32_t image_size = readUint32(&footer[12]);
+
+        /* the manifest must describe exactly the payload it is part of,
+           with every byte of the image in a chunk */
+        if ((chunk_size > 0) &&
+                (chunk_count <= CHUNK_MANIFEST_MAX_CHUNKS) &&
+                (chunk_count == image_size / chunk_size +
+                 ((image_size % chunk_size) ? 1 : 0)) &&
+                (image_size < payload_size) &&
+                (payload_size - image_size ==
+                 (chunk_count + 1) * SIZEOF_SHA256 + CHUNK_MANIFEST_FOOTER_SIZE)) {
+            manifest->chunk_size = chunk_size;
+            manifest->chunk_count = chunk_count;
+            manifest->image_size = image_size;
+
+            result = true;
+        } else {
+            tr_warning("Unsupported chunk manifest");
+        }
+    }
+
+    return result;
+}
+
+bool chunkManifestCheckRoot(const chunk_manifest_t *manifest)
+{
+    uint8_t root[SIZEOF_SHA256];
+
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts(&ctx, 0);
+    mbedtls_sha256_update(&ctx,
+                          manifest->digest[0],
+                          manifest->chunk_count * SIZEOF_SHA256);
+    mbedtls_sha256_finish(&ctx, root);
+    mbedtls_sha256_free(&ctx);
+
+    return (memcmp(root, manifest->root, SIZEOF_SHA256) == 0);
+}
+
+void chunkCheckStart(chunk_check_t *check, const chunk_manifest_t *manifest)
+{
+    memset(check, 0, sizeof(chunk_check_t));
+
+    check->manifest = manifest;
+    check->first_failed = CHUNK_MANIFEST_NO_FAILURE;
+
+    mbedtls_sha256_init(&check->ctx);
+    mbedtls_sha256_starts(&check->ctx, 0);
+}
+
+uint32_t chunkCheckUpdate(chunk_check_t *check,
+                          const uint8_t *data,
+                          uint32_t size)
+{
+    const chunk_manifest_t *manifest = check->manifest;
+    uint32_t failed = 0;
+
+    while (manifest && (size > 0) && (check->offset < manifest->image_size)) {
+        uint32_t chunk = check->offset / manifest->chunk_size;
+
+        /* stop at the end of the chunk */
+        uint32_t end = (chunk + 1) * manifest->chunk_size;
+
+        if (end > manifest->image_size) {
+            end = manifest->image_size;
+        }
+
+        uint32_t length = (size > end - check->offset) ?
+                          end - check->offset : size;
+
+        mbedtls_sha256_update(&check->ctx, data, length);
+
+        check->offset += length;
+        data += length;
+        size -= length;
+
+        if (check->offset == end) {
+            uint8_t digest[SIZEOF_SHA256];
+
+            mbedtls_sha256_finish(&check->ctx, digest);
+
+            if (memcmp(digest, manifest->digest[chunk], SIZEOF_SHA256) != 0) {
+                check->failed[chunk / 32] |= (1UL << (chunk % 32));
+
+                if (check->failed_count == 0) {
+                    check->first_failed = chunk;
+                }
+
+                check->failed_count++;
+                failed++;
+            }
+
+            /* every chunk is hashed on its own */
+            mbedtls_sha256_starts(&check->ctx, 0);
+        }
+    }
+
+    return failed;
+}
+
+bool chunkCheckFailed(const chunk_check_t *check, uint32_t chunk)
+{
+    return (chunk < CHUNK_MANIFEST_MAX_CHUNKS) &&
+           (check->failed[chunk / 32] & (1UL << (chunk % 32)));
+}
+
+void chunkCheckFree(chunk_check_t *check)
+{
+    mbedtls_sha256_free(&check->ctx);
+}
@@ -0,0 +1,132 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef CHUNK_MANIFEST_H
+#define CHUNK_MANIFEST_H
+
+/* An optional chunk manifest can be appended to a firmware payload:
+
+       +-------------------+ <- details->size
+       |  footer (16 B)    |    magic, chunk size, chunk count, image size
+       +-------------------+
+       |  root (32 B)      |    SHA-256 of all chunk digests
+       +-------------------+
+       |  chunk digests    |    chunk count * 32 B
+       +-------------------+ <- image size
+       |  image            |
+       +-------------------+ <- 0
+
+   Digest i is the SHA-256 of chunk i of the image on its own, the last
+   chunk may be shorter than the chunk size. The root is checked when the
+   manifest is loaded and the digests while the image is hashed, so a
+   corrupt chunk is detected as soon as it has been read and every chunk
+   can be checked, or copied again, independently. The manifest is part of
+   the payload, so the SHA-256 in the firmware header covers the root and
+   remains the final check.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "bootloader_common.h"
+#include "mbedtls/sha256.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef CHUNK_MANIFEST_MAX_CHUNKS
+#define CHUNK_MANIFEST_MAX_CHUNKS   32
+#endif
+
+#define CHUNK_MANIFEST_MAGIC        0x524B4843 /* "CHKR" */
+#define CHUNK_MANIFEST_FOOTER_SIZE  16
+#define CHUNK_MANIFEST_NO_FAILURE   0xFFFFFFFF
+
+typedef struct {
+    uint32_t chunk_size;
+    uint32_t chunk_count;
+    uint32_t image_size;
+    uint8_t  digest[CHUNK_MANIFEST_MAX_CHUNKS][SIZEOF_SHA256];
+    uint8_t  root[SIZEOF_SHA256];
+} chunk_manifest_t;
+
+/* progress of checking an image against its manifest */
+typedef struct {
+    const chunk_manifest_t *manifest;
+    mbedtls_sha256_context ctx;
+    uint32_t offset;
+    uint32_t failed_count;
+    uint32_t first_failed;
+    uint32_t failed[(CHUNK_MANIFEST_MAX_CHUNKS + 31) / 32];
+} chunk_check_t;
+
+/**
+ * Parse the footer of a payload
+ * @param  footer        Last CHUNK_MANIFEST_FOOTER_SIZE bytes of the payload.
+ * @param  payload_size  Size of the payload.
+ * @param  manifest      Manifest to initialize. The digests and the root
+ *                       must be loaded by the caller from offset image_size.
+ * @return true if the payload carries a supported chunk manifest.
+ */
+bool chunkManifestParse(const uint8_t footer[CHUNK_MANIFEST_FOOTER_SIZE],
+                        uint32_t payload_size,
+                        chunk_manifest_t *manifest);
+
+/**
+ * Check the loaded digests against the root
+ * @return true if the digests hash to the root.
+ */
+bool chunkManifestCheckRoot(const chunk_manifest_t *manifest);
+
+/**
+ * Start checking an image against its manifest
+ * @param  check     Check to initialize.
+ * @param  manifest  Loaded manifest, or NULL to check nothing.
+ */
+void chunkCheckStart(chunk_check_t *check, const chunk_manifest_t *manifest);
+
+/**
+ * Hash the next part of the payload into the chunk digests
+ * @detail Data after the image is ignored. Every chunk that is completed
+ *         is compared with its digest and recorded if it does not match.
+ * @param  check  Started check.
+ * @param  data   Payload data following the data passed before.
+ * @param  size   Size of data.
+ * @return number of chunks completed by data that failed.
+ */
+uint32_t chunkCheckUpdate(chunk_check_t *check,
+                          const uint8_t *data,
+                          uint32_t size);
+
+/**
+ * Query a chunk after it was checked
+ * @return true if the chunk did not match its digest.
+ */
+bool chunkCheckFailed(const chunk_check_t *check, uint32_t chunk);
+
+/**
+ * Release the hash context of a check
+ */
+void chunkCheckFree(chunk_check_t *check);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHUNK_MANIFEST_H
@@ -0,0 +1,225 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#include "compressed_image.h"
+
+#include "bootloader_common.h"
+
+#include <string.h>
+
+#define WINDOW_MASK (COMPRESSED_IMAGE_WINDOW_SIZE - 1)
+
+#if (COMPRESSED_IMAGE_WINDOW_SIZE & WINDOW_MASK) != 0
+#error "COMPRESSED_IMAGE_WINDOW_SIZE must be a power of 2"
+#endif
+
+/* LZ4 sequence: token, literal length, literals, offset, match length */
+enum {
+    STATE_TOKEN,
+    STATE_LITERAL_LENGTH,
+    STATE_LITERALS,
+    STATE_OFFSET_LOW,
+    STATE_OFFSET_HIGH,
+    STATE_MATCH_LENGTH,
+    STATE_MATCH
+};
+
+#define MIN_MATCH 4
+
+compressed_image_stream_t compressed_image_stream;
+
+static uint32_t readUint32(const uint8_t *buffer)
+{
+    return ((uint32_t) buffer[0])       | ((uint32_t) buffer[1] << 8) |
+           ((uint32_t) buffer[2] << 16) | ((uint32_t) buffer[3] << 24);
+}
+
+bool compressedImageParseHeader(const uint8_t buffer[COMPRESSED_IMAGE_HEADER_SIZE],
+                                uint32_t *size)
+{
+    bool result = false;
+
+    if (buffer && size &&
+            (readUint32(&buffer[0]) == COMPRESSED_IMAGE_MAGIC)) {
+        /* images compressed with a larger window cannot be decoded */
+        if ((readUint32(&buffer[4]) <= COMPRESSED_IMAGE_WINDOW_SIZE) &&
+                (readUint32(&buffer[12]) == 0)) {
+            *size = readUint32(&buffer[8]);
+            result = true;
+        } else {
+            tr_warning("Unsupported compressed image");
+        }
+    }
+
+    return result;
+}
+
+void compressedImageInit(compressed_image_stream_t *stream, uint32_t size)
+{
+    stream->produced = 0;
+    stream->size = size;
+    stream->state = STATE_TOKEN;
+    stream->literals = 0;
+    stream->match = 0;
+    stream->offset = 0;
+}
+
+/**
+ * Append a byte to the output and the window
+ */
+static void emit(compressed_image_stream_t *stream,
+                 uint8_t *output,
+                 uint32_t *written,
+                 uint8_t value)
+{
+    stream->window[stream->produced & WINDOW_MASK] = value;
+    stream->produced++;
+
+    output[*written] = value;
+    *written += 1;
+}
+
+bool compressedImageDecode(compressed_image_stream_t *stream,
+                           const uint8_t **input,
+                           uint32_t *input_size,
+                           uint8_t *output,
+                           uint32_t *output_size)
+{
+    bool result = true;
+    uint32_t written = 0;
+
+    const uint8_t *data = *input;
+    uint32_t available = *input_size;
+
+    while (result && (written < *output_size)) {
+        /* states that produce output do not need input */
+        if ((available == 0) && (stream->state != STATE_MATCH)) {
+            break;
+        }
+
+        switch (stream->state) {
+            case STATE_TOKEN:
+                stream->literals = *data >> 4;
+                stream->match = (*data & 0x0F) + MIN_MATCH;
+                data++;
+                available--;
+
+                stream->state = (stream->literals == 15) ?
+                                STATE_LITERAL_LENGTH : STATE_LITERALS;
+                break;
+
+            case STATE_LITERAL_LENGTH:
+                stream->literals += *data;
+
+                if (*data != 255) {
+                    stream->state = STATE_LITERALS;
+                }
+
+                data++;
+                available--;
+                break;
+
+            case STATE_LITERALS:
+                if (stream->literals == 0) {
+                    stream->state = STATE_OFFSET_LOW;
+                } else {
+                    /* copy as many literals as input and output allow */
+                    while ((stream->literals > 0) && (available > 0) &&
+                            (written < *output_size)) {
+                        emit(stream, output, &written, *data);
+                        stream->literals--;
+                        data++;
+                        available--;
+                    }
+                }
+                break;
+
+            case STATE_OFFSET_LOW:
+                stream->offset = *data;
+                stream->state = STATE_OFFSET_HIGH;
+                data++;
+                available--;
+                break;
+
+            case STATE_OFFSET_HIGH:
+                stream->offset |= (uint32_t) *data << 8;
+
+                /* matches may only refer to bytes still in the window */
+                result = (stream->offset > 0) &&
+                         (stream->offset <= COMPRESSED_IMAGE_WINDOW_SIZE) &&
+                         (stream->offset <= stream->produced);
+
+                stream->state = (stream->match == 15 + MIN_MATCH) ?
+                                STATE_MATCH_LENGTH : STATE_MATCH;
+                data++;
+                available--;
+                break;
+
+            case STATE_MATCH_LENGTH:
+                stream->match += *data;
+
+                if (*data != 255) {
+                    stream->state = STATE_MATCH;
+                }
+
+                data++;
+                available--;
+                break;
+
+            case STATE_MATCH:
+                if (stream->match == 0) {
+                    stream->state = STATE_TOKEN;
+                } else {
+                    while ((stream->match > 0) && (written < *output_size)) {
+                        emit(stream, output, &written,
+                             stream->window[(stream->produced - stream->offset) &
+                                            WINDOW_MASK]);
+                        stream->match--;
+                    }
+                }
+                break;
+
+            default:
+                result = false;
+                break;
+        }
+
+        /* the stream may not produce more than the image */
+        if (stream->produced > stream->size) {
+            result = false;
+        }
+    }
+
+    *input = data;
+    *input_size = available;
+    *output_size = written;
+
+    return result;
+}
+
+bool compressedImageDone(const compressed_image_stream_t *stream)
+{
+    /* the last sequence of a block only holds literals */
+    bool boundary = (stream->state == STATE_TOKEN) ||
+                    ((stream->state == STATE_LITERALS) &&
+                     (stream->literals == 0)) ||
+                    (stream->state == STATE_OFFSET_LOW) ||
+                    ((stream->state == STATE_MATCH) && (stream->match == 0));
+
+    return boundary && (stream->produced == stream->size);
+}
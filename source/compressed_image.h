@@ -0,0 +1,106 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef COMPRESSED_IMAGE_H
+#define COMPRESSED_IMAGE_H
+
+/* A compressed firmware payload is a header followed by a single LZ4 block
+   (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md) whose match
+   offsets are limited to COMPRESSED_IMAGE_WINDOW_SIZE:
+
+       +-------------------+
+       |  LZ4 block        |
+       +-------------------+ <- COMPRESSED_IMAGE_HEADER_SIZE
+       |  header           |    magic, window size, uncompressed size
+       +-------------------+ <- 0
+
+   The SHA-256 in the firmware header is the hash of the uncompressed image,
+   so the active header written after the install is unchanged.
+
+   The decoder is streaming: input and output can be split at any byte, and
+   only the last COMPRESSED_IMAGE_WINDOW_SIZE bytes of output are kept.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define COMPRESSED_IMAGE_MAGIC          0x57345A4C /* "LZ4W" */
+#define COMPRESSED_IMAGE_HEADER_SIZE    16
+#define COMPRESSED_IMAGE_WINDOW_SIZE    4096
+
+typedef struct {
+    uint8_t  window[COMPRESSED_IMAGE_WINDOW_SIZE];
+    uint32_t produced;
+    uint32_t size;
+    uint32_t state;
+    uint32_t literals;
+    uint32_t match;
+    uint32_t offset;
+} compressed_image_stream_t;
+
+/* one decoder shared by the integrity check and the install */
+extern compressed_image_stream_t compressed_image_stream;
+
+/**
+ * Parse the header of a payload
+ * @param  buffer  First COMPRESSED_IMAGE_HEADER_SIZE bytes of the payload.
+ * @param  size    Set to the size of the uncompressed image.
+ * @return true if the payload is a supported compressed image.
+ */
+bool compressedImageParseHeader(const uint8_t buffer[COMPRESSED_IMAGE_HEADER_SIZE],
+                                uint32_t *size);
+
+/**
+ * Prepare a decoder for a new image
+ * @param  stream  Decoder.
+ * @param  size    Size of the uncompressed image.
+ */
+void compressedImageInit(compressed_image_stream_t *stream, uint32_t size);
+
+/**
+ * Decompress as much as possible
+ * @param  stream       Decoder.
+ * @param  input        Compressed data, advanced past the consumed bytes.
+ * @param  input_size   Bytes available at input, decremented accordingly.
+ * @param  output       Buffer for uncompressed data.
+ * @param  output_size  On input the size of output, on output the number of
+ *                      bytes written.
+ * @return false if the data is corrupt or exceeds the image size.
+ */
+bool compressedImageDecode(compressed_image_stream_t *stream,
+                           const uint8_t **input,
+                           uint32_t *input_size,
+                           uint8_t *output,
+                           uint32_t *output_size);
+
+/**
+ * Check that the whole image was decompressed
+ * @return true if the stream ended on a sequence boundary after producing
+ *         exactly the image size.
+ */
+bool compressedImageDone(const compressed_image_stream_t *stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // COMPRESSED_IMAGE_H
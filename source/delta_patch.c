@@ -0,0 +1,86 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#include "delta_patch.h"
+
+#include <string.h>
+
+static uint32_t readUint32(const uint8_t *buffer)
+{
+    return ((uint32_t) buffer[0])       | ((uint32_t) buffer[1] << 8) |
+           ((uint32_t) buffer[2] << 16) | ((uint32_t) buffer[3] << 24);
+}
+
+bool deltaPatchParseHeader(const uint8_t buffer[DELTA_PATCH_HEADER_SIZE],
+                           delta_patch_header_t *header)
+{
+    bool result = false;
+
+    if (buffer && header &&
+            (readUint32(&buffer[0]) == DELTA_PATCH_MAGIC)) {
+        header->flags = readUint32(&buffer[4]);
+        header->sector_size = readUint32(&buffer[8]);
+        header->first_window = readUint32(&buffer[12]);
+        header->source_size = readUint32(&buffer[16]);
+        header->target_size = readUint32(&buffer[20]);
+        memcpy(header->source_hash, &buffer[24], SIZEOF_SHA256);
+        memcpy(header->target_hash, &buffer[56], SIZEOF_SHA256);
+
+        if ((header->sector_size > 0) &&
+                (header->first_window > 0) &&
+                (header->first_window <= header->sector_size) &&
+                (header->target_size > 0) &&
+                ((header->flags & ~DELTA_PATCH_FLAG_BACKWARD) == 0)) {
+            result = true;
+        } else {
+            tr_warning("Unsupported delta patch");
+        }
+    }
+
+    return result;
+}
+
+uint32_t deltaPatchWindowCount(const delta_patch_header_t *header)
+{
+    uint32_t count = 1;
+
+    if (header->target_size > header->first_window) {
+        count += (header->target_size - header->first_window +
+                  header->sector_size - 1) / header->sector_size;
+    }
+
+    return count;
+}
+
+void deltaPatchWindow(const delta_patch_header_t *header,
+                      uint32_t window,
+                      uint32_t *start,
+                      uint32_t *end)
+{
+    if (window == 0) {
+        *start = 0;
+        *end = header->first_window;
+    } else {
+        *start = header->first_window + (window - 1) * header->sector_size;
+        *end = *start + header->sector_size;
+    }
+
+    if (*end > header->target_size) {
+        *end = header->target_size;
+    }
+}
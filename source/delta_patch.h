@@ -0,0 +1,104 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef DELTA_PATCH_H
+#define DELTA_PATCH_H
+
+/* A delta patch rebuilds a new application from the active one, in place:
+
+       +-------------------+
+       |  operations       |    COPY or DATA, see below
+       +-------------------+ <- DELTA_PATCH_HEADER_SIZE
+       |  header           |    magic, flags, sector layout, source and
+       |                   |    target size and SHA-256
+       +-------------------+ <- 0
+
+   The target is built one flash sector (window) at a time in RAM, then the
+   sector is erased and programmed. Window 0 runs from the application start
+   to the first sector boundary, the other windows are one sector each.
+
+   The operations of each window are stored in ascending target order and
+   never cross a window boundary. Windows are stored in ascending order, or
+   in descending order if DELTA_PATCH_FLAG_BACKWARD is set. A COPY may only
+   read source bytes that have not been overwritten yet:
+
+       forward:   source offset          >= start of the current window
+       backward:  source offset + length <= end of the current window
+
+   All values are little endian.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "bootloader_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DELTA_PATCH_MAGIC           0x50544C44 /* "DLTP" */
+#define DELTA_PATCH_HEADER_SIZE     88
+
+#define DELTA_PATCH_FLAG_BACKWARD   0x00000001
+
+/* operation codes, followed by a 32-bit length */
+#define DELTA_PATCH_OP_COPY         0x00 /* then 32-bit source offset */
+#define DELTA_PATCH_OP_DATA         0x01 /* then length bytes */
+
+typedef struct {
+    uint32_t flags;
+    uint32_t sector_size;
+    uint32_t first_window;
+    uint32_t source_size;
+    uint32_t target_size;
+    uint8_t  source_hash[SIZEOF_SHA256];
+    uint8_t  target_hash[SIZEOF_SHA256];
+} delta_patch_header_t;
+
+/**
+ * Parse the header of a delta patch
+ * @param  buffer  First DELTA_PATCH_HEADER_SIZE bytes of the payload.
+ * @param  header  Header to initialize.
+ * @return true if the payload is a supported delta patch.
+ */
+bool deltaPatchParseHeader(const uint8_t buffer[DELTA_PATCH_HEADER_SIZE],
+                           delta_patch_header_t *header);
+
+/**
+ * Number of windows covering the target
+ */
+uint32_t deltaPatchWindowCount(const delta_patch_header_t *header);
+
+/**
+ * Target offsets covered by a window
+ * @param  header  Parsed header.
+ * @param  window  Index of the window, less than deltaPatchWindowCount().
+ * @param  start   Set to the first target offset of the window.
+ * @param  end     Set to the end of the window, clipped to the target size.
+ */
+void deltaPatchWindow(const delta_patch_header_t *header,
+                      uint32_t window,
+                      uint32_t *start,
+                      uint32_t *end);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DELTA_PATCH_H
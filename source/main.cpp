@@ -31,7 +31,10 @@
 #include "bootloader_platform.h"
 #include "active_application.h"
 #include "bootloader_common.h"
+#include "boot_phase.h"
+#include "boot_timing.h"
 #include "mbed_application.h"
+#include "transfer_sizing.h"
 #include "upgrade.h"
 
 #if defined(BOOTLOADER_POWER_CUT_TEST) && (BOOTLOADER_POWER_CUT_TEST == 1)
@@ -75,23 +78,32 @@ SDBlockDevice sd(MBED_CONF_SD_SPI_MOSI, MBED_CONF_SD_SPI_MISO,
                  MBED_CONF_SD_SPI_CLK,  MBED_CONF_SD_SPI_CS);
 #endif
 
+#if defined(STORAGE_READ_AHEAD) && (STORAGE_READ_AHEAD == 1)
+#include "read_ahead_block_device.h"
+
+/* read slots ahead in multi-block transfers and cache the slot headers */
+ReadAheadBlockDevice sd_cache(&sd);
+
+BlockDevice *arm_uc_blockdevice = &sd_cache;
+#else
 BlockDevice *arm_uc_blockdevice = &sd;
 #endif
+#endif
 
 #ifndef MBED_CONF_APP_APPLICATION_START_ADDRESS
 #error Application start address must be defined
 #endif
 
-/* If jump address is not set then default to start address. */
-#ifndef MBED_CONF_APP_APPLICATION_JUMP_ADDRESS
-#define MBED_CONF_APP_APPLICATION_JUMP_ADDRESS MBED_CONF_APP_APPLICATION_START_ADDRESS
-#endif
-
 int main(void)
 {
+    bootPhaseEnter(BOOT_PHASE_INIT);
+
     /* Use malloc to allocate uint64_t version number on the heap */
     heapVersion = (uint64_t *) malloc(sizeof(uint64_t));
     bootCounter = (uint8_t *) malloc(1);
+#if defined(VERIFIED_IMAGE_CACHE) && (VERIFIED_IMAGE_CACHE == 1)
+    verifiedImageSkips = (uint32_t *) malloc(2 * sizeof(uint32_t));
+#endif
 
     /* Set PAAL Update implementation before initializing Firmware Manager */
     ARM_UCP_SetPAALUpdate(&MBED_CLOUD_CLIENT_UPDATE_STORAGE);
@@ -99,6 +111,11 @@ int main(void)
     /* Initialize PAL */
     arm_uc_error_t ucp_result = ARM_UCP_Initialize(arm_ucp_event_handler);
 
+#if defined(ARM_UC_USE_PAL_BLOCKDEVICE) && (ARM_UC_USE_PAL_BLOCKDEVICE==1)
+    /* size storage reads in whole blocks of the storage device */
+    transferSizingStorageGeometry(arm_uc_blockdevice->get_read_size());
+#endif
+
     /* If a reboot message was left from last boot, print it here */
     if (existsErrorMessageLeadingToReboot()) {
         tr_info("error message leading to reboot: %s",
@@ -162,6 +179,12 @@ int main(void)
             /* Try to update firmware from journal */
             canForward = upgradeApplicationFromStorage();
 
+#if defined(ARM_UC_USE_PAL_BLOCKDEVICE) && (ARM_UC_USE_PAL_BLOCKDEVICE==1) && \
+    defined(STORAGE_READ_AHEAD) && (STORAGE_READ_AHEAD == 1)
+            tr_debug("Storage cache hits: %" PRIu32 ", misses: %" PRIu32,
+                     sd_cache.get_hits(), sd_cache.get_misses());
+#endif
+
             /* deinit storage driver */
             activeStorageDeinit();
         }
@@ -169,6 +192,8 @@ int main(void)
 
     /* forward control to ACTIVE application if it is deemed sane */
     if (canForward) {
+        bootPhaseEnter(BOOT_PHASE_JUMP);
+
 #if defined(BOOTLOADER_POWER_CUT_TEST) && (BOOTLOADER_POWER_CUT_TEST == 1)
         power_cut_test_assert_state(POWER_CUT_TEST_STATE_END);
         wait(5);
@@ -176,16 +201,21 @@ int main(void)
 #elif defined(FIRMWARE_UPDATE_TEST) && (FIRMWARE_UPDATE_TEST == 1)
         firmware_update_test_end();
 #endif
-        uint32_t app_start_addr = MBED_CONF_APP_APPLICATION_START_ADDRESS;
-        uint32_t app_stack_ptr = *((uint32_t *)(MBED_CONF_APP_APPLICATION_JUMP_ADDRESS + 0));
-        uint32_t app_jump_addr = *((uint32_t *)(MBED_CONF_APP_APPLICATION_JUMP_ADDRESS + 4));
+        /* with XIP_AB_BOOT this is the region selected during the update */
+        uint32_t app_start_addr = activeApplicationStartAddress();
+        uint32_t app_vector_addr = activeApplicationJumpAddress();
+        uint32_t app_stack_ptr = *((uint32_t *)(app_vector_addr + 0));
+        uint32_t app_jump_addr = *((uint32_t *)(app_vector_addr + 4));
 
         tr_info("Application's start address: 0x%" PRIX32, app_start_addr);
         tr_info("Application's jump address: 0x%" PRIX32, app_jump_addr);
         tr_info("Application's stack address: 0x%" PRIX32, app_stack_ptr);
         tr_info("Forwarding to application...\r\n");
 
-        mbed_start_application(MBED_CONF_APP_APPLICATION_JUMP_ADDRESS);
+        /* hand the boot timing record to the application */
+        bootTimingFinish();
+
+        mbed_start_application(app_vector_addr);
     }
 
     /* Reset bootCounter; this allows a user to reapply a new bootloader
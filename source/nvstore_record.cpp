@@ -0,0 +1,151 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#if defined(NVSTORE_ENABLED) && NVSTORE_ENABLED
+
+#ifndef __STDC_FORMAT_MACROS
+#define __STDC_FORMAT_MACROS
+#endif
+
+#include "nvstore_record.h"
+#include "bootloader_common.h"
+
+#include "nvstore.h"
+#include "mbedtls/md.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#define DEVICE_KEY_SIZE_IN_BYTES (128/8)
+
+extern "C" int8_t mbed_cloud_client_get_rot_128bit(uint8_t *key_buf, uint32_t length);
+
+static bool nvstoreInit(void)
+{
+    static bool initialized = false;
+
+    if (!initialized) {
+        initialized = (NVStore::get_instance().init() == NVSTORE_SUCCESS);
+    }
+
+    return initialized;
+}
+
+/**
+ * Calculate the authentication code of a record
+ * @detail HMAC-SHA256 over the NVStore key and the record, keyed with the
+ *         device root of trust. Including the key prevents records from
+ *         being moved between keys.
+ */
+static bool nvstoreRecordMac(uint16_t key,
+                             const uint8_t *record,
+                             uint16_t size,
+                             uint8_t mac[SIZEOF_SHA256])
+{
+    uint8_t rot[DEVICE_KEY_SIZE_IN_BYTES] = { 0 };
+
+    bool result = (mbed_cloud_client_get_rot_128bit(rot, sizeof(rot)) == 0);
+
+    if (result) {
+        mbedtls_md_context_t ctx;
+        mbedtls_md_init(&ctx);
+
+        uint8_t keyBytes[2] = { (uint8_t)(key >> 8), (uint8_t) key };
+
+        result = (mbedtls_md_setup(&ctx,
+                                   mbedtls_md_info_from_type(MBEDTLS_MD_SHA256),
+                                   1) == 0) &&
+                 (mbedtls_md_hmac_starts(&ctx, rot, sizeof(rot)) == 0) &&
+                 (mbedtls_md_hmac_update(&ctx, keyBytes, sizeof(keyBytes)) == 0) &&
+                 (mbedtls_md_hmac_update(&ctx, record, size) == 0) &&
+                 (mbedtls_md_hmac_finish(&ctx, mac) == 0);
+
+        mbedtls_md_free(&ctx);
+    }
+
+    /* do not leave the root of trust on the stack */
+    memset(rot, 0, sizeof(rot));
+
+    return result;
+}
+
+bool nvstoreRecordRead(uint16_t key, void *record, uint16_t size)
+{
+    bool result = false;
+
+    if (record && (size <= NVSTORE_RECORD_MAX_SIZE) && nvstoreInit()) {
+        uint8_t stored[NVSTORE_RECORD_MAX_SIZE + SIZEOF_SHA256];
+        uint16_t actualSize = 0;
+
+        int status = NVStore::get_instance().get(key,
+                                                 sizeof(stored),
+                                                 stored,
+                                                 actualSize);
+
+        if ((status == NVSTORE_SUCCESS) &&
+                (actualSize == size + SIZEOF_SHA256)) {
+            uint8_t mac[SIZEOF_SHA256];
+
+            if (nvstoreRecordMac(key, stored, size, mac) &&
+                    (memcmp(mac, &stored[size], SIZEOF_SHA256) == 0)) {
+                memcpy(record, stored, size);
+                result = true;
+            } else {
+                tr_warning("NVStore record %" PRIu16 " not authentic", key);
+            }
+        }
+    }
+
+    return result;
+}
+
+bool nvstoreRecordWrite(uint16_t key, const void *record, uint16_t size)
+{
+    bool result = false;
+
+    if (record && (size <= NVSTORE_RECORD_MAX_SIZE) && nvstoreInit()) {
+        uint8_t stored[NVSTORE_RECORD_MAX_SIZE + SIZEOF_SHA256];
+
+        memcpy(stored, record, size);
+
+        if (nvstoreRecordMac(key, stored, size, &stored[size])) {
+            int status = NVStore::get_instance().set(key,
+                                                     size + SIZEOF_SHA256,
+                                                     stored);
+
+            result = (status == NVSTORE_SUCCESS);
+        }
+    }
+
+    return result;
+}
+
+bool nvstoreRecordRemove(uint16_t key)
+{
+    bool result = false;
+
+    if (nvstoreInit()) {
+        int status = NVStore::get_instance().remove(key);
+
+        result = (status == NVSTORE_SUCCESS) || (status == NVSTORE_NOT_FOUND);
+    }
+
+    return result;
+}
+
+#endif // #if defined(NVSTORE_ENABLED) && NVSTORE_ENABLED
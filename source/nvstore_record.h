@@ -0,0 +1,109 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef NVSTORE_RECORD_H
+#define NVSTORE_RECORD_H
+
+#include <stdint.h>
+
+/* NVStore keys below this one hold the SOTP types of mbed Cloud Client,
+   including the root of trust read in nvstore_rot.cpp (key 4). Raise it if
+   the cloud client in use defines more types.
+*/
+#ifndef NVSTORE_KEY_CLIENT_RESERVED
+#define NVSTORE_KEY_CLIENT_RESERVED 8
+#endif
+
+/* first NVStore key used by the bootloader records, the keys below must
+   also stay below nvstore.max_keys
+*/
+#ifndef NVSTORE_KEY_BASE
+#define NVSTORE_KEY_BASE NVSTORE_KEY_CLIENT_RESERVED
+#endif
+
+#ifndef NVSTORE_KEY_VERIFIED_IMAGE_B
+#define NVSTORE_KEY_VERIFIED_IMAGE_B (NVSTORE_KEY_BASE + 0)
+#endif
+
+#ifndef NVSTORE_KEY_INSTALL_JOURNAL
+#define NVSTORE_KEY_INSTALL_JOURNAL (NVSTORE_KEY_BASE + 1)
+#endif
+
+#ifndef NVSTORE_KEY_VERIFIED_IMAGE
+#define NVSTORE_KEY_VERIFIED_IMAGE (NVSTORE_KEY_BASE + 2)
+#endif
+
+/* rejected slot records use one key per firmware location, starting here */
+#ifndef NVSTORE_KEY_REJECTED_SLOT
+#define NVSTORE_KEY_REJECTED_SLOT  (NVSTORE_KEY_BASE + 3)
+#endif
+
+/* highest key of the default nvstore.max_keys of 16, above the rejected
+   slot records */
+#ifndef NVSTORE_KEY_TRANSFER_SIZING
+#define NVSTORE_KEY_TRANSFER_SIZING (NVSTORE_KEY_BASE + 7)
+#endif
+
+#if (NVSTORE_KEY_VERIFIED_IMAGE_B < NVSTORE_KEY_CLIENT_RESERVED) || \
+    (NVSTORE_KEY_INSTALL_JOURNAL < NVSTORE_KEY_CLIENT_RESERVED) || \
+    (NVSTORE_KEY_VERIFIED_IMAGE < NVSTORE_KEY_CLIENT_RESERVED) || \
+    (NVSTORE_KEY_REJECTED_SLOT < NVSTORE_KEY_CLIENT_RESERVED) || \
+    (NVSTORE_KEY_TRANSFER_SIZING < NVSTORE_KEY_CLIENT_RESERVED)
+#error "Bootloader NVStore keys collide with the keys reserved for mbed Cloud Client"
+#endif
+
+#if defined(MBED_CONF_NVSTORE_MAX_KEYS) && \
+    ((NVSTORE_KEY_VERIFIED_IMAGE_B >= MBED_CONF_NVSTORE_MAX_KEYS) || \
+     (NVSTORE_KEY_INSTALL_JOURNAL >= MBED_CONF_NVSTORE_MAX_KEYS) || \
+     (NVSTORE_KEY_VERIFIED_IMAGE >= MBED_CONF_NVSTORE_MAX_KEYS) || \
+     (NVSTORE_KEY_TRANSFER_SIZING >= MBED_CONF_NVSTORE_MAX_KEYS))
+#error "Bootloader NVStore keys exceed nvstore.max_keys"
+#endif
+
+/* largest record that can be stored, excluding the authentication code */
+#define NVSTORE_RECORD_MAX_SIZE    128
+
+/**
+ * Read a record from NVStore and check its authentication code
+ * @detail Records are authenticated with an HMAC-SHA256 keyed with the
+ *         device root of trust, so records that were not written by this
+ *         device are rejected.
+ * @param  key     NVStore key of the record.
+ * @param  record  Caller-allocated buffer for the record.
+ * @param  size    Expected size of the record.
+ * @return true if the record exists, has the expected size and is authentic.
+ */
+bool nvstoreRecordRead(uint16_t key, void *record, uint16_t size);
+
+/**
+ * Write an authenticated record to NVStore
+ * @param  key     NVStore key of the record.
+ * @param  record  Record to write.
+ * @param  size    Size of the record, at most NVSTORE_RECORD_MAX_SIZE.
+ * @return true if the record was written.
+ */
+bool nvstoreRecordWrite(uint16_t key, const void *record, uint16_t size);
+
+/**
+ * Remove a record from NVStore
+ * @param  key     NVStore key of the record.
+ * @return true if the record no longer exists.
+ */
+bool nvstoreRecordRemove(uint16_t key);
+
+#endif // NVSTORE_RECORD_H
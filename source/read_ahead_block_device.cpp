@@ -0,0 +1,246 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#if defined(ARM_UC_USE_PAL_BLOCKDEVICE) && (ARM_UC_USE_PAL_BLOCKDEVICE==1)
+
+#include "read_ahead_block_device.h"
+
+#include <string.h>
+
+ReadAheadBlockDevice::ReadAheadBlockDevice(BlockDevice *bd)
+    : _bd(bd),
+      _window_size(0),
+      _header_block(0),
+      _window_addr(0),
+      _window_valid(0),
+      _next_addr(0),
+      _clock(0),
+      _hits(0),
+      _misses(0)
+{
+    for (uint32_t index = 0; index < STORAGE_HEADER_CACHE_ENTRIES; index++) {
+        _headers[index].valid = false;
+    }
+}
+
+int ReadAheadBlockDevice::init()
+{
+    int result = _bd->init();
+
+    if (result == BD_ERROR_OK) {
+        bd_size_t read_size = _bd->get_read_size();
+
+        /* both caches hold whole read blocks, a window smaller than a block
+           disables read-ahead and a block size that does not divide the
+           header entry size disables the header cache */
+        _window_size = (STORAGE_READ_AHEAD_SIZE / read_size) * read_size;
+        _header_block = ((STORAGE_HEADER_CACHE_BLOCK % read_size) == 0) ?
+                        STORAGE_HEADER_CACHE_BLOCK : 0;
+
+        invalidate(0, _bd->size());
+    }
+
+    return result;
+}
+
+int ReadAheadBlockDevice::deinit()
+{
+    return _bd->deinit();
+}
+
+int ReadAheadBlockDevice::sync()
+{
+    return _bd->sync();
+}
+
+int ReadAheadBlockDevice::read(void *buffer, bd_addr_t addr, bd_size_t size)
+{
+    if (!is_valid_read(addr, size)) {
+        return BD_ERROR_DEVICE_ERROR;
+    }
+
+    uint8_t *data = (uint8_t *) buffer;
+    int result = BD_ERROR_OK;
+
+    /* reads that continue the previous one are streamed through the window */
+    bool sequential = (addr == _next_addr);
+    _next_addr = addr + size;
+
+    while ((size > 0) && (result == BD_ERROR_OK)) {
+        if ((addr >= _window_addr) && (addr < _window_addr + _window_valid)) {
+            bd_size_t length = _window_addr + _window_valid - addr;
+
+            if (length > size) {
+                length = size;
+            }
+
+            memcpy(data, &_window[addr - _window_addr], length);
+            _hits++;
+
+            data += length;
+            addr += length;
+            size -= length;
+        } else if (size >= _window_size) {
+            /* already a multi-block transfer */
+            result = _bd->read(data, addr, size);
+            _misses++;
+
+            size = 0;
+        } else if (!sequential && (_header_block > 0) &&
+                   ((addr % _header_block) + size <= _header_block)) {
+            result = header_read(data, addr, size);
+
+            size = 0;
+        } else {
+            bd_size_t length = _bd->size() - addr;
+
+            if (length > _window_size) {
+                length = _window_size;
+            }
+
+            _window_valid = 0;
+            result = _bd->read(_window, addr, length);
+            _misses++;
+
+            if (result == BD_ERROR_OK) {
+                _window_addr = addr;
+                _window_valid = length;
+            }
+        }
+    }
+
+    return result;
+}
+
+int ReadAheadBlockDevice::header_read(uint8_t *buffer, bd_addr_t addr, bd_size_t size)
+{
+    bd_addr_t block = addr - (addr % _header_block);
+    header_entry_t *entry = NULL;
+    header_entry_t *oldest = &_headers[0];
+    int result = BD_ERROR_OK;
+
+    for (uint32_t index = 0; index < STORAGE_HEADER_CACHE_ENTRIES; index++) {
+        header_entry_t *candidate = &_headers[index];
+
+        if (candidate->valid && (candidate->addr == block)) {
+            entry = candidate;
+        }
+
+        /* replace free entries first, then the least recently used */
+        uint32_t used = candidate->valid ? candidate->used : 0;
+        uint32_t oldest_used = oldest->valid ? oldest->used : 0;
+
+        if (used < oldest_used) {
+            oldest = candidate;
+        }
+    }
+
+    if (entry) {
+        _hits++;
+    } else {
+        bd_size_t length = _bd->size() - block;
+
+        if (length > _header_block) {
+            length = _header_block;
+        }
+
+        entry = oldest;
+        entry->valid = false;
+
+        result = _bd->read(entry->data, block, length);
+        _misses++;
+
+        if (result == BD_ERROR_OK) {
+            entry->addr = block;
+            entry->valid = true;
+        }
+    }
+
+    if (result == BD_ERROR_OK) {
+        memcpy(buffer, &entry->data[addr - block], size);
+        entry->used = ++_clock;
+    }
+
+    return result;
+}
+
+int ReadAheadBlockDevice::program(const void *buffer, bd_addr_t addr, bd_size_t size)
+{
+    invalidate(addr, size);
+
+    return _bd->program(buffer, addr, size);
+}
+
+int ReadAheadBlockDevice::erase(bd_addr_t addr, bd_size_t size)
+{
+    invalidate(addr, size);
+
+    return _bd->erase(addr, size);
+}
+
+void ReadAheadBlockDevice::invalidate(bd_addr_t addr, bd_size_t size)
+{
+    if ((addr < _window_addr + _window_valid) && (_window_addr < addr + size)) {
+        _window_valid = 0;
+    }
+
+    for (uint32_t index = 0; index < STORAGE_HEADER_CACHE_ENTRIES; index++) {
+        header_entry_t *entry = &_headers[index];
+
+        if (entry->valid &&
+                (addr < entry->addr + _header_block) &&
+                (entry->addr < addr + size)) {
+            entry->valid = false;
+        }
+    }
+
+    /* the next read is not a continuation of cached data */
+    _next_addr = 0;
+}
+
+bd_size_t ReadAheadBlockDevice::get_read_size() const
+{
+    return _bd->get_read_size();
+}
+
+bd_size_t ReadAheadBlockDevice::get_program_size() const
+{
+    return _bd->get_program_size();
+}
+
+bd_size_t ReadAheadBlockDevice::get_erase_size() const
+{
+    return _bd->get_erase_size();
+}
+
+bd_size_t ReadAheadBlockDevice::size() const
+{
+    return _bd->size();
+}
+
+uint32_t ReadAheadBlockDevice::get_hits() const
+{
+    return _hits;
+}
+
+uint32_t ReadAheadBlockDevice::get_misses() const
+{
+    return _misses;
+}
+
+#endif // ARM_UC_USE_PAL_BLOCKDEVICE
@@ -0,0 +1,104 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef READ_AHEAD_BLOCK_DEVICE_H
+#define READ_AHEAD_BLOCK_DEVICE_H
+
+#include "BlockDevice.h"
+
+#include <stdint.h>
+
+/* bytes read from the underlying device in one transfer on a sequential
+   read that is not cached */
+#ifndef STORAGE_READ_AHEAD_SIZE
+#define STORAGE_READ_AHEAD_SIZE (4 * 1024)
+#endif
+
+/* number of small, non sequential reads (slot headers) kept */
+#ifndef STORAGE_HEADER_CACHE_ENTRIES
+#define STORAGE_HEADER_CACHE_ENTRIES 4
+#endif
+
+/* size of each header cache entry */
+#ifndef STORAGE_HEADER_CACHE_BLOCK
+#define STORAGE_HEADER_CACHE_BLOCK 512
+#endif
+
+/**
+ * Read caching decorator for the firmware storage block device
+ * @detail Small reads that continue where the previous read ended are served
+ *         from a read-ahead window that is filled with one large multi-block
+ *         transfer. Other small reads, such as the slot headers read during
+ *         the slot scan, are kept in a few separate entries so they survive
+ *         the streaming of a slot body. Reads at least as large as the
+ *         window go straight to the underlying device. Programs and erases
+ *         are passed through and drop any cached data they overlap.
+ */
+class ReadAheadBlockDevice : public BlockDevice {
+public:
+    /**
+     * @param bd  Underlying block device, must outlive the decorator.
+     */
+    ReadAheadBlockDevice(BlockDevice *bd);
+
+    virtual int init();
+    virtual int deinit();
+    virtual int sync();
+    virtual int read(void *buffer, bd_addr_t addr, bd_size_t size);
+    virtual int program(const void *buffer, bd_addr_t addr, bd_size_t size);
+    virtual int erase(bd_addr_t addr, bd_size_t size);
+    virtual bd_size_t get_read_size() const;
+    virtual bd_size_t get_program_size() const;
+    virtual bd_size_t get_erase_size() const;
+    virtual bd_size_t size() const;
+
+    /**
+     * @return number of reads, or parts of reads, served from the cache.
+     */
+    uint32_t get_hits() const;
+
+    /**
+     * @return number of transfers from the underlying device.
+     */
+    uint32_t get_misses() const;
+
+private:
+    struct header_entry_t {
+        bd_addr_t addr;
+        uint32_t  used;
+        bool      valid;
+        uint8_t   data[STORAGE_HEADER_CACHE_BLOCK];
+    };
+
+    int header_read(uint8_t *buffer, bd_addr_t addr, bd_size_t size);
+    void invalidate(bd_addr_t addr, bd_size_t size);
+
+    BlockDevice *_bd;
+    bd_size_t _window_size;
+    bd_size_t _header_block;
+    bd_addr_t _window_addr;
+    bd_size_t _window_valid;
+    bd_addr_t _next_addr;
+    uint32_t _clock;
+    uint32_t _hits;
+    uint32_t _misses;
+    uint8_t _window[STORAGE_READ_AHEAD_SIZE];
+    header_entry_t _headers[STORAGE_HEADER_CACHE_ENTRIES];
+};
+
+#endif // READ_AHEAD_BLOCK_DEVICE_H
@@ -0,0 +1,273 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef __STDC_FORMAT_MACROS
+#define __STDC_FORMAT_MACROS
+#endif
+
+#include "transfer_sizing.h"
+#include "bootloader_common.h"
+
+#include <inttypes.h>
+
+#if defined(TRANSFER_CALIBRATION) && (TRANSFER_CALIBRATION == 1)
+#if !defined(NVSTORE_ENABLED) || !NVSTORE_ENABLED
+#error "TRANSFER_CALIBRATION requires NVStore"
+#endif
+
+#include "nvstore_record.h"
+
+/* smallest transfer size timed */
+#define TRANSFER_CALIBRATION_MIN_SIZE 512
+
+/* transfer sizes picked by calibration, valid while the geometry they were
+   timed with is unchanged */
+typedef struct {
+    uint32_t storage_read_size;
+    uint32_t page_size;
+    uint32_t flash_mapped;
+    uint32_t buffer_size;
+    uint32_t sizes[TRANSFER_PHASES];
+} transfer_sizing_record_t;
+#endif
+
+/* read size of the storage device, 1 if any size can be read */
+static uint32_t storageReadSize = 1;
+
+static uint32_t transferSizes[TRANSFER_PHASES] = {
+    BUFFER_SIZE,
+    BUFFER_SIZE,
+    BUFFER_SIZE
+};
+
+/* every transfer size of a phase is a multiple of this */
+static uint32_t transferUnit[TRANSFER_PHASES];
+
+/* largest transfer size of a phase */
+static const uint32_t transferLimit[TRANSFER_PHASES] = {
+    BUFFER_SIZE,
+    BUFFER_SIZE,
+    BUFFER_SIZE
+};
+
+static uint32_t leastCommonMultiple(uint32_t a, uint32_t b)
+{
+    uint32_t x = a;
+    uint32_t y = b;
+
+    while (y != 0) {
+        uint32_t remainder = x % y;
+        x = y;
+        y = remainder;
+    }
+
+    return a / x * b;
+}
+
+/* use the largest multiple of the unit that fits the buffer */
+static void geometrySizes(void)
+{
+    for (uint32_t phase = 0; phase < TRANSFER_PHASES; phase++) {
+        transferSizes[phase] = transferLimit[phase] /
+                               transferUnit[phase] * transferUnit[phase];
+    }
+}
+
+void transferSizingStorageGeometry(uint32_t readSize)
+{
+    storageReadSize = (readSize > 0) ? readSize : 1;
+}
+
+#if defined(TRANSFER_CALIBRATION) && (TRANSFER_CALIBRATION == 1)
+/**
+ * Time transfers of one size
+ * @return microseconds per KiB, 0 if the transfers could not be made.
+ */
+static uint32_t timeTransferSize(transfer_timer_t timer,
+                                 transfer_phase_t phase,
+                                 uint32_t size)
+{
+    uint32_t count = TRANSFER_CALIBRATION_SIZE / size;
+    uint32_t elapsed = 0;
+
+    if (count == 0) {
+        count = 1;
+    }
+
+    if (!timer(phase, size, count, &elapsed)) {
+        return 0;
+    }
+
+    /* never report a transfer as free */
+    uint32_t rate = (uint32_t)(((uint64_t) elapsed * 1024) / ((uint64_t) size * count));
+
+    return (rate > 0) ? rate : 1;
+}
+
+/**
+ * Time the candidate sizes of a phase and keep the fastest
+ * @detail The size picked from the geometry is timed first and a smaller
+ *         size has to be at least 1/16 faster to replace it, so timing
+ *         noise does not change the size from boot to boot.
+ * @return false if the transfers could not be made.
+ */
+static bool calibratePhase(transfer_timer_t timer, transfer_phase_t phase)
+{
+    uint32_t bestSize = transferSizes[phase];
+    uint32_t bestRate = timeTransferSize(timer, phase, bestSize);
+
+    if (bestRate == 0) {
+        return false;
+    }
+
+    tr_debug("Transfer %d: %" PRIu32 " bytes at %" PRIu32 " us/KiB",
+             phase, bestSize, bestRate);
+
+    uint32_t unit = transferUnit[phase];
+    uint32_t size = (TRANSFER_CALIBRATION_MIN_SIZE + unit - 1) / unit * unit;
+
+    for ( ; size < transferSizes[phase]; size *= 2) {
+        uint32_t rate = timeTransferSize(timer, phase, size);
+
+        if (rate == 0) {
+            return false;
+        }
+
+        tr_debug("Transfer %d: %" PRIu32 " bytes at %" PRIu32 " us/KiB",
+                 phase, size, rate);
+
+        if (rate < bestRate - bestRate / 16) {
+            bestSize = size;
+            bestRate = rate;
+        }
+    }
+
+    transferSizes[phase] = bestSize;
+
+    return true;
+}
+
+/**
+ * Use the sizes of an earlier calibration
+ * @return true if the record was made with the current geometry.
+ */
+static bool loadCalibration(const transfer_sizing_record_t *expected)
+{
+    transfer_sizing_record_t record;
+
+    bool result = nvstoreRecordRead(NVSTORE_KEY_TRANSFER_SIZING,
+                                    &record,
+                                    sizeof(record)) &&
+                  (record.storage_read_size == expected->storage_read_size) &&
+                  (record.page_size == expected->page_size) &&
+                  (record.flash_mapped == expected->flash_mapped) &&
+                  (record.buffer_size == expected->buffer_size);
+
+    for (uint32_t phase = 0; result && (phase < TRANSFER_PHASES); phase++) {
+        result = (record.sizes[phase] > 0) &&
+                 (record.sizes[phase] <= transferLimit[phase]) &&
+                 (record.sizes[phase] % transferUnit[phase] == 0);
+    }
+
+    if (result) {
+        for (uint32_t phase = 0; phase < TRANSFER_PHASES; phase++) {
+            transferSizes[phase] = record.sizes[phase];
+        }
+    }
+
+    return result;
+}
+
+static void calibrate(uint32_t pageSize,
+                      bool flashMapped,
+                      transfer_timer_t timer)
+{
+    transfer_sizing_record_t record;
+    record.storage_read_size = storageReadSize;
+    record.page_size         = pageSize;
+    record.flash_mapped      = flashMapped;
+    record.buffer_size       = BUFFER_SIZE;
+
+    if (loadCalibration(&record)) {
+        return;
+    }
+
+    tr_info("Calibrating transfer sizes");
+
+    bool result = calibratePhase(timer, TRANSFER_STORAGE_READ) &&
+                  calibratePhase(timer, TRANSFER_PROGRAM);
+
+    /* nothing is copied from memory mapped flash, the largest size has the
+       least overhead */
+    if (result && !flashMapped) {
+        result = calibratePhase(timer, TRANSFER_FLASH_READ);
+    }
+
+    /* a failed calibration keeps the sizes from the geometry until the
+       geometry changes, instead of timing again on every boot */
+    if (!result) {
+        tr_warning("Transfer size calibration failed, using the geometry sizes");
+        geometrySizes();
+    }
+
+    for (uint32_t phase = 0; phase < TRANSFER_PHASES; phase++) {
+        record.sizes[phase] = transferSizes[phase];
+    }
+
+    nvstoreRecordWrite(NVSTORE_KEY_TRANSFER_SIZING,
+                       &record,
+                       sizeof(record));
+}
+#endif
+
+void transferSizingInit(uint32_t pageSize,
+                        bool flashMapped,
+                        transfer_timer_t timer)
+{
+    transferUnit[TRANSFER_STORAGE_READ] = storageReadSize;
+    transferUnit[TRANSFER_FLASH_READ] = 1;
+    transferUnit[TRANSFER_PROGRAM] = leastCommonMultiple(pageSize, storageReadSize);
+
+    /* a unit larger than the buffer cannot be kept, the storage driver
+       then has to handle the partial reads */
+    if (transferUnit[TRANSFER_STORAGE_READ] > transferLimit[TRANSFER_STORAGE_READ]) {
+        transferUnit[TRANSFER_STORAGE_READ] = 1;
+    }
+
+    if (transferUnit[TRANSFER_PROGRAM] > transferLimit[TRANSFER_PROGRAM]) {
+        transferUnit[TRANSFER_PROGRAM] = pageSize;
+    }
+
+    geometrySizes();
+
+#if defined(TRANSFER_CALIBRATION) && (TRANSFER_CALIBRATION == 1)
+    calibrate(pageSize, flashMapped, timer);
+#else
+    (void) flashMapped;
+    (void) timer;
+#endif
+
+    tr_debug("Transfer sizes: storage read %" PRIu32 ", flash read %" PRIu32
+             ", program %" PRIu32, transferSizes[TRANSFER_STORAGE_READ],
+             transferSizes[TRANSFER_FLASH_READ], transferSizes[TRANSFER_PROGRAM]);
+}
+
+uint32_t transferSize(transfer_phase_t phase)
+{
+    return transferSizes[phase];
+}
@@ -0,0 +1,93 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef TRANSFER_SIZING_H
+#define TRANSFER_SIZING_H
+
+/* Transfer sizes used by each phase of an update.
+
+   The buffer is always BUFFER_SIZE bytes, but the phases that stream
+   through it use the transfer size their device handles best: the storage
+   read size when hashing a stored firmware, the internal flash read size
+   when hashing the active firmware and the amount of stored firmware read
+   and programmed per pass when installing it.
+
+   By default the sizes follow from the storage and flash geometry. With
+   TRANSFER_CALIBRATION a few sizes are timed on the first boot and the
+   fastest are kept in NVStore until the geometry changes.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* time a few transfer sizes on the first boot and keep the fastest */
+#ifndef TRANSFER_CALIBRATION
+#define TRANSFER_CALIBRATION               0
+#endif
+
+/* number of bytes transferred when timing each size */
+#ifndef TRANSFER_CALIBRATION_SIZE
+#define TRANSFER_CALIBRATION_SIZE          (32 * 1024)
+#endif
+
+typedef enum {
+    TRANSFER_STORAGE_READ,  /* storage read per hash update */
+    TRANSFER_FLASH_READ,    /* internal flash read per hash update */
+    TRANSFER_PROGRAM,       /* storage read and program per install pass,
+                               calibrated by its storage reads */
+    TRANSFER_PHASES
+} transfer_phase_t;
+
+/**
+ * Time a number of transfers of one size
+ * @param  phase    Phase the transfers belong to.
+ * @param  size     Size of each transfer, at most BUFFER_SIZE.
+ * @param  count    Number of transfers.
+ * @param  elapsed  Time taken in microseconds.
+ * @return false if the transfers could not be made.
+ */
+typedef bool (*transfer_timer_t)(transfer_phase_t phase,
+                                 uint32_t size,
+                                 uint32_t count,
+                                 uint32_t *elapsed);
+
+/**
+ * Set the read size of the firmware storage device
+ * @detail Storage reads are then a multiple of this size. Without it any
+ *         size is assumed to be readable.
+ * @param  readSize  Read size reported by the storage device.
+ */
+void transferSizingStorageGeometry(uint32_t readSize);
+
+/**
+ * Pick the transfer size of each phase
+ * @param  pageSize     Internal flash page size.
+ * @param  flashMapped  Whether the internal flash is read through its
+ *                      memory map.
+ * @param  timer        Timing function used by TRANSFER_CALIBRATION.
+ */
+void transferSizingInit(uint32_t pageSize,
+                        bool flashMapped,
+                        transfer_timer_t timer);
+
+/**
+ * @return transfer size of a phase in bytes.
+ */
+uint32_t transferSize(transfer_phase_t phase);
+
+#endif // TRANSFER_SIZING_H
@@ -0,0 +1,279 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#include "ucp_request.h"
+#include "bootloader_common.h"
+#include "boot_timing.h"
+
+#include "cmsis.h"
+
+#include <stddef.h>
+
+/* request handed to the PAAL */
+static ucp_request_t *ucpActive = NULL;
+
+/* requests waiting for the PAAL */
+static ucp_request_t *ucpQueueHead = NULL;
+static ucp_request_t *ucpQueueTail = NULL;
+
+/* most recent event reported by the PAAL */
+static volatile uint32_t ucpEvent = CLEAR_EVENT;
+
+/* events that finish each type of request */
+static const uint32_t ucpDoneEvent[] = {
+    ARM_UC_PAAL_EVENT_READ_DONE,
+    ARM_UC_PAAL_EVENT_GET_FIRMWARE_DETAILS_DONE,
+    ARM_UC_PAAL_EVENT_GET_ACTIVE_FIRMWARE_DETAILS_DONE,
+    ARM_UC_PAAL_EVENT_PREPARE_DONE,
+    ARM_UC_PAAL_EVENT_WRITE_DONE,
+    ARM_UC_PAAL_EVENT_FINALIZE_DONE
+};
+
+static const uint32_t ucpErrorEvent[] = {
+    ARM_UC_PAAL_EVENT_READ_ERROR,
+    ARM_UC_PAAL_EVENT_GET_FIRMWARE_DETAILS_ERROR,
+    ARM_UC_PAAL_EVENT_GET_ACTIVE_FIRMWARE_DETAILS_ERROR,
+    ARM_UC_PAAL_EVENT_PREPARE_ERROR,
+    ARM_UC_PAAL_EVENT_WRITE_ERROR,
+    ARM_UC_PAAL_EVENT_FINALIZE_ERROR
+};
+
+static void ucpRequestInit(ucp_request_t *request,
+                           ucp_request_type_t type,
+                           uint32_t location,
+                           uint32_t offset,
+                           arm_uc_buffer_t *buffer,
+                           arm_uc_firmware_details_t *details)
+{
+    request->type = type;
+    request->state = UCP_REQUEST_IDLE;
+    request->location = location;
+    request->offset = offset;
+    request->buffer = buffer;
+    request->details = details;
+    request->event = CLEAR_EVENT;
+    request->callback = NULL;
+    request->context = NULL;
+    request->next = NULL;
+}
+
+void ucpRequestRead(ucp_request_t *request,
+                    uint32_t location,
+                    uint32_t offset,
+                    arm_uc_buffer_t *buffer)
+{
+    ucpRequestInit(request, UCP_REQUEST_READ, location, offset, buffer, NULL);
+}
+
+void ucpRequestFirmwareDetails(ucp_request_t *request,
+                               uint32_t location,
+                               arm_uc_firmware_details_t *details)
+{
+    ucpRequestInit(request, UCP_REQUEST_GET_FIRMWARE_DETAILS,
+                   location, 0, NULL, details);
+}
+
+void ucpRequestActiveFirmwareDetails(ucp_request_t *request,
+                                     arm_uc_firmware_details_t *details)
+{
+    ucpRequestInit(request, UCP_REQUEST_GET_ACTIVE_FIRMWARE_DETAILS,
+                   0, 0, NULL, details);
+}
+
+void ucpRequestPrepare(ucp_request_t *request,
+                       uint32_t location,
+                       arm_uc_firmware_details_t *details,
+                       arm_uc_buffer_t *buffer)
+{
+    ucpRequestInit(request, UCP_REQUEST_PREPARE, location, 0, buffer, details);
+}
+
+void ucpRequestWrite(ucp_request_t *request,
+                     uint32_t location,
+                     uint32_t offset,
+                     arm_uc_buffer_t *buffer)
+{
+    ucpRequestInit(request, UCP_REQUEST_WRITE, location, offset, buffer, NULL);
+}
+
+void ucpRequestFinalize(ucp_request_t *request,
+                        uint32_t location)
+{
+    ucpRequestInit(request, UCP_REQUEST_FINALIZE, location, 0, NULL, NULL);
+}
+
+/**
+ * Hand a request to the PAAL
+ * @return true if the call was accepted and an event will follow.
+ */
+static bool ucpStart(ucp_request_t *request)
+{
+    arm_uc_error_t status = { ERR_INVALID_PARAMETER };
+
+    switch (request->type) {
+        case UCP_REQUEST_READ:
+            status = ARM_UCP_Read(request->location,
+                                  request->offset,
+                                  request->buffer);
+            break;
+        case UCP_REQUEST_GET_FIRMWARE_DETAILS:
+            status = ARM_UCP_GetFirmwareDetails(request->location,
+                                                request->details);
+            break;
+        case UCP_REQUEST_GET_ACTIVE_FIRMWARE_DETAILS:
+            status = ARM_UCP_GetActiveFirmwareDetails(request->details);
+            break;
+        case UCP_REQUEST_PREPARE:
+            status = ARM_UCP_Prepare(request->location,
+                                     request->details,
+                                     request->buffer);
+            break;
+        case UCP_REQUEST_WRITE:
+            status = ARM_UCP_Write(request->location,
+                                   request->offset,
+                                   request->buffer);
+            break;
+        case UCP_REQUEST_FINALIZE:
+            status = ARM_UCP_Finalize(request->location);
+            break;
+        default:
+            break;
+    }
+
+    return (status.error == ERR_NONE);
+}
+
+/**
+ * Mark a request as finished and run its callback
+ */
+static void ucpFinish(ucp_request_t *request, bool success)
+{
+    request->state = success ? UCP_REQUEST_DONE : UCP_REQUEST_FAILED;
+
+    if (success && (request->type == UCP_REQUEST_READ)) {
+        bootTimingStorageRead(request->buffer->size);
+    }
+
+    if (request->callback) {
+        request->callback(request);
+    }
+}
+
+void ucpPoll(void)
+{
+    /* retire the outstanding request once its event has arrived */
+    if (ucpActive && (ucpEvent != CLEAR_EVENT)) {
+        ucp_request_t *request = ucpActive;
+        uint32_t event = ucpEvent;
+
+        ucpEvent = CLEAR_EVENT;
+
+        if ((event == ucpDoneEvent[request->type]) ||
+                (event == ucpErrorEvent[request->type])) {
+            ucpActive = NULL;
+            request->event = event;
+
+            ucpFinish(request, (event == ucpDoneEvent[request->type]));
+        } else {
+            tr_debug("Ignoring event %" PRIx32 " for request type %d",
+                     event, request->type);
+        }
+    }
+
+    /* start the next request, failing the ones the PAAL rejects */
+    while (!ucpActive && ucpQueueHead) {
+        ucp_request_t *request = ucpQueueHead;
+
+        ucpQueueHead = request->next;
+
+        if (ucpQueueHead == NULL) {
+            ucpQueueTail = NULL;
+        }
+
+        request->next = NULL;
+        request->state = UCP_REQUEST_ACTIVE;
+
+        ucpEvent = CLEAR_EVENT;
+        ucpActive = request;
+
+        if (!ucpStart(request)) {
+            ucpActive = NULL;
+
+            ucpFinish(request, false);
+        }
+    }
+}
+
+bool ucpSubmit(ucp_request_t *request)
+{
+    bool result = (request != NULL) &&
+                  (request->state != UCP_REQUEST_QUEUED) &&
+                  (request->state != UCP_REQUEST_ACTIVE);
+
+    if (result) {
+        request->state = UCP_REQUEST_QUEUED;
+        request->event = CLEAR_EVENT;
+        request->next = NULL;
+
+        if (ucpQueueTail) {
+            ucpQueueTail->next = request;
+        } else {
+            ucpQueueHead = request;
+        }
+
+        ucpQueueTail = request;
+
+        /* start it straight away if nothing else is outstanding */
+        ucpPoll();
+    }
+
+    return result;
+}
+
+bool ucpWait(ucp_request_t *request)
+{
+    bool result = false;
+
+    if (request) {
+        ucpPoll();
+
+        while ((request->state == UCP_REQUEST_QUEUED) ||
+                (request->state == UCP_REQUEST_ACTIVE)) {
+            /* sleep until the PAAL reports an event */
+            while (ucpActive && (ucpEvent == CLEAR_EVENT)) {
+                __WFI();
+            }
+
+            ucpPoll();
+        }
+
+        result = (request->state == UCP_REQUEST_DONE);
+    }
+
+    return result;
+}
+
+bool ucpRun(ucp_request_t *request)
+{
+    return ucpSubmit(request) && ucpWait(request);
+}
+
+void ucpRequestEvent(uint32_t event)
+{
+    ucpEvent = event;
+}
@@ -0,0 +1,161 @@
+// ----------------------------------------------------------------------------
+// Copyright 2018 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef UCP_REQUEST_H
+#define UCP_REQUEST_H
+
+/* Completion based access to the UCP storage API.
+
+   Every storage operation is described by a request. Requests are queued
+   with ucpSubmit() and handed to the PAAL one at a time, in order, because
+   the PAAL reports completions through a single event callback without
+   saying which call they belong to. Each event is matched against the
+   request that is in flight, so a completion is never mistaken for the
+   result of another request, and events that do not belong to the request
+   type are ignored.
+
+   Completions are retired by ucpPoll(), which also starts the next queued
+   request. ucpWait() polls and sleeps until a given request has finished.
+   A request callback, when set, runs from ucpPoll() in thread context and
+   may submit further requests.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "update-client-paal/arm_uc_paal_update.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    UCP_REQUEST_READ,
+    UCP_REQUEST_GET_FIRMWARE_DETAILS,
+    UCP_REQUEST_GET_ACTIVE_FIRMWARE_DETAILS,
+    UCP_REQUEST_PREPARE,
+    UCP_REQUEST_WRITE,
+    UCP_REQUEST_FINALIZE
+} ucp_request_type_t;
+
+typedef enum {
+    UCP_REQUEST_IDLE,
+    UCP_REQUEST_QUEUED,
+    UCP_REQUEST_ACTIVE,
+    UCP_REQUEST_DONE,
+    UCP_REQUEST_FAILED
+} ucp_request_state_t;
+
+typedef struct ucp_request ucp_request_t;
+
+typedef void (*ucp_request_callback_t)(ucp_request_t *request);
+
+struct ucp_request {
+    ucp_request_type_t          type;
+    volatile ucp_request_state_t state;
+    uint32_t                    location;
+    uint32_t                    offset;
+    arm_uc_buffer_t            *buffer;
+    arm_uc_firmware_details_t  *details;
+    uint32_t                    event;
+    ucp_request_callback_t      callback;
+    void                       *context;
+    ucp_request_t              *next;
+};
+
+/**
+ * Set up a request to read from a firmware location
+ * @detail The PAAL fills buffer->ptr and sets buffer->size.
+ */
+void ucpRequestRead(ucp_request_t *request,
+                    uint32_t location,
+                    uint32_t offset,
+                    arm_uc_buffer_t *buffer);
+
+/**
+ * Set up a request to read the header of a firmware location
+ */
+void ucpRequestFirmwareDetails(ucp_request_t *request,
+                               uint32_t location,
+                               arm_uc_firmware_details_t *details);
+
+/**
+ * Set up a request to read the header of the active firmware
+ */
+void ucpRequestActiveFirmwareDetails(ucp_request_t *request,
+                                     arm_uc_firmware_details_t *details);
+
+/**
+ * Set up a request to prepare a firmware location for writing
+ */
+void ucpRequestPrepare(ucp_request_t *request,
+                       uint32_t location,
+                       arm_uc_firmware_details_t *details,
+                       arm_uc_buffer_t *buffer);
+
+/**
+ * Set up a request to write to a firmware location
+ */
+void ucpRequestWrite(ucp_request_t *request,
+                     uint32_t location,
+                     uint32_t offset,
+                     arm_uc_buffer_t *buffer);
+
+/**
+ * Set up a request to finalize a firmware location after writing
+ */
+void ucpRequestFinalize(ucp_request_t *request,
+                        uint32_t location);
+
+/**
+ * Queue a request
+ * @detail The request and the memory it refers to must stay valid until
+ *         it has finished. The request is started straight away if no
+ *         other request is outstanding.
+ * @return false if the request is already outstanding.
+ */
+bool ucpSubmit(ucp_request_t *request);
+
+/**
+ * Retire a completed request and start the next queued one
+ */
+void ucpPoll(void);
+
+/**
+ * Wait until a request has finished
+ * @return true if the request completed successfully.
+ */
+bool ucpWait(ucp_request_t *request);
+
+/**
+ * Submit a request and wait until it has finished
+ * @return true if the request completed successfully.
+ */
+bool ucpRun(ucp_request_t *request);
+
+/**
+ * Pass an event from the UCP callback to the outstanding request
+ * @detail Safe to call from interrupt context.
+ */
+void ucpRequestEvent(uint32_t event);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // UCP_REQUEST_H
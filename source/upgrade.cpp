@@ -25,6 +25,10 @@
 #include "update-client-paal/arm_uc_paal_update.h"
 #include "active_application.h"
 #include "bootloader_common.h"
+#include "boot_phase.h"
+#include "boot_timing.h"
+#include "transfer_sizing.h"
+#include "ucp_request.h"
 
 #include "mbedtls/sha256.h"
 #include "mbed.h"
@@ -39,12 +43,74 @@
 #include "firmware_update_test.h"
 #endif
 
+#if defined(CHUNK_MANIFEST) && (CHUNK_MANIFEST == 1)
+#include "chunk_manifest.h"
+#endif
+
+#if defined(COMPRESSED_IMAGES) && (COMPRESSED_IMAGES == 1)
+#include "compressed_image.h"
+
+/* size of the stack buffer used to hash decompressed data */
+#ifndef COMPRESSED_IMAGE_HASH_BUFFER_SIZE
+#define COMPRESSED_IMAGE_HASH_BUFFER_SIZE  256
+#endif
+#endif
+
 #ifndef MAX_FIRMWARE_LOCATIONS
 #define MAX_FIRMWARE_LOCATIONS             1
 #endif
 
 #define INVALID_IMAGE_INDEX          0xFFFFFFFF
 
+/* Select the update candidate on its header alone and verify it while it is
+   being installed, instead of reading it in full before the install.
+*/
+#ifndef SINGLE_PASS_INSTALL
+#define SINGLE_PASS_INSTALL                0
+#endif
+
+#if SINGLE_PASS_INSTALL && \
+    (!defined(VERIFY_DURING_COPY) || (VERIFY_DURING_COPY == 0))
+#error "SINGLE_PASS_INSTALL requires VERIFY_DURING_COPY"
+#endif
+
+#if defined(REJECTED_SLOT_CACHE) && (REJECTED_SLOT_CACHE == 1)
+#if !defined(NVSTORE_ENABLED) || !NVSTORE_ENABLED
+#error "REJECTED_SLOT_CACHE requires NVStore"
+#endif
+
+#include "nvstore_record.h"
+
+/* one key per firmware location, these must not reach the keys above them */
+#if NVSTORE_KEY_REJECTED_SLOT + MAX_FIRMWARE_LOCATIONS > NVSTORE_KEY_TRANSFER_SIZING
+#error "Rejected slot records overlap NVSTORE_KEY_TRANSFER_SIZING, move NVSTORE_KEY_REJECTED_SLOT or NVSTORE_KEY_TRANSFER_SIZING"
+#endif
+
+#if defined(MBED_CONF_NVSTORE_MAX_KEYS) && \
+    (NVSTORE_KEY_REJECTED_SLOT + MAX_FIRMWARE_LOCATIONS > MBED_CONF_NVSTORE_MAX_KEYS)
+#error "Rejected slot records exceed nvstore.max_keys"
+#endif
+
+/* Count every boot on which a rejected slot is skipped. Each count is an
+   NVStore write, 0 only records the rejection itself.
+*/
+#ifndef REJECTED_SLOT_COUNT_SKIPS
+#define REJECTED_SLOT_COUNT_SKIPS          0
+#endif
+
+/* record of a stored firmware that failed its integrity check, the
+   application can read it to schedule a new download
+*/
+typedef struct {
+    uint64_t version;
+    uint64_t size;
+    uint8_t  hash[SIZEOF_SHA256];
+    uint8_t  campaign[ARM_UC_GUID_SIZE];
+    uint32_t skipped;
+    uint32_t reserved;
+} rejected_slot_record_t;
+#endif
+
 /* SHA256 pointer to buffer in the heap */
 uint64_t *heapVersion = NULL;
 
@@ -52,81 +118,293 @@ uint64_t *heapVersion = NULL;
 uint8_t *bootCounter = NULL;
 
 /**
- * Verify the integrity of stored firmware
- * @detail Read the firmware and compute its hash.
- *         Compare the computed hash with the one given in the header
- *         to verify the firmware integrity
- * @param  headerP
- *             Caller-allocated header structure containing the hash and size
- *             of the firmware.
- * @param  index
- *             Index of firmware to check.
- * @return true if the validation succeeds.
+ * Read the next part of a stored firmware and wait for the read to complete
+ * @param  source  Index of the firmware location.
+ * @param  offset  Offset into the firmware to read from.
+ * @param  size    Total size of the firmware.
+ * @param  buffer  Buffer to read into, buffer->size is set to the number of
+ *                 bytes expected.
+ * @param  mapped  Firmware in memory mapped internal flash, or NULL. The
+ *                 buffer then points straight at the firmware and nothing
+ *                 is read.
+ * @return true if all expected bytes were read.
  */
-bool checkStoredApplication(uint32_t source,
-                            arm_uc_firmware_details_t *details)
+static bool readStoredPart(uint32_t source,
+                           uint32_t offset,
+                           uint32_t size,
+                           arm_uc_buffer_t *buffer,
+                           const uint8_t *mapped)
 {
-    tr_debug("checkStoredApplication");
+    /* set the number of bytes expected */
+    uint32_t expected = (size - offset) > buffer->size_max ?
+                        buffer->size_max : (size - offset);
+
+    buffer->size = expected;
+
+    if (mapped) {
+        /* the buffer is only read from */
+        buffer->ptr = (uint8_t *) &mapped[offset];
+
+        return true;
+    }
+
+    /* fill buffer using UCP and wait for the result */
+    ucp_request_t request;
+    ucpRequestRead(&request, source, offset, buffer);
+
+    return ucpRun(&request) &&
+           (buffer->size == expected);
+}
+
+#if (defined(CHUNK_MANIFEST) && (CHUNK_MANIFEST == 1)) || \
+    (defined(COMPRESSED_IMAGES) && (COMPRESSED_IMAGES == 1))
+/**
+ * Read part of a stored firmware and wait for the read to complete
+ * @return true if all requested bytes were read.
+ */
+static bool readStoredFirmware(uint32_t source,
+                               uint32_t offset,
+                               uint8_t *data,
+                               uint32_t size)
+{
+    arm_uc_buffer_t buffer = {
+        .size_max = size,
+        .size     = 0,
+        .ptr      = data
+    };
+
+    return readStoredPart(source, offset, offset + size, &buffer, NULL);
+}
+#endif
+
+#if defined(CHUNK_MANIFEST) && (CHUNK_MANIFEST == 1)
+/* chunk manifest of the stored firmware being checked */
+static chunk_manifest_t storedManifest;
 
+/**
+ * Load the chunk manifest of a stored firmware
+ * @param  source   Index of the firmware location.
+ * @param  size     Size of the firmware payload.
+ * @param  damaged  Set if the manifest does not match its own root, the
+ *                  payload is then known to be corrupt.
+ * @return the manifest, or NULL if the firmware does not carry a usable one.
+ */
+static const chunk_manifest_t *loadStoredChunkManifest(uint32_t source,
+                                                       uint32_t size,
+                                                       bool *damaged)
+{
+    const chunk_manifest_t *manifest = NULL;
+    uint8_t footer[CHUNK_MANIFEST_FOOTER_SIZE];
+
+    if ((size > CHUNK_MANIFEST_FOOTER_SIZE) &&
+            readStoredFirmware(source,
+                               size - CHUNK_MANIFEST_FOOTER_SIZE,
+                               footer,
+                               CHUNK_MANIFEST_FOOTER_SIZE) &&
+            chunkManifestParse(footer, size, &storedManifest)) {
+        uint32_t digestsSize = storedManifest.chunk_count * SIZEOF_SHA256;
+
+        if (((digestsSize == 0) ||
+                readStoredFirmware(source,
+                                   storedManifest.image_size,
+                                   storedManifest.digest[0],
+                                   digestsSize)) &&
+                readStoredFirmware(source,
+                                   storedManifest.image_size + digestsSize,
+                                   storedManifest.root,
+                                   SIZEOF_SHA256)) {
+            if (chunkManifestCheckRoot(&storedManifest)) {
+                tr_debug("Chunk manifest: %" PRIu32 " chunks of %" PRIu32,
+                         storedManifest.chunk_count, storedManifest.chunk_size);
+
+                manifest = &storedManifest;
+            } else {
+                tr_error("Slot %" PRIu32 " chunk manifest does not match "
+                         "its root", source);
+                *damaged = true;
+            }
+        }
+    }
+
+    return manifest;
+}
+#endif
+
+#if defined(COMPRESSED_IMAGES) && (COMPRESSED_IMAGES == 1)
+/**
+ * Decompress part of a stored compressed image into the hash
+ * @return false if the compressed data is corrupt.
+ */
+static bool hashCompressedSegment(mbedtls_sha256_context *ctx,
+                                  const uint8_t *data,
+                                  uint32_t size)
+{
+    bool result = true;
+    uint8_t output[COMPRESSED_IMAGE_HASH_BUFFER_SIZE];
+    uint32_t length = 0;
+
+    /* continue while there is input or the output buffer was filled */
+    do {
+        length = sizeof(output);
+        result = compressedImageDecode(&compressed_image_stream,
+                                       &data,
+                                       &size,
+                                       output,
+                                       &length);
+
+        mbedtls_sha256_update(ctx, output, length);
+    } while (result && ((size > 0) || (length == sizeof(output))));
+
+    return result;
+}
+#endif
+
+/**
+ * Hash a stored firmware and compare it with its header
+ * @param  mapped  Firmware in memory mapped internal flash, or NULL to read
+ *                 it through the storage driver.
+ * @see    checkStoredApplication()
+ */
+static bool hashStoredFirmware(uint32_t source,
+                               arm_uc_firmware_details_t *details,
+                               bool *mismatch,
+                               const uint8_t *mapped)
+{
     bool result = false;
 
+    /* set when the firmware could not be read, which says nothing about
+       its contents */
+    bool readFailed = (details == NULL);
+
     if (details) {
 #if defined(BOOTLOADER_POWER_CUT_TEST) && (BOOTLOADER_POWER_CUT_TEST == 1)
         power_cut_test_assert_state(POWER_CUT_TEST_STATE_FIRMWARE_VALIDATION);
 #endif
 
-        /* setup UCP buffer for reading firmware */
         arm_uc_buffer_t buffer = {
-            .size_max = BUFFER_SIZE,
+            .size_max = transferSize(TRANSFER_STORAGE_READ),
             .size     = 0,
             .ptr      = buffer_array
         };
 
+#if defined(CHUNK_MANIFEST) && (CHUNK_MANIFEST == 1)
+        /* check each chunk as soon as it is hashed if there is a manifest */
+        bool manifestDamaged = false;
+        const chunk_manifest_t *manifest =
+            loadStoredChunkManifest(source, details->size, &manifestDamaged);
+
+        chunk_check_t chunkCheck;
+        chunkCheckStart(&chunkCheck, manifest);
+#endif
+
+#if defined(COMPRESSED_IMAGES) && (COMPRESSED_IMAGES == 1)
+        /* a compressed image is hashed as it is decompressed */
+        uint8_t header[COMPRESSED_IMAGE_HEADER_SIZE];
+        uint32_t imageSize = 0;
+
+        bool headerRead = (details->size > COMPRESSED_IMAGE_HEADER_SIZE) &&
+                          readStoredFirmware(source, 0, header,
+                                             COMPRESSED_IMAGE_HEADER_SIZE);
+
+        bool compressed = headerRead &&
+                          compressedImageParseHeader(header, &imageSize);
+
+        /* set when the firmware is known to be corrupt before the end */
+        bool corrupt = false;
+
+        if ((details->size > COMPRESSED_IMAGE_HEADER_SIZE) && !headerRead) {
+            readFailed = true;
+            corrupt = true;
+        }
+
+        if (compressed) {
+            tr_debug("Compressed image of %" PRIu32 " bytes", imageSize);
+            compressedImageInit(&compressed_image_stream, imageSize);
+
+            /* the image could never be installed */
+            if (imageSize > MBED_CONF_APP_MAX_APPLICATION_SIZE) {
+                tr_error("Slot %" PRIu32 " uncompressed size too large %"
+                         PRIu32, source, imageSize);
+                corrupt = true;
+            }
+        }
+#else
+        /* set when the firmware is known to be corrupt before the end */
+        bool corrupt = false;
+#endif
+
+#if defined(CHUNK_MANIFEST) && (CHUNK_MANIFEST == 1)
+        if (manifestDamaged) {
+            corrupt = true;
+        }
+#endif
+
         /* initialize hashing facility */
         mbedtls_sha256_context mbedtls_ctx;
         mbedtls_sha256_init(&mbedtls_ctx);
         mbedtls_sha256_starts(&mbedtls_ctx, 0);
 
+        uint32_t startTime = us_ticker_read();
+
         /* read full firmware using PAL Update API */
         uint32_t offset = 0;
-        while (offset < details->size) {
-            /* clear most recent UCP event */
-            event_callback = CLEAR_EVENT;
-
-            /* set the number of bytes expected */
-            buffer.size = (details->size - offset) > buffer.size_max ?
-                          buffer.size_max : (details->size - offset);
-
-            /* fill buffer using UCP */
-            arm_uc_error_t ucp_status = ARM_UCP_Read(source,
-                                                     offset,
-                                                     &buffer);
-
-            /* wait for event if the call is accepted */
-            if (ucp_status.error == ERR_NONE) {
-                while (event_callback == CLEAR_EVENT) {
-                    __WFI();
-                }
-            }
 
+        while ((offset < details->size) && !corrupt) {
             /* check status and actual read size */
-            if ((event_callback == ARM_UC_PAAL_EVENT_READ_DONE) &&
-                    (buffer.size > 0)) {
-                /* update hash */
-                mbedtls_sha256_update(&mbedtls_ctx, buffer.ptr, buffer.size);
-
-                offset += buffer.size;
-            } else {
+            if (!readStoredPart(source, offset, details->size, &buffer, mapped) ||
+                    (buffer.size == 0)) {
                 tr_trace("\r\n");
-                tr_debug("ARM_UCP_Read returned 0 bytes");
+                tr_debug("ARM_UCP_Read returned %" PRIu32 " bytes at %" PRIu32,
+                         buffer.size, offset);
+                readFailed = true;
+                corrupt = true;
                 break;
             }
 
+            offset += buffer.size;
+
+            /* update hash */
+#if defined(COMPRESSED_IMAGES) && (COMPRESSED_IMAGES == 1)
+            if (compressed) {
+                /* the header is not part of the compressed data */
+                uint32_t skip = (offset == buffer.size) ?
+                                COMPRESSED_IMAGE_HEADER_SIZE : 0;
+
+                if (!hashCompressedSegment(&mbedtls_ctx,
+                                           &buffer.ptr[skip],
+                                           buffer.size - skip)) {
+                    tr_trace("\r\n");
+                    tr_error("Slot %" PRIu32 " compressed data is corrupt",
+                             source);
+                    corrupt = true;
+                }
+            } else
+#endif
+            {
+                mbedtls_sha256_update(&mbedtls_ctx, buffer.ptr, buffer.size);
+
+#if defined(CHUNK_MANIFEST) && (CHUNK_MANIFEST == 1)
+                /* a bad chunk rejects the candidate without reading on */
+                if (chunkCheckUpdate(&chunkCheck, buffer.ptr, buffer.size) > 0) {
+                    tr_trace("\r\n");
+                    tr_error("Slot %" PRIu32 " chunk %" PRIu32 " (offset 0x%08"
+                             PRIX32 ") failed integrity check", source,
+                             chunkCheck.first_failed,
+                             chunkCheck.first_failed * manifest->chunk_size);
+                    corrupt = true;
+                }
+#endif
+            }
+
 #if defined(SHOW_PROGRESS_BAR) && SHOW_PROGRESS_BAR == 1
             printProgress(offset, details->size);
 #endif
         }
 
+        tr_debug("Hashed %" PRIu32 " bytes in %" PRIu32 " ms",
+                 offset, (us_ticker_read() - startTime) / 1000);
+        bootTimingSlotHash(source, us_ticker_read() - startTime);
+
         /* make sure buffer is large enough to contain both the SHA and HMAC */
 #if BUFFER_SIZE < (2*SIZEOF_SHA256)
 #error "BUFFER_SIZE too small to contain SHA and HMAC"
@@ -144,6 +422,10 @@ bool checkStoredApplication(uint32_t source,
         mbedtls_sha256_free(&mbedtls_ctx);
         hash_buffer.size = SIZEOF_SHA256;
 
+#if defined(CHUNK_MANIFEST) && (CHUNK_MANIFEST == 1)
+        chunkCheckFree(&chunkCheck);
+#endif
+
         /* compare calculated hash with hash from header */
         int diff = memcmp(details->hash,
                           hash_buffer.ptr,
@@ -155,9 +437,511 @@ bool checkStoredApplication(uint32_t source,
             printSHA256(details->hash);
             printSHA256(hash_buffer.ptr);
         }
+
+#if defined(COMPRESSED_IMAGES) && (COMPRESSED_IMAGES == 1)
+        /* the compressed data must describe exactly the image */
+        if (compressed && !compressedImageDone(&compressed_image_stream)) {
+            result = false;
+        }
+#endif
+
+        if (corrupt || readFailed) {
+            result = false;
+        }
+    }
+
+    if (mismatch) {
+        *mismatch = !result && !readFailed;
+    }
+
+    return result;
+}
+
+/**
+ * Verify the integrity of stored firmware
+ * @detail Read the firmware and compute its hash.
+ *         Compare the computed hash with the one given in the header
+ *         to verify the firmware integrity
+ * @param  headerP
+ *             Caller-allocated header structure containing the hash and size
+ *             of the firmware.
+ * @param  index
+ *             Index of firmware to check.
+ * @param  mismatch
+ *             Optional. Set to true if the firmware was read and does not
+ *             match the header, false if the check failed for another
+ *             reason, such as a storage read error.
+ * @return true if the validation succeeds.
+ */
+bool checkStoredApplication(uint32_t source,
+                            arm_uc_firmware_details_t *details,
+                            bool *mismatch)
+{
+    tr_debug("checkStoredApplication");
+
+    const uint8_t *mapped = NULL;
+
+#if defined(MAPPED_STORAGE) && (MAPPED_STORAGE == 1)
+    /* hash straight from internal flash if the slot is memory mapped */
+    if (details) {
+        mapped = mappedStoredFirmware(source, details->size);
+    }
+#endif
+
+    bool result = hashStoredFirmware(source, details, mismatch, mapped);
+
+#if defined(MAPPED_STORAGE) && (MAPPED_STORAGE == 1)
+    /* only a match proves that the slot is where the layout puts it, a
+       mismatch is checked again through the storage driver */
+    if (mapped && result) {
+        mappedStoredFirmwareConfirm(source);
+    } else if (mapped) {
+        tr_warning("Slot %" PRIu32 " does not match at 0x%08" PRIX32
+                   ", checking it through the storage driver",
+                   source, (uint32_t)(uintptr_t) mapped);
+
+        result = hashStoredFirmware(source, details, mismatch, NULL);
+    }
+#endif
+
+    return result;
+}
+
+#if defined(REJECTED_SLOT_CACHE) && (REJECTED_SLOT_CACHE == 1)
+/**
+ * Check if a stored firmware was rejected on a previous boot
+ * @detail The record must match the version, size, hash and campaign in the
+ *         header, so a slot is checked again as soon as a new image is
+ *         stored. A record that no longer matches is removed.
+ * @param  index    Index of the firmware location.
+ * @param  details  Header of the stored firmware.
+ * @return true if the integrity check can be skipped.
+ */
+static bool rejectedSlotCacheHit(uint32_t index,
+                                 const arm_uc_firmware_details_t *details)
+{
+    rejected_slot_record_t record;
+
+    bool exists = nvstoreRecordRead(NVSTORE_KEY_REJECTED_SLOT + index,
+                                    &record,
+                                    sizeof(record));
+
+    bool hit = exists &&
+               (record.version == details->version) &&
+               (record.size == details->size) &&
+               (memcmp(record.hash, details->hash, SIZEOF_SHA256) == 0) &&
+               (memcmp(record.campaign, details->campaign,
+                       ARM_UC_GUID_SIZE) == 0);
+
+    if (exists && !hit) {
+        /* the slot holds a new image, drop the stale record */
+        nvstoreRecordRemove(NVSTORE_KEY_REJECTED_SLOT + index);
+    }
+
+#if REJECTED_SLOT_COUNT_SKIPS
+    if (hit && (record.skipped < UINT32_MAX)) {
+        record.skipped++;
+
+        if (!nvstoreRecordWrite(NVSTORE_KEY_REJECTED_SLOT + index,
+                                &record,
+                                sizeof(record))) {
+            tr_warning("Failed to count rejected slot");
+        }
+    }
+#endif
+
+    return hit;
+}
+
+/**
+ * Record that a stored firmware failed its integrity check
+ * @param  index    Index of the firmware location.
+ * @param  details  Header of the stored firmware.
+ */
+static void rejectedSlotCacheStore(uint32_t index,
+                                   const arm_uc_firmware_details_t *details)
+{
+    rejected_slot_record_t record;
+    memset(&record, 0, sizeof(record));
+
+    record.version = details->version;
+    record.size = details->size;
+    memcpy(record.hash, details->hash, SIZEOF_SHA256);
+    memcpy(record.campaign, details->campaign, ARM_UC_GUID_SIZE);
+
+    if (!nvstoreRecordWrite(NVSTORE_KEY_REJECTED_SLOT + index,
+                            &record,
+                            sizeof(record))) {
+        tr_warning("Failed to store rejected slot record");
+    }
+}
+#endif
+
+/* Headers of the firmware candidates found in storage */
+typedef struct {
+    uint32_t index;
+    arm_uc_firmware_details_t details;
+} stored_candidate_t;
+
+static stored_candidate_t storedCandidates[MAX_FIRMWARE_LOCATIONS];
+
+#if defined(DELTA_UPDATE) && (DELTA_UPDATE == 1)
+/**
+ * Look for a full image to recover with should a delta patch be interrupted
+ * @detail A patch overwrites the active firmware in place. If the install
+ *         is cut short, neither the old nor the new firmware is left in the
+ *         active region, and the device can only boot again by installing
+ *         a full image from another slot.
+ * @param  patchIndex  Index of the firmware location holding the patch.
+ * @return true if another location holds a full image that passes its
+ *         integrity check.
+ */
+static bool deltaFallbackAvailable(uint32_t patchIndex)
+{
+    bool result = false;
+
+    for (uint32_t index = 0;
+            (index < MAX_FIRMWARE_LOCATIONS) && !result; index++) {
+        if (index == patchIndex) {
+            continue;
+        }
+
+        arm_uc_firmware_details_t details;
+        memset(&details, 0, sizeof(arm_uc_firmware_details_t));
+
+        ucp_request_t request;
+        ucpRequestFirmwareDetails(&request, index, &details);
+
+        /* a patch in this slot would need the active firmware as well */
+        bool patch = true;
+        bool mismatch = false;
+
+        result = ucpRun(&request) &&
+                 (details.size > 0) &&
+                 (details.size <= MBED_CONF_APP_MAX_APPLICATION_SIZE) &&
+                 checkStoredDeltaPatch(index, &details, false, &patch) &&
+                 !patch &&
+                 checkStoredApplication(index, &details, &mismatch);
+
+        if (result) {
+            tr_info("Slot %" PRIu32 " holds a full image to recover with",
+                    index);
+        }
+    }
+
+    return result;
+}
+#endif
+
+/**
+ * Collect the headers of all firmware candidates worth installing
+ * @param  activeFirmwareValid
+ *             Whether the active image is usable. If not, any replacement
+ *             will do.
+ * @param  minimumVersion
+ *             The version a candidate must exceed.
+ * @return number of candidates in storedCandidates, ordered by descending
+ *         version. Candidates with equal versions keep their slot order.
+ */
+static uint32_t collectStoredCandidates(bool activeFirmwareValid,
+                                        uint64_t minimumVersion)
+{
+    uint32_t count = 0;
+
+    /* request all headers up front. The PAAL still reads them one at a
+       time, in order, but a PAAL that completes in the background reads
+       the next header while the earlier ones are checked. */
+    ucp_request_t request[MAX_FIRMWARE_LOCATIONS];
+    arm_uc_firmware_details_t slotDetails[MAX_FIRMWARE_LOCATIONS];
+    bool submitted[MAX_FIRMWARE_LOCATIONS];
+
+#if defined(BOOT_TIMING_RECORD) && (BOOT_TIMING_RECORD == 1)
+    /* each header is charged the wait for its read */
+    uint32_t readTime = us_ticker_read();
+#endif
+
+    for (uint32_t index = 0; index < MAX_FIRMWARE_LOCATIONS; index++) {
+        memset(&slotDetails[index], 0, sizeof(arm_uc_firmware_details_t));
+
+        ucpRequestFirmwareDetails(&request[index], index, &slotDetails[index]);
+        submitted[index] = ucpSubmit(&request[index]);
+    }
+
+    for (uint32_t index = 0; index < MAX_FIRMWARE_LOCATIONS; index++) {
+        /* a request that was not accepted is a failed read */
+        bool headerRead = submitted[index] && ucpWait(&request[index]);
+
+#if defined(BOOT_TIMING_RECORD) && (BOOT_TIMING_RECORD == 1)
+        uint32_t now = us_ticker_read();
+        bootTimingSlotHeader(index, now - readTime);
+        readTime = now;
+#endif
+
+        /* Check version and size first */
+        if (headerRead) {
+            arm_uc_firmware_details_t imageDetails = slotDetails[index];
+
+            /* default to use firmware candidate */
+            bool firmwareDifferentFromActive = true;
+
+            /* disable duplicate hash check when running test */
+#if !defined(FIRMWARE_UPDATE_TEST) || (FIRMWARE_UPDATE_TEST == 0)
+
+            /* compare stored firmware with the currently active one */
+            if (heapVersion) {
+                firmwareDifferentFromActive =
+                    (*heapVersion != imageDetails.version);
+            }
+#endif
+
+            /* Only consider firmwares with higher version number than the
+               active image and with a different hash. This prevents rollbacks
+               and hash checks of old images. If the active image is not valid,
+               minimumVersion equals 0.
+            */
+            if ((imageDetails.version > minimumVersion) &&
+                    (imageDetails.size > 0) &&
+                    (firmwareDifferentFromActive || !activeFirmwareValid)) {
+                /* check firmware size fits */
+                if (imageDetails.size <= MBED_CONF_APP_MAX_APPLICATION_SIZE) {
+                    tr_info("Slot %" PRIu32 " firmware candidate", index);
+                    tr_info("Version: %" PRIu64, imageDetails.version);
+
+                    /* insert sorted, newest first */
+                    uint32_t position = count;
+
+                    while ((position > 0) &&
+                            (storedCandidates[position - 1].details.version <
+                             imageDetails.version)) {
+                        storedCandidates[position] =
+                            storedCandidates[position - 1];
+                        position--;
+                    }
+
+                    storedCandidates[position].index = index;
+                    storedCandidates[position].details = imageDetails;
+                    count++;
+                } else {
+                    /* Firmware candidate size too large */
+                    tr_error("Slot %" PRIu32 " firmware size too large %"
+                             PRIu32 " > %" PRIu32, index,
+                             (uint32_t) imageDetails.size,
+                             (uint32_t) MBED_CONF_APP_MAX_APPLICATION_SIZE);
+                }
+            } else {
+                tr_info("Slot %" PRIu32 " firmware is of older date",
+                        index);
+                /* do not print HMAC version
+                printSHA256(imageDetails.hash);
+                */
+                tr_info("Version: %" PRIu64, imageDetails.version);
+            }
+        } else {
+            tr_info("Slot %" PRIu32 " is empty", index);
+        }
     }
 
+    return count;
+}
+
+/**
+ * Search all firmware locations for the candidate with the highest version
+ * @detail All headers are read first. Candidates are then verified newest
+ *         first, and the search stops at the first one that passes, so
+ *         older candidates are not hashed in the common case.
+ * @param  verify
+ *             Validate the body of the candidate before accepting it. When
+ *             false, the newest candidate is selected on its header alone
+ *             and must be verified while it is installed.
+ * @param  activeFirmwareValid
+ *             Whether the active image is usable. If not, any replacement
+ *             will do.
+ * @param  best
+ *             On input, the version a candidate must exceed.
+ *             On output, the details of the selected candidate.
+ * @return index of the selected candidate or INVALID_IMAGE_INDEX.
+ */
+static uint32_t findStoredFirmware(bool verify,
+                                   bool activeFirmwareValid,
+                                   arm_uc_firmware_details_t *best)
+{
+    uint32_t bestIndex = INVALID_IMAGE_INDEX;
+
+    uint32_t count = collectStoredCandidates(activeFirmwareValid,
+                                             best->version);
+
+    for (uint32_t position = 0; position < count; position++) {
+        stored_candidate_t *candidate = &storedCandidates[position];
+
+#if defined(REJECTED_SLOT_CACHE) && (REJECTED_SLOT_CACHE == 1)
+        /* skip candidates that already failed on a previous boot */
+        if (rejectedSlotCacheHit(candidate->index, &candidate->details)) {
+            tr_info("Slot %" PRIu32 " firmware was rejected before",
+                    candidate->index);
+            continue;
+        }
+#endif
+
+        /* Validate candidate firmware body. */
+        bool firmwareValid = true;
+        bool checkFirmware = verify;
+
+#if defined(DELTA_UPDATE) && (DELTA_UPDATE == 1)
+        /* a delta patch must match the active firmware */
+        bool patch = false;
+
+        if (!checkStoredDeltaPatch(candidate->index,
+                                   &candidate->details,
+                                   activeFirmwareValid,
+                                   &patch)) {
+            tr_info("Slot %" PRIu32 " delta patch does not apply to the "
+                    "active firmware", candidate->index);
+            continue;
+        }
+
+        /* a patch is applied in place and destroys the active firmware, so
+           it is only installed with a full image in another slot to
+           recover with, and always checked in full before it is selected,
+           also with SINGLE_PASS_INSTALL */
+        if (patch && !deltaFallbackAvailable(candidate->index)) {
+            tr_error("Slot %" PRIu32 " delta patch refused, no other slot "
+                     "holds a valid full image to recover with",
+                     candidate->index);
+            continue;
+        }
+
+        if (patch) {
+            checkFirmware = true;
+        }
+#endif
+
+#if defined(RESUMABLE_INSTALL) && (RESUMABLE_INSTALL == 1)
+        /* an interrupted install is verified while it is completed */
+        if (checkFirmware &&
+                installJournalMatches(candidate->index, &candidate->details)) {
+            tr_info("Slot %" PRIu32 " install was interrupted, resuming",
+                    candidate->index);
+            checkFirmware = false;
+        }
+#endif
+
+        if (checkFirmware) {
+            tr_info("Slot %" PRIu32 " firmware integrity check:",
+                    candidate->index);
+
+            bool mismatch = false;
+
+            firmwareValid = checkStoredApplication(candidate->index,
+                                                   &candidate->details,
+                                                   &mismatch);
+
+#if defined(REJECTED_SLOT_CACHE) && (REJECTED_SLOT_CACHE == 1)
+            /* a read error may not repeat on the next boot, only a firmware
+               that does not match its header is rejected for good */
+            if (mismatch) {
+                rejectedSlotCacheStore(candidate->index, &candidate->details);
+            }
+#endif
+        }
+
+        if (firmwareValid) {
+            /* Integrity check passed or deferred to install */
+            tr_info("Slot %" PRIu32 " selected", candidate->index);
+            printSHA256(candidate->details.hash);
+            tr_info("Version: %" PRIu64, candidate->details.version);
+
+            /* Update best candidate information */
+            bestIndex = candidate->index;
+            *best = candidate->details;
+            break;
+        } else {
+            /* Integrity check failed */
+            tr_error("Slot %" PRIu32 " firmware integrity check failed",
+                     candidate->index);
+        }
+    }
+
+    return bestIndex;
+}
+
+#if defined(XIP_AB_BOOT) && (XIP_AB_BOOT == 1)
+/* region the application is started from, the other one is the rollback
+   target and receives installs from the firmware storage */
+static uint32_t bootRegion = 0;
+static bool bootRegionValid = false;
+
+/**
+ * Check the firmware in every application region
+ * @detail The region holding the newest valid firmware is selected to boot.
+ * @param  details  Caller-allocated array for the header of every region.
+ * @param  status   Caller-allocated array for the result of every check.
+ */
+static void checkApplicationRegions(arm_uc_firmware_details_t *details,
+                                    int *status)
+{
+    bootRegionValid = false;
+
+    for (uint32_t region = 0; region < APPLICATION_REGION_COUNT; region++) {
+        tr_info("Region %" PRIu32 " firmware integrity check:", region);
+
+        activeRegionSelect(region);
+        status[region] = checkActiveApplication(&details[region]);
+
+        if (status[region] == RESULT_SUCCESS) {
+            tr_info("Region %" PRIu32 " version: %" PRIu64,
+                    region, details[region].version);
+
+            if ((!bootRegionValid) ||
+                    (details[region].version > details[bootRegion].version)) {
+                bootRegion = region;
+                bootRegionValid = true;
+            }
+        } else if (status[region] == RESULT_EMPTY) {
+            tr_info("Region %" PRIu32 " is empty", region);
+        } else {
+            tr_error("Region %" PRIu32 " integrity check failed", region);
+        }
+    }
+
+    activeRegionSelect(bootRegion);
+}
+#endif
+
+/**
+ * Install a stored firmware
+ * @detail With XIP_AB_BOOT the firmware is installed into the region that is
+ *         not booted, which keeps the booted firmware as rollback target.
+ * @param  index     Index of the firmware location.
+ * @param  details   Header of the stored firmware.
+ * @param  mismatch  Optional. Set to true if the stored firmware does not
+ *                   match its header.
+ * @return true if the firmware was installed and is valid.
+ */
+static bool installStoredFirmware(uint32_t index,
+                                  arm_uc_firmware_details_t *details,
+                                  bool *mismatch)
+{
+#if defined(XIP_AB_BOOT) && (XIP_AB_BOOT == 1)
+    uint32_t installRegion = bootRegionValid ?
+                             (bootRegion + 1) % APPLICATION_REGION_COUNT :
+                             bootRegion;
+
+    tr_info("Install into region %" PRIu32, installRegion);
+    activeRegionSelect(installRegion);
+
+    bool result = copyStoredApplication(index, details, mismatch);
+
+    if (result) {
+        bootRegion = installRegion;
+        bootRegionValid = true;
+    }
+
+    activeRegionSelect(bootRegion);
+
     return result;
+#else
+    return copyStoredApplication(index, details, mismatch);
+#endif
 }
 
 /**
@@ -193,9 +977,25 @@ bool upgradeApplicationFromStorage(void)
     /* Step 1. Validate the active application.                              */
     /*************************************************************************/
 
+    bootPhaseEnter(BOOT_PHASE_ACTIVE_CHECK);
+
+#if defined(XIP_AB_BOOT) && (XIP_AB_BOOT == 1)
+    arm_uc_firmware_details_t regionDetails[APPLICATION_REGION_COUNT];
+    int regionStatus[APPLICATION_REGION_COUNT];
+
+    checkApplicationRegions(regionDetails, regionStatus);
+
+    /* the newest valid region is treated as the active firmware */
+    int activeApplicationStatus = regionStatus[bootRegion];
+
+    if (activeApplicationStatus == RESULT_SUCCESS) {
+        imageDetails = regionDetails[bootRegion];
+    }
+#else
     tr_info("Active firmware integrity check:");
 
     int activeApplicationStatus = checkActiveApplication(&imageDetails);
+#endif
 
 #if (defined(BOOTLOADER_POWER_CUT_TEST) && (BOOTLOADER_POWER_CUT_TEST == 1)) ||\
     (defined(FIRMWARE_UPDATE_TEST) && (FIRMWARE_UPDATE_TEST == 1))
@@ -257,6 +1057,23 @@ bool upgradeApplicationFromStorage(void)
     /* active image cannot be run */
     else if (localCounter >= MAX_BOOT_RETRIES) {
         tr_error("Failed to boot active application %d times", MAX_BOOT_RETRIES);
+
+#if defined(XIP_AB_BOOT) && (XIP_AB_BOOT == 1)
+        /* fall back to the firmware in the other region. The failed version
+           stays the one to beat, so it is not installed again. */
+        uint32_t rollbackRegion = (bootRegion + 1) % APPLICATION_REGION_COUNT;
+        bestStoredFirmwareImageDetails.version = imageDetails.version;
+        bootRegionValid = (regionStatus[rollbackRegion] == RESULT_SUCCESS);
+
+        if (bootRegionValid) {
+            tr_info("Rolling back to region %" PRIu32 ", version %" PRIu64,
+                    rollbackRegion, regionDetails[rollbackRegion].version);
+
+            bootRegion = rollbackRegion;
+            activeRegionSelect(bootRegion);
+            activeFirmwareValid = true;
+        }
+#endif
     }
     /* active image failed integrity check */
     else {
@@ -268,92 +1085,11 @@ bool upgradeApplicationFromStorage(void)
     /*         replacement firmware for corrupted active image.              */
     /*************************************************************************/
 
-    for (uint32_t index = 0; index < MAX_FIRMWARE_LOCATIONS; index++) {
-        /* clear most recent UCP event */
-        event_callback = CLEAR_EVENT;
-
-        /* Check version and checksum first */
-        arm_uc_error_t ucp_status = ARM_UCP_GetFirmwareDetails(index,
-                                                               &imageDetails);
-
-        /* wait for event if the call is accepted */
-        if (ucp_status.error == ERR_NONE) {
-            while (event_callback == CLEAR_EVENT) {
-                __WFI();
-            }
-        }
-
-        /* check event */
-        if (event_callback == ARM_UC_PAAL_EVENT_GET_FIRMWARE_DETAILS_DONE) {
-            /* default to use firmware candidate */
-            bool firmwareDifferentFromActive = true;
-
-            /* disable duplicate hash check when running test */
-#if !defined(FIRMWARE_UPDATE_TEST) || (FIRMWARE_UPDATE_TEST == 0)
-
-            /* compare stored firmware with the currently active one */
-            if (heapVersion) {
-                firmwareDifferentFromActive =
-                    (*heapVersion != imageDetails.version);
-            }
-#endif
-
-            /* Only hash check firmwares with higher version number than the
-               active image and with a different hash. This prevents rollbacks
-               and hash checks of old images. If the active image is not valid,
-               bestStoredFirmwareImageDetails.version equals 0.
-            */
-            if ((imageDetails.version > bestStoredFirmwareImageDetails.version) &&
-                    (imageDetails.size > 0) &&
-                    (firmwareDifferentFromActive || !activeFirmwareValid)) {
-                tr_info("Slot %" PRIu32 " firmware integrity check:",
-                        index);
+    bootPhaseEnter(BOOT_PHASE_SLOT_SCAN);
 
-                /* Validate candidate firmware body. */
-                bool firmwareValid = checkStoredApplication(index,
-                                                            &imageDetails);
-
-                if (firmwareValid) {
-                    /* Integrity check passed */
-                    printSHA256(imageDetails.hash);
-                    tr_info("Version: %" PRIu64, imageDetails.version);
-
-                    /* check firmware size fits */
-                    if (imageDetails.size <= MBED_CONF_APP_MAX_APPLICATION_SIZE) {
-                        /* Update best candidate information */
-                        bestStoredFirmwareIndex = index;
-                        bestStoredFirmwareImageDetails.version = imageDetails.version;
-                        bestStoredFirmwareImageDetails.size = imageDetails.size;
-                        memcpy(bestStoredFirmwareImageDetails.hash,
-                               imageDetails.hash,
-                               ARM_UC_SHA256_SIZE);
-                        memcpy(bestStoredFirmwareImageDetails.campaign,
-                               imageDetails.campaign,
-                               ARM_UC_GUID_SIZE);
-                    } else {
-                        /* Firmware candidate size too large */
-                        tr_error("Slot %" PRIu32 " firmware size too large %"
-                                 PRIu32 " > %" PRIu32, index,
-                                 (uint32_t) imageDetails.size,
-                                 (uint32_t) MBED_CONF_APP_MAX_APPLICATION_SIZE);
-                    }
-                } else {
-                    /* Integrity check failed */
-                    tr_error("Slot %" PRIu32 " firmware integrity check failed",
-                             index);
-                }
-            } else {
-                tr_info("Slot %" PRIu32 " firmware is of older date",
-                        index);
-                /* do not print HMAC version
-                printSHA256(imageDetails.hash);
-                */
-                tr_info("Version: %" PRIu64, imageDetails.version);
-            }
-        } else {
-            tr_info("Slot %" PRIu32 " is empty", index);
-        }
-    }
+    bestStoredFirmwareIndex = findStoredFirmware(!SINGLE_PASS_INSTALL,
+                                                 activeFirmwareValid,
+                                                 &bestStoredFirmwareImageDetails);
 
     /*************************************************************************/
     /* Step 3. Apply new firmware if a suitable candidate was found.         */
@@ -361,16 +1097,33 @@ bool upgradeApplicationFromStorage(void)
 
     /* only replace active image if there is a better candidate */
     if (bestStoredFirmwareIndex != INVALID_IMAGE_INDEX) {
+#if SINGLE_PASS_INSTALL
+        /* version of the firmware the install replaces, if it was valid */
+        uint64_t replacedVersion = activeFirmwareValid ?
+                                   imageDetails.version : 0;
+#endif
+
         /* if copy fails, retry up to MAX_COPY_RETRIES */
         for (uint32_t retries = 0; retries < MAX_COPY_RETRIES; retries++) {
             tr_info("Update active firmware using slot %" PRIu32 ":",
                     bestStoredFirmwareIndex);
 
-            activeFirmwareValid = copyStoredApplication(bestStoredFirmwareIndex,
-                                                        &bestStoredFirmwareImageDetails);
+            bootPhaseEnter(BOOT_PHASE_INSTALL);
+
+            bool mismatch = false;
+            bool installed = installStoredFirmware(bestStoredFirmwareIndex,
+                                                   &bestStoredFirmwareImageDetails,
+                                                   &mismatch);
+
+#if defined(XIP_AB_BOOT) && (XIP_AB_BOOT == 1)
+            /* a failed install leaves the booted region untouched */
+            activeFirmwareValid = bootRegionValid;
+#else
+            activeFirmwareValid = installed;
+#endif
 
             /* if image is valid, break out from loop */
-            if (activeFirmwareValid) {
+            if (installed) {
                 tr_info("New active firmware is valid");
 #if defined(FIRMWARE_UPDATE_TEST) && (FIRMWARE_UPDATE_TEST == 1)
                 firmware_update_test_validate();
@@ -379,7 +1132,58 @@ bool upgradeApplicationFromStorage(void)
             } else {
                 tr_error("Firmware update failed");
             }
+
+            /* the stored firmware itself is corrupt, another copy would
+               only erase and program the same data again */
+            if (mismatch) {
+                tr_error("Slot %" PRIu32 " firmware does not match its "
+                         "header, not retrying", bestStoredFirmwareIndex);
+                break;
+            }
+        }
+
+#if SINGLE_PASS_INSTALL
+        /* The candidate was selected on its header alone and failed
+           verification during install, leaving the active region without a
+           header. Fall back to searching for a verified replacement.
+        */
+        if (!activeFirmwareValid) {
+            tr_info("Searching for verified replacement firmware");
+
+            bootPhaseEnter(BOOT_PHASE_SLOT_SCAN);
+
+            /* the active region is empty now, so any verified firmware is
+               better than none, even one older than the replaced one */
+            bestStoredFirmwareImageDetails.version = 0;
+            bestStoredFirmwareIndex = findStoredFirmware(true,
+                                                         false,
+                                                         &bestStoredFirmwareImageDetails);
+
+            if (bestStoredFirmwareIndex != INVALID_IMAGE_INDEX) {
+                if (bestStoredFirmwareImageDetails.version < replacedVersion) {
+                    tr_error("Rolling back from version %" PRIu64 " to %"
+                             PRIu64 ", the replaced firmware was erased by "
+                             "the failed install", replacedVersion,
+                             bestStoredFirmwareImageDetails.version);
+                }
+
+                tr_info("Update active firmware using slot %" PRIu32 ":",
+                        bestStoredFirmwareIndex);
+
+                bootPhaseEnter(BOOT_PHASE_INSTALL);
+
+                activeFirmwareValid = installStoredFirmware(bestStoredFirmwareIndex,
+                                                            &bestStoredFirmwareImageDetails,
+                                                            NULL);
+            }
+
+            if (activeFirmwareValid) {
+                tr_info("New active firmware is valid");
+            } else {
+                tr_error("Active firmware invalid");
+            }
         }
+#endif
     } else if (activeFirmwareValid) {
         tr_info("Active firmware up-to-date");
     } else {
@@ -0,0 +1,76 @@
+#!/usr/bin/env python
+# ----------------------------------------------------------------------------
+# Copyright 2018 ARM Ltd.
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ----------------------------------------------------------------------------
+
+"""Append a chunk manifest to a firmware image.
+
+The output is the payload to sign and upload: the image, the SHA-256 of
+every chunk, the SHA-256 of all chunk digests as root and a 16 byte footer.
+See source/chunk_manifest.h.
+"""
+
+import argparse
+import hashlib
+import struct
+import sys
+
+MAGIC = 0x524B4843
+
+
+def chunk_digests(image, chunk_size):
+    return [hashlib.sha256(image[start:start + chunk_size]).digest()
+            for start in range(0, len(image), chunk_size)]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("input", help="firmware image (.bin)")
+    parser.add_argument("output", help="payload with chunk manifest")
+    parser.add_argument("--chunk-size", type=lambda x: int(x, 0),
+                        default=64 * 1024,
+                        help="chunk size in bytes")
+    parser.add_argument("--max-chunks", type=int, default=32,
+                        help="CHUNK_MANIFEST_MAX_CHUNKS of the bootloader")
+    args = parser.parse_args()
+
+    if args.chunk_size <= 0:
+        sys.exit("chunk size must be positive")
+
+    with open(args.input, "rb") as f:
+        image = f.read()
+
+    digests = chunk_digests(image, args.chunk_size)
+    if len(digests) > args.max_chunks:
+        sys.exit("%d chunks exceed the limit of %d, use a larger chunk size"
+                 % (len(digests), args.max_chunks))
+
+    root = hashlib.sha256(b"".join(digests)).digest()
+    footer = struct.pack("<4L", MAGIC, args.chunk_size, len(digests),
+                         len(image))
+    payload = image + b"".join(digests) + root + footer
+
+    with open(args.output, "wb") as f:
+        f.write(payload)
+
+    print("%s: %d chunks of %d bytes, payload %d bytes, SHA-256 %s" %
+          (args.output, len(digests), args.chunk_size, len(payload),
+           hashlib.sha256(payload).hexdigest()))
+
+
+if __name__ == "__main__":
+    main()
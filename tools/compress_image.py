@@ -0,0 +1,180 @@
+#!/usr/bin/env python
+# ----------------------------------------------------------------------------
+# Copyright 2018 ARM Ltd.
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ----------------------------------------------------------------------------
+
+"""Compress a firmware image for the bootloader.
+
+The output is a 16 byte header followed by one LZ4 block with match offsets
+limited to the bootloader window. See source/compressed_image.h. The
+firmware header must carry the SHA-256 of the uncompressed image, which is
+printed for convenience.
+"""
+
+import argparse
+import hashlib
+import struct
+import sys
+
+MAGIC = 0x57345A4C
+HEADER_SIZE = 16
+WINDOW_SIZE = 4096
+MIN_MATCH = 4
+# LZ4 block rules: the last match starts at least 12 bytes before the end
+# and the last 5 bytes are literals
+MF_LIMIT = 12
+LAST_LITERALS = 5
+MAX_CANDIDATES = 32
+
+
+def encode_length(value):
+    output = bytearray()
+    while value >= 255:
+        output.append(255)
+        value -= 255
+    output.append(value)
+    return output
+
+
+def sequence(literals, offset, match):
+    """Encode one sequence, match 0 ends the block."""
+    literal_nibble = min(len(literals), 15)
+    match_nibble = min(match - MIN_MATCH, 15) if match else 0
+    output = bytearray([(literal_nibble << 4) | match_nibble])
+    if literal_nibble == 15:
+        output += encode_length(len(literals) - 15)
+    output += literals
+    if match:
+        output += struct.pack("<H", offset)
+        if match_nibble == 15:
+            output += encode_length(match - MIN_MATCH - 15)
+    return output
+
+
+def compress(image, window_size):
+    output = bytearray()
+    chains = {}
+    literals = bytearray()
+    position = 0
+    match_limit = len(image) - MF_LIMIT
+
+    def insert(at):
+        key = bytes(image[at:at + MIN_MATCH])
+        chain = chains.setdefault(key, [])
+        chain.append(at)
+        if len(chain) > MAX_CANDIDATES:
+            del chain[0]
+
+    while position < match_limit:
+        best_offset, best_length = 0, 0
+        key = bytes(image[position:position + MIN_MATCH])
+        for candidate in reversed(chains.get(key, [])):
+            offset = position - candidate
+            if offset > window_size:
+                break
+            limit = len(image) - LAST_LITERALS - position
+            length = 0
+            while (length < limit and
+                   image[candidate + length] == image[position + length]):
+                length += 1
+            if length > best_length:
+                best_offset, best_length = offset, length
+
+        if best_length >= MIN_MATCH:
+            output += sequence(literals, best_offset, best_length)
+            literals = bytearray()
+            for at in range(position, position + best_length):
+                insert(at)
+            position += best_length
+        else:
+            insert(position)
+            literals.append(image[position])
+            position += 1
+
+    literals += image[position:]
+    output += sequence(literals, 0, 0)
+    return bytes(output)
+
+
+def decompress(block, size, window_size):
+    """Reference decoder with the bootloader's window limit."""
+    output = bytearray()
+    position = 0
+    while position < len(block):
+        token = block[position]
+        position += 1
+        length = token >> 4
+        if length == 15:
+            while True:
+                value = block[position]
+                position += 1
+                length += value
+                if value != 255:
+                    break
+        output += block[position:position + length]
+        position += length
+        if position == len(block):
+            break
+        (offset,) = struct.unpack_from("<H", block, position)
+        position += 2
+        if offset == 0 or offset > window_size or offset > len(output):
+            raise ValueError("invalid offset")
+        length = (token & 0x0F) + MIN_MATCH
+        if length == 15 + MIN_MATCH:
+            while True:
+                value = block[position]
+                position += 1
+                length += value
+                if value != 255:
+                    break
+        for _ in range(length):
+            output.append(output[-offset])
+    if len(output) != size:
+        raise ValueError("size mismatch")
+    return bytes(output)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("input", help="firmware image (.bin)")
+    parser.add_argument("output", help="compressed payload")
+    parser.add_argument("--window-size", type=int, default=WINDOW_SIZE,
+                        help="COMPRESSED_IMAGE_WINDOW_SIZE of the bootloader")
+    args = parser.parse_args()
+
+    if args.window_size < 1 or args.window_size > 65535:
+        sys.exit("window size must be between 1 and 65535")
+
+    with open(args.input, "rb") as f:
+        image = f.read()
+
+    block = compress(bytearray(image), args.window_size)
+    if decompress(bytearray(block), len(image), args.window_size) != image:
+        sys.exit("compression failed verification")
+
+    payload = struct.pack("<4L", MAGIC, args.window_size, len(image), 0) + block
+
+    with open(args.output, "wb") as f:
+        f.write(payload)
+
+    print("%s: %d bytes (%.1f%% of %d), image SHA-256 %s" %
+          (args.output, len(payload), 100.0 * len(payload) / max(len(image), 1),
+           len(image), hashlib.sha256(image).hexdigest()))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,305 @@
+#!/usr/bin/env python
+# ----------------------------------------------------------------------------
+# Copyright 2018 ARM Ltd.
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ----------------------------------------------------------------------------
+
+"""Create a delta patch that the bootloader applies in place.
+
+The patch rebuilds TARGET from the active application SOURCE one flash
+sector at a time. See source/delta_patch.h for the format. Every patch is
+applied to a simulated flash before it is written, so a patch that would
+read overwritten source bytes is never produced.
+"""
+
+import argparse
+import hashlib
+import random
+import struct
+import sys
+
+MAGIC = 0x50544C44
+HEADER_SIZE = 88
+FLAG_BACKWARD = 0x1
+OP_COPY = 0x00
+OP_DATA = 0x01
+
+# shortest match worth a COPY, an operation costs 9 bytes
+MIN_MATCH = 16
+# bytes used to index the source
+KEY_SIZE = 8
+# candidate positions kept per key
+MAX_CANDIDATES = 16
+
+
+class Layout(object):
+    """Windows of the target: up to the first sector boundary, then sectors."""
+
+    def __init__(self, sector_size, app_start, target_size):
+        self.sector_size = sector_size
+        self.first_window = sector_size - (app_start % sector_size)
+        self.target_size = target_size
+
+    def windows(self):
+        start = 0
+        end = self.first_window
+        while start < self.target_size:
+            yield start, min(end, self.target_size)
+            start = end
+            end += self.sector_size
+
+
+def index_source(source):
+    index = {}
+    for offset in range(0, len(source) - KEY_SIZE + 1):
+        candidates = index.setdefault(source[offset:offset + KEY_SIZE], [])
+        if len(candidates) < MAX_CANDIDATES:
+            candidates.append(offset)
+    return index
+
+
+def match_length(source, target, src, dst, limit):
+    limit = min(limit, len(source) - src)
+    length = 0
+    # compare blocks first, then bytes
+    while (length + 64 <= limit and
+           source[src + length:src + length + 64] ==
+           target[dst + length:dst + length + 64]):
+        length += 64
+    while length < limit and source[src + length] == target[dst + length]:
+        length += 1
+    return length
+
+
+def window_ops(source, target, index, start, end, backward):
+    """Operations that build target[start:end] from the remaining source."""
+    ops = []
+    literal = bytearray()
+    position = start
+    last_shift = None
+
+    def usable(src, length):
+        # length of the match that only uses source bytes not overwritten yet
+        if backward:
+            return max(0, min(length, end - src))
+        return length if src >= start else 0
+
+    while position < end:
+        best_src, best_length = None, 0
+        candidates = []
+        if last_shift is not None:
+            candidates.append(position + last_shift)
+        key = target[position:position + KEY_SIZE]
+        if len(key) == KEY_SIZE:
+            candidates.extend(index.get(key, []))
+        for src in candidates:
+            if src < 0 or src >= len(source):
+                continue
+            length = usable(src, match_length(source, target, src, position,
+                                              end - position))
+            if length > best_length:
+                best_src, best_length = src, length
+
+        if best_length >= MIN_MATCH:
+            if literal:
+                ops.append((OP_DATA, bytes(literal)))
+                literal = bytearray()
+            ops.append((OP_COPY, best_src, best_length))
+            last_shift = best_src - position
+            position += best_length
+        else:
+            literal.append(target[position])
+            position += 1
+
+    if literal:
+        ops.append((OP_DATA, bytes(literal)))
+    return ops
+
+
+def encode_ops(ops):
+    output = bytearray()
+    for op in ops:
+        if op[0] == OP_COPY:
+            output += struct.pack("<BLL", OP_COPY, op[2], op[1])
+        else:
+            output += struct.pack("<BL", OP_DATA, len(op[1])) + op[1]
+    return bytes(output)
+
+
+def create_patch(source, target, sector_size, app_start, backward):
+    layout = Layout(sector_size, app_start, len(target))
+    index = index_source(source)
+    windows = list(layout.windows())
+    if backward:
+        windows.reverse()
+
+    body = b"".join(encode_ops(window_ops(source, target, index, start, end,
+                                          backward))
+                    for start, end in windows)
+
+    header = struct.pack("<6L", MAGIC, FLAG_BACKWARD if backward else 0,
+                         sector_size, layout.first_window, len(source),
+                         len(target))
+    header += hashlib.sha256(source).digest()
+    header += hashlib.sha256(target).digest()
+    assert len(header) == HEADER_SIZE
+    return header + body
+
+
+def apply_patch(source, patch, app_start):
+    """Apply a patch like the bootloader does, on a simulated flash.
+
+    The flash holds the source. Each window is staged, then its sector is
+    erased and programmed. Reading an erased byte raises an error.
+    """
+    (magic, flags, sector_size, first_window, source_size,
+     target_size) = struct.unpack_from("<6L", patch, 0)
+    if magic != MAGIC or source_size != len(source):
+        raise ValueError("patch does not apply to this source")
+    if hashlib.sha256(source).digest() != patch[24:56]:
+        raise ValueError("source hash mismatch")
+
+    backward = bool(flags & FLAG_BACKWARD)
+    layout = Layout(sector_size, app_start, target_size)
+    if layout.first_window != first_window:
+        raise ValueError("patch made for a different application start")
+
+    size = max(source_size, target_size) + sector_size
+    flash = bytearray(source) + bytearray(size - source_size)
+    erased = [False] * size
+
+    windows = list(layout.windows())
+    if backward:
+        windows.reverse()
+
+    offset = HEADER_SIZE
+    for start, end in windows:
+        staging = bytearray()
+        while start + len(staging) < end:
+            op, length = struct.unpack_from("<BL", patch, offset)
+            offset += 5
+            if length == 0 or start + len(staging) + length > end:
+                raise ValueError("operation crosses a window")
+            if op == OP_COPY:
+                (src,) = struct.unpack_from("<L", patch, offset)
+                offset += 4
+                if src + length > source_size:
+                    raise ValueError("copy beyond source")
+                if backward and src + length > end:
+                    raise ValueError("copy from a later window")
+                if not backward and src < start:
+                    raise ValueError("copy from an earlier window")
+                if any(erased[src:src + length]):
+                    raise ValueError("copy from overwritten flash")
+                staging += flash[src:src + length]
+            elif op == OP_DATA:
+                staging += patch[offset:offset + length]
+                offset += length
+            else:
+                raise ValueError("unknown operation %d" % op)
+
+        # erase the whole sector, which may extend past the target
+        sector_end = start + (first_window if start == 0 else sector_size)
+        for address in range(start, sector_end):
+            erased[address] = True
+        flash[start:end] = staging
+
+    target = bytes(flash[:target_size])
+    if hashlib.sha256(target).digest() != patch[56:88]:
+        raise ValueError("target hash mismatch")
+    return target
+
+
+def self_test():
+    rng = random.Random(1)
+    sector_size = 4096
+    for case in range(12):
+        source = bytes(bytearray(rng.getrandbits(8)
+                                 for _ in range(rng.randint(1, 40000))))
+        target = bytearray(source)
+        for _ in range(rng.randint(0, 6)):
+            position = rng.randint(0, len(target))
+            action = rng.randint(0, 2)
+            if action == 0:
+                target[position:position] = bytearray(
+                    rng.getrandbits(8) for _ in range(rng.randint(1, 3000)))
+            elif action == 1:
+                del target[position:position + rng.randint(1, 3000)]
+            else:
+                target[position:position + 100] = bytearray(
+                    rng.getrandbits(8) for _ in range(100))
+        if not target:
+            target = bytearray(b"\x00")
+        target = bytes(target)
+        app_start = rng.choice([0x8000, 0xA400, 0x10400])
+        for backward in (False, True):
+            patch = create_patch(source, target, sector_size, app_start,
+                                 backward)
+            assert apply_patch(source, patch, app_start) == target
+    print("self test passed")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("source", nargs="?", help="active application (.bin)")
+    parser.add_argument("target", nargs="?", help="new application (.bin)")
+    parser.add_argument("output", nargs="?", help="delta patch to store")
+    parser.add_argument("--sector-size", type=lambda x: int(x, 0),
+                        default=4096, help="flash sector size")
+    parser.add_argument("--app-start", type=lambda x: int(x, 0),
+                        help="application start address")
+    parser.add_argument("--direction", choices=["auto", "forward", "backward"],
+                        default="auto",
+                        help="window order, auto picks the smaller patch")
+    parser.add_argument("--self-test", action="store_true",
+                        help="apply random patches to a simulated flash")
+    args = parser.parse_args()
+
+    if args.self_test:
+        self_test()
+        return
+
+    if not (args.source and args.target and args.output and
+            args.app_start is not None):
+        parser.error("source, target, output and --app-start are required")
+
+    with open(args.source, "rb") as f:
+        source = f.read()
+    with open(args.target, "rb") as f:
+        target = f.read()
+
+    directions = {"auto": [False, True], "forward": [False],
+                  "backward": [True]}[args.direction]
+    patches = [create_patch(source, target, args.sector_size, args.app_start,
+                            backward) for backward in directions]
+    patch = min(patches, key=len)
+
+    try:
+        apply_patch(source, patch, args.app_start)
+    except ValueError as error:
+        sys.exit("patch failed verification: %s" % error)
+
+    with open(args.output, "wb") as f:
+        f.write(patch)
+
+    print("%s: %d bytes (%.1f%% of target), %s" %
+          (args.output, len(patch), 100.0 * len(patch) / len(target),
+           "backward" if struct.unpack_from("<L", patch, 4)[0] & FLAG_BACKWARD
+           else "forward"))
+
+
+if __name__ == "__main__":
+    main()